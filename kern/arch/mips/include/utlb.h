@@ -0,0 +1,48 @@
+#ifndef _MIPS_UTLB_H_
+#define _MIPS_UTLB_H_
+
+/*
+ * Definitions shared by the C code of the TLB (vm_tlb.c) and by the fast path of the UTLB exception handler (utlb_refill in
+ * exception-mips1.S), that is used with the kernel option utlb_refill. This file is included by assembly code, so it must
+ * contain only macros.
+ *
+ * Each CPU has a refill table (see struct tlb in vm_tlb.h): a direct mapped table of the pages resident on the CPU, that always
+ * contains the pages of all the valid slots of its TLB. On a miss the handler looks for the page in the table and, if it's there,
+ * writes it in a free slot or in the next slot of the round robin, without calling the VM: the entry that it overwrites is still in
+ * the table, so the frames considered in the TLB by the IPT don't change.
+ */
+
+#define UTLB_SETS 128 /* entries of the refill table (twice the slots of the TLB) */
+#define UTLB_SLOTS 64 /* slots of the TLB (NUM_TLB in mips/tlb.h, that can't be included here) */
+
+/*
+ * Set of an entry, computed from its EntryHi: the low bits of the virtual page number are mixed with the ASID, so that the same
+ * page of different processes goes to different sets. The handler computes it in the same way.
+ */
+#define UTLB_SET(hi) ((((hi) >> 12) ^ ((hi) >> 6)) & (UTLB_SETS - 1))
+
+/*
+ * Option utlb_trace: trace161 flag ('k', kernel instructions) turned on at the UTLB vector and off just before the rfe that ends the
+ * refill, both by the fast path and by the slow path (see arch/mips/vm/utlb_trace.c), so that trace161 prints only the instructions
+ * of the refills. exception_return recognizes the end of a refill by its exception code, EX_TLBL or EX_TLBS (UTLB_EX_TLBL + 1).
+ */
+#define UTLB_TRACE 107
+#define UTLB_EX_TLBL 2 /* EX_TLBL in mips/trapframe.h, that can't be included here */
+
+/*
+ * Offsets of the fields of struct tlb read and written by the handler. tlb_init checks them at compile time.
+ */
+#define UTLB_SH_IPT 0        /* ipt_index[] */
+#define UTLB_SH_PID 256      /* pid[] */
+#define UTLB_SH_VADDR 512    /* vaddr[] */
+#define UTLB_FREE 768        /* free_slots[] */
+#define UTLB_NFREE 1024      /* nfree */
+#define UTLB_HAND 1028       /* hand */
+#define UTLB_RF_HI 1032      /* refill_hi[] */
+#define UTLB_RF_LO 1544      /* refill_lo[] */
+#define UTLB_RF_IPT 2056     /* refill_ipt[] */
+#define UTLB_RF_PID 2568     /* refill_pid[] */
+#define UTLB_REFILLS 3080    /* fast_refills */
+#define UTLB_SAVE 3084       /* utlb_save[], where the handler saves t0-t3 */
+
+#endif /* _MIPS_UTLB_H_ */
@@ -114,17 +114,42 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * A shootdown carries a batch of up to TS_BATCH invalidations of the
+ * same kind, so that (for example) several frames stolen from the
+ * TLBs cost a single IPI:
+ *
+ *   TS_PID:    invalidate all the entries of process ts_pid
+ *              (ts_count is 0).
+ *   TS_PAGE:   invalidate the entries of process ts_pid that map the
+ *              virtual pages in ts_arg.
+ *   TS_FRAMES: invalidate the entries that map the frames (IPT
+ *              indexes) in ts_arg, whatever process they belong to.
+ *
+ * ts_wait is decremented by each target cpu once the shootdown has
+ * been performed; the sender waits for it to reach zero.
+ *
+ * Each cpu has at most a shootdown in flight for each thread that is
+ * sending one, so 32 queued requests are more than enough for the
+ * number of cpus sys161 supports.
  */
 
+#define TS_PID    0
+#define TS_PAGE   1
+#define TS_FRAMES 2
+
+#define TS_BATCH  8
+
+struct tlbshootdown_wait;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	int ts_type;			/* TS_PID, TS_PAGE or TS_FRAMES */
+	pid_t ts_pid;			/* process, for TS_PID and TS_PAGE */
+	unsigned ts_count;		/* number of elements in ts_arg */
+	uint32_t ts_arg[TS_BATCH];	/* virtual pages or IPT indexes */
+	struct tlbshootdown_wait *ts_wait;	/* completion counter */
 };
 
-#define TLBSHOOTDOWN_MAX 16
+#define TLBSHOOTDOWN_MAX 32
 
 
 #endif /* _MIPS_VM_H_ */
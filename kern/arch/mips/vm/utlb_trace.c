@@ -0,0 +1,30 @@
+#include <types.h>
+#include <lib.h>
+#include <mips/trapframe.h>
+#include <mips/utlb.h>
+#include <lamebus/ltrace.h>
+#include <vm_tlb.h>
+
+/*
+ * Trace of the TLB refills (option utlb_trace). The UTLB vector turns on the trace161 flag UTLB_TRACE before going to the fast
+ * path or to common_exception, and the refill turns it off just before its rfe (see exception-mips1.S), both with and without
+ * utlb_refill. So running the same program under trace161 with and without utlb_refill compares the whole cost of a refill,
+ * exception entry and return included.
+ */
+
+uint32_t utlb_trace_reg; // address of the trace-on register of trace161 (the trace-off one follows it), 0 without the trace device
+
+void tlb_trace_init(void){
+    /*exception_return checks the exception code with the values of mips/utlb.h*/
+    COMPILE_ASSERT(UTLB_EX_TLBL == EX_TLBL);
+    COMPILE_ASSERT(EX_TLBS == EX_TLBL + 1);
+    utlb_trace_reg = (uint32_t)ltrace_tron_addr();
+}
+
+void tlb_trace_on(void){
+    ltrace_on(UTLB_TRACE);
+}
+
+void tlb_trace_off(void){
+    ltrace_off(UTLB_TRACE);
+}
@@ -107,6 +107,16 @@ ltrace_eraseprof(void)
 	}
 }
 
+void *
+ltrace_tron_addr(void)
+{
+	if (the_trace == NULL) {
+		return NULL;
+	}
+	return bus_map_area(the_trace->lt_busdata, the_trace->lt_buspos,
+			    LTRACE_REG_TRON);
+}
+
 int
 config_ltrace(struct ltrace_softc *sc, int ltraceno)
 {
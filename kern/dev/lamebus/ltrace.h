@@ -47,6 +47,7 @@ struct ltrace_softc {
  *   ltrace_stop:  causes sys161/trace161 to drop to the debugger.
  *   ltrace_setprof: turn on and off trace161 profile collection.
  *   ltrace_eraseprof: discard trace161 profile collected so far.
+ *   ltrace_tron_addr: address of the trace-on register, for assembly code.
  *
  * The flags for ltrace_on/off are the characters used to control
  * tracing on the trace161 command line. See the System/161 manual for
@@ -78,6 +79,11 @@ struct ltrace_softc {
  * data, if trace161 is collecting a profile. (Otherwise it does
  * nothing.) This can be used to e.g. exclude bootup actions from your
  * profile.
+ *
+ * ltrace_tron_addr returns the kernel virtual address of the register
+ * written by ltrace_on (the one written by ltrace_off follows it), or
+ * NULL if there is no trace device. It is for code that can't call
+ * functions, like the UTLB exception handler.
  */
 void ltrace_on(uint32_t code);
 void ltrace_off(uint32_t code);
@@ -86,5 +92,6 @@ void ltrace_dump(uint32_t code);
 void ltrace_stop(uint32_t code);
 void ltrace_setprof(uint32_t onoff);
 void ltrace_eraseprof(void);
+void *ltrace_tron_addr(void);
 
 #endif /* _LAMEBUS_LTRACE_H_ */
@@ -44,11 +44,12 @@
 #include "current.h"
 #include "opt-project.h"
 #include "opt-debug.h"
+#include "opt-sw_list.h"
 
 struct vnode;
+struct swap_map;
 #if OPT_PROJECT
 struct spinlock stealmem_lock;
-struct semaphore *sem_fork;
 #endif
 
 #define DUMBVM_STACKPAGES    18
@@ -82,6 +83,12 @@ struct addrspace {
         size_t initial_offset1;
         size_t initial_offset2;
         int valid;
+        uint32_t asid[MAXCPUS];//ASID used to tag the TLB entries of this address space on each CPU (each TLB has its own ASIDs)
+        uint32_t asid_generation[MAXCPUS];//Generation in which asid was assigned on each CPU. If it's old, the ASID must be reassigned
+        uint32_t tlb_cpus;//Bitmask of the CPUs whose TLB may contain entries of this address space. Only the thread of the process changes it
+#if OPT_SW_LIST
+        struct swap_map *as_swap;//Pages of this address space that are in the swapfile (see swapfile.h)
+#endif
 #endif
 };
 
@@ -168,9 +175,4 @@ vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 void addrspace_init(void);
 
-/**
- * It creates the semaphore used to protect sys_fork
-*/
-void create_sem_fork(void);
-
 #endif /* _ADDRSPACE_H_ */
@@ -125,10 +125,15 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_lockstats returns how many times the subpage allocator took
+ * its spinlock and how many kmalloc/kfree were served by the per-cpu
+ * magazines without it (always 0 without the option magazine).
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
 void kheap_printstats(void);
+void kheap_lockstats(uint32_t *locks, uint32_t *saved);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
@@ -6,7 +6,15 @@
 #include "kern/errno.h"
 #include "synch.h"
 #include "spl.h"
+#include "spinlock.h"
+#include "wchan.h"
 #include "opt-debug.h"
+#include "opt-readahead.h"
+#include "opt-pageout.h"
+#include "opt-zero_pool.h"
+#include "opt-text_share.h"
+#include "opt-page_cache.h"
+#include "opt-buddy.h"
 
 int pt_active;
 #if OPT_DEBUG
@@ -21,34 +29,154 @@ struct pt_entry
 {                 // this is an entry of our IPT
     vaddr_t page; // virt page in the frame
     pid_t pid;    // processID
-    uint8_t ctl;  // some bits for control; from the lower:  Validity bit, Reference bit, isInTLB bit, ...
+    uint8_t ctl;  // some bits for control; from the lower:  Validity bit, Reference bit, isInTLB bit, Busy bit, ...
+    uint8_t tlb;  // number of TLB slots that map the frame. It can be higher than 1 only if the frame is shared after a fork
 } entr;
 
+/*
+ * Node of the list of processes that share a frame with its owner (pid field of the IPT entry) after a fork.
+ * The frame is mapped read-only by all of them, and it's copied on the first write (copy on write).
+ */
+struct sharer
+{
+    pid_t pid;
+    struct sharer *next;
+};
+
+#define FRAME_WCHANS 16 // Number of wait channels for busy frames. Frame i uses frame_wchan[i % FRAME_WCHANS]
+
+#if OPT_PAGE_CACHE
+#if !OPT_TEXT_SHARE
+#error "page_cache keeps its pages in the file index of text_share"
+#endif
+#define PCACHE_VNODES 16 // Maximum number of ELF files that can have pages in the page cache at the same time
+#endif
+
+#if OPT_BUDDY
+/*
+ * Buddy allocator of the kernel pages: alloc_kpages takes blocks of 2^k frames from a pool of chunks of 2^BUDDY_MAX_ORDER frames, aligned
+ * in the IPT. The pool grows by one chunk when no free block is big enough, and the chunks that become entirely free are given back to
+ * the free list of the IPT, except BUDDY_SPARE_CHUNKS of them.
+ */
+#define BUDDY_MAX_ORDER 4 // a chunk (and the biggest block) has 16 frames. Bigger allocations use the scan of the IPT
+#define BUDDY_SPARE_CHUNKS 1 // free chunks kept in the pool, so that a kmalloc/kfree pattern doesn't take and give back a chunk every time
+#endif
+
 struct ptInfo
 {
     struct pt_entry *pt;    // our IPT
     int ptSize;             // IPT size, in number of pte
     paddr_t firstfreepaddr; // Offset to use to compute the physical address of the frames
-    struct lock *pt_lock;   // Necessary for the cv
-    struct cv *pt_cv;       // Used to sleep if the IPT is full
+    struct spinlock pt_spinlock; // Protects the IPT, the free list, the sharers and the hash table. It's never held during I/O, kmalloc or kfree
+    struct wchan *frame_wchan[FRAME_WCHANS]; // Used to wait until a busy frame (loaded, stored or copied) is ready
+    struct wchan *victim_wchan; // Used to sleep if all the frames are busy, in the TLB or allocated with kmalloc
     int *contiguous;        // Used to keep track of how many pages we need to free
+    int *free_next;         // Next frame in the free list (-1 if it's the last one)
+    int *free_prev;         // Previous frame in the free list (-1 if it's the first one)
+    int free_head;          // First frame of the free list, -1 if there are no free frames
+    int free_tail;          // Last frame of the free list, -1 if there are no free frames
+    int nfree;              // Number of frames currently in the free list
+    struct sharer **sharers; // For each frame, the other processes that map it (copy on write). NULL if the frame is private
+    struct sharer *spare_sharers; // Sharers released while holding pt_spinlock. They can't be freed there, so they're reused by the next forks
+    #if OPT_PAGEOUT
+    struct wchan *pageout_wchan; // The pageout daemon sleeps here while there are enough free frames
+    int pageout_low;        // Low watermark: the daemon is woken up when the free frames are less than pageout_low
+    int pageout_high;       // High watermark: once woken up, the daemon frees frames until they're pageout_high
+    #endif
+    #if OPT_ZERO_POOL
+    struct wchan *zero_wchan; // The zeroing thread sleeps here while the pool is full or there's nothing to zero
+    int nzeroed;            // Number of free frames that are already zeroed. They're at the tail of the free list
+    int zero_target;        // The zeroing thread stops when nzeroed reaches zero_target
+    #endif
+    #if OPT_TEXT_SHARE
+    struct vnode **file_vnode; // For each frame, the ELF file of its page. NULL if the frame isn't in the file index
+    off_t *file_offset;     // For each frame in the file index, the offset of its page in the ELF file
+    int *file_next;         // Next frame in the same bucket of the file index (-1 if it's the last one)
+    int *file_buckets;      // First frame of each bucket of the file index, -1 if the bucket is empty
+    #endif
+    #if OPT_PAGE_CACHE
+    struct vnode *cache_vnodes[PCACHE_VNODES]; // ELF files referenced by the page cache (VOP_INCREF), NULL if the slot is empty
+    int cache_vnode_pages[PCACHE_VNODES]; // Number of frames of each file in the file index. The files with 0 frames are closed by page_cache_reap
+    #endif
+    #if OPT_BUDDY
+    int buddy_free[BUDDY_MAX_ORDER + 1]; // First free block of each order, -1 if there are none. The blocks are linked with free_next and free_prev
+    int *buddy_order;       // For each frame, the order of the free block that begins there, -1 if it isn't the first frame of a free block
+    uint8_t *buddy_chunk;   // For each chunk of 2^BUDDY_MAX_ORDER frames, 1 if it belongs to the pool of the kernel pages
+    int buddy_chunks;       // Number of chunks in the pool
+    int buddy_free_chunks;  // Number of chunks of the pool that are entirely free
+    int buddy_nfree;        // Number of free frames in the pool
+    #endif
 } peps;
 
-struct hashentry // single entry of hashtable
+struct hashentry // single slot of the hash table
 {
-    int iptentry;           // "ptr" to IPT entry
-    vaddr_t vad;            // virtual address of the entry
+    vaddr_t vad;            // virtual address of the entry, 0 if the slot is empty
     pid_t pid;              // pid of the entry
-    struct hashentry *next; // ptr to next hashentry
+    int iptentry;           // "ptr" to IPT entry
 };
 
-struct hashT // struct
+struct hashT // open addressing hash table (linear probing)
 {
-    struct hashentry **table; // array of list of hashentry with dimension size.
-    int size;                 // 2 times the IPT
+    struct hashentry *table; // array of slots with dimension size. Colliding entries are stored in the following slots, so a lookup reads contiguous memory
+    int size;                // number of slots, always a power of 2 and at least 2 times the IPT
+    int bits;                // log2(size), used by the hash function
+    int count;               // number of slots currently used
 } htable;
 
-struct hashentry *unusedptrlist; // list where all unused blocks for the hast table are stored
+#define TSB_SIZE 2048 // number of entries of the TSB, a power of 2
+
+/*
+ * Translation cache (TSB) in front of the hash table: a direct mapped array of TSB_SIZE entries, tagged with the pid, that is filled
+ * when a lookup in the hash table succeeds. A page is in the TSB only if it's also in the hash table, since every removal from the
+ * hash table removes it from the TSB too, so a reload is usually satisfied by a single probe.
+ * It's protected by pt_spinlock.
+ */
+struct hashentry *tsb;
+
+#if OPT_READAHEAD
+/*
+ * Readahead of the ELF file: when a page fault reads a page from the ELF file, the following pages of the same segment that aren't in
+ * RAM are read together with it, in free frames. Each process has its own window, that starts from RA_WINDOW_INIT pages: it grows by one
+ * page each time a page read ahead is used, and it's halved each time one is evicted (or freed) before being used.
+ */
+#define RA_WINDOW_INIT 4 // initial number of pages read ahead
+#define RA_WINDOW_MAX 8 // maximum number of pages read ahead
+#define RA_MIN_FREE 16 // the readahead never takes the last RA_MIN_FREE free frames, that are left to the page faults
+#endif
+
+#if OPT_PAGEOUT
+/*
+ * Pageout daemon: a kernel thread that keeps some free frames, so that the page faults don't have to select a victim and wait for
+ * its store in the swapfile. The default watermarks are a percentage of the IPT, and they can be changed from the menu (pageout).
+ */
+#define PAGEOUT_LOW_PCT 5 // default low watermark, in percentage of the frames of the IPT
+#define PAGEOUT_HIGH_PCT 10 // default high watermark, in percentage of the frames of the IPT
+#endif
+
+#if OPT_ZERO_POOL
+/*
+ * Pool of zeroed frames: a kernel thread zeroes the free frames in advance, so that the page faults on stack pages and on the pages of the
+ * data segment after the end of the file can use them without calling bzero.
+ */
+#define ZERO_POOL_PCT 10 // size of the pool, in percentage of the frames of the IPT
+#endif
+
+#if OPT_TEXT_SHARE
+/*
+ * File index: the frames that contain a text page read from the ELF file are indexed by (vnode, offset), so that all the processes
+ * running the same program map the same frame, as sharers (see struct sharer), instead of reading their own copy.
+ */
+#define FILE_BUCKETS 256 // number of buckets of the file index, a power of 2
+#endif
+
+#if OPT_PAGE_CACHE
+/*
+ * Page cache: the file index contains also the data pages read from the ELF file, and its frames stay in RAM after the last process
+ * that maps them ends, owned by PCACHE_PID, until the replacement policy selects them. A cached frame is never written: the processes
+ * that map it copy it on the first write, as if it was shared.
+ */
+#define PCACHE_PID 0 // owner of the frames of the page cache that no process maps. Pids start from 1
+#endif
 
 /**
  * It initializes the page table.
@@ -74,15 +202,19 @@ int pt_get_paddr(vaddr_t, pid_t);
  *  return the physical position of the page
  *
  * @param vaddr_t: virtual address
+ * @param int *: set to 1 if the page was already in the IPT (TLB reload), 0 otherwise
  *
  *
  * @return physical address found inside the IPT
  */
-paddr_t get_page(vaddr_t);
+paddr_t get_page(vaddr_t, int *);
 
 /**
- * This function finds a victim in the IPT and the updates the hash table.
+ * This function finds a victim in the IPT. The old page is removed from the hash table for all the processes that mapped it,
+ * while the new one must be added by the caller.
  *  it uses a second chance algorithm based on TLB presence and reference bit
+ * It must be called with pt_spinlock held, and it returns with pt_spinlock held, but the lock is released while the old page is
+ * stored in the swapfile. The frame is returned busy.
  * @param vaddr_t: virtual address
  * @param pid_t: pid of the process
  *
@@ -102,7 +234,9 @@ int find_victim(vaddr_t, pid_t);
 void free_pages(pid_t);
 
 /**
- * This function inserts into the hash table, from unusedptrlist, a page, in order to fastly find the index
+ * This function inserts into the hash table a page, in order to fastly find the index.
+ * If the load factor would become higher than 1/2, the table is doubled before the insertion. It must be called with pt_spinlock
+ * held, which is released while the new table is allocated.
  *
  * @param vaddr_t: virtual address
  * @param pid_t: pid of the process
@@ -113,14 +247,61 @@ void free_pages(pid_t);
 void add_in_hash(vaddr_t, pid_t, int);
 
 /**
- * This function advices that a frame(virtual address) is removed from TLB.
+ * This function advices that a frame is removed from TLB.
+ * The index is provided by the shadow of the TLB, so we don't need to search the page in the IPT.
  *
- * @param vaddr_t: virtual address
+ * @param int: index of the frame in the IPT
+ * @param int: 1 if the TLB slot was referenced, so that the reference bit of the frame must be set
+ *
+ *
+ * @return 1 if everything ok
+ */
+int update_tlb_bit(int, int);
+
+/**
+ * This function tells if a page has been written since it was loaded. A clean page can be removed from the IPT without
+ * storing it in the swapfile.
+ *
+ * @param int: index of the frame in the IPT
  *
  *
- * @return 1 if everything ok, -1 otherwise
+ * @return 1 if the page is dirty, 0 otherwise
  */
-int update_tlb_bit(vaddr_t, pid_t);
+int get_dirty_bit(int);
+
+/**
+ * This function marks a page as dirty. It's called on the first write to the page.
+ *
+ * @param int: index of the frame in the IPT
+ *
+ */
+void set_dirty_bit(int);
+
+/**
+ * This function tells if a frame is shared by more processes after a fork.
+ *
+ * @param int: index of the frame in the IPT
+ *
+ * @return 1 if the frame is shared, 0 otherwise
+ */
+int is_shared(int);
+
+/**
+ * This function is called on the first write of the current process on a page. If the frame is private, it's just marked as dirty.
+ * Otherwise the page is copied in a new frame that becomes private to the current process (copy on write).
+ *
+ * @param vaddr_t: virtual address of the page
+ * @param int: index of the frame currently mapped by the process
+ *
+ * @return physical address of the frame that can be written, 0 if the frame doesn't map the page anymore (the access must be retried)
+ */
+paddr_t get_writable_page(vaddr_t, int);
+
+/**
+ * This function is called when the swapfile is full. It releases some swapfile entries that are just copies of clean pages
+ * in RAM (swap cache), marking these pages as dirty.
+ */
+void reclaim_swap_cache(void);
 
 /**
  * This function inserts in the IPT some kernel memory in a contiguous way
@@ -152,33 +333,83 @@ int get_index_from_hash(vaddr_t, pid_t);
 void free_contiguous_pages(vaddr_t);
 
 /**
- * This function is used to copy inside PT or Swap-file all the pages of the old pid for the new one
+ * This function is used to share with the new pid all the frames of the old one (copy on write). No page is copied:
+ * the new pid is added to the sharers of each frame and to the hash table.
+ * It must be called with pt_spinlock held after pt_entries_ready returned 1, so it never sleeps.
  *
  * @param pid_t: old pid to copy from
  * @param pid_t: new pid to add for each page
+ * @param struct sharer **: pool of sharers reserved for this fork. The used ones are removed from it
  *
  */
-void copy_pt_entries(pid_t, pid_t);
+void copy_pt_entries(pid_t, pid_t, struct sharer **);
 
 /**
- * This function setups some bits before the copy_pt_entries related to a fork
+ * This function prepares what copy_pt_entries needs for a fork: a sharer for each frame of the old pid and enough free slots
+ * in the hash table. It also waits for the busy frames of the old pid. Since it sleeps (and so old may lose or gain frames), the
+ * caller must check with pt_entries_ready, holding pt_spinlock, that nothing is missing.
  *
- * @param pid_t: pages with that pid will be prepared for SWAP
+ * @param pid_t: old pid to copy from
+ * @param struct sharer **: pool of sharers of the fork, initially NULL
+ */
+void reserve_pt_entries(pid_t, struct sharer **);
+
+/**
+ * This function tells if copy_pt_entries can be performed without sleeping. It must be called with pt_spinlock held.
  *
+ * @param pid_t: old pid to copy from
+ * @param struct sharer *: pool of sharers of the fork
  *
- * @return void
+ * @return 1 if no frame of old is busy and the pool and the hash table are big enough, 0 otherwise
  */
-void prepare_copy_pt(pid_t);
+int pt_entries_ready(pid_t, struct sharer *);
 
 /**
- * This function setups setups to zero all the SWAP bits related to the passed pid
+ * This function frees the sharers reserved for a fork and not used by copy_pt_entries.
  *
- * @param pid_t: pages with this pid will be updated with SWAP-bit=0
+ * @param struct sharer *: pool of sharers of the fork
+ */
+void release_pt_pool(struct sharer *);
+
+#if OPT_BUDDY
+/**
+ * This function prints the state of the buddy allocator: the chunks of the pool, its free frames, the free blocks of each order and
+ * how fragmented they are, together with the longest run of free frames in the IPT. It's called by vm_shutdown and by the menu (kfrag).
+ */
+void buddy_print_stats(void);
+#endif
+
+#if OPT_PAGE_CACHE
+/**
+ * This function closes the ELF files that are referenced by the page cache but don't have pages in it anymore. It can't be done when
+ * their last frame is evicted, since pt_spinlock is held and closing a file may sleep, so it's called by as_destroy.
+ */
+void page_cache_reap(void);
+#endif
+
+#if OPT_PAGEOUT
+/**
+ * This function starts the pageout daemon. It's called by vm_bootstrap, after the initialization of the IPT.
+ */
+void pageout_start(void);
+
+/**
+ * This function changes the watermarks of the pageout daemon.
  *
+ * @param int: new low watermark, in frames
+ * @param int: new high watermark, in frames
  *
- * @return void
+ * @return 0 if everything ok, EINVAL if the watermarks aren't 0 < low < high <= half of the IPT
  */
-void end_copy_pt(pid_t);
+int pageout_set_watermarks(int, int);
+#endif
+
+#if OPT_ZERO_POOL
+/**
+ * This function starts the thread that fills the pool of zeroed frames. It's called by vm_bootstrap, after the initialization of the IPT.
+ */
+void zero_pool_start(void);
+#endif
 
 /**
  * Debugging function, used to print number of kmalloc - number of kfree
@@ -186,7 +417,10 @@ void end_copy_pt(pid_t);
 void print_nkmalloc(void);
 
 /**
- * This function removes from the hash table a list block and adds it again in unusedptrlist
+ * This function removes an entry from the hash table. The following entries of the same cluster are shifted back,
+ * so that we never need tombstones and lookups never get slower after many removals.
+ * The entry is removed from the TSB too: all the pages that leave the IPT (victims in find_victim, free_pages, frames taken by
+ * get_contiguous_pages, copies on write) pass from here.
  *
  *
  * @param vaddr_t: virtual address
@@ -198,7 +432,8 @@ void print_nkmalloc(void);
 void remove_from_hash(vaddr_t, pid_t);
 
 /**
- * This function uses an hash function in order to calculate the entry in the hash table
+ * This function uses an hash function in order to calculate the entry in the hash table.
+ * The virtual page number and the pid are packed in a single key, that is then spread on the table with a Fibonacci (multiplicative) hash.
  *
  * @param vaddr_t: virtual address
  * @param pid_t: pid of the process
@@ -213,4 +448,15 @@ int get_hash_func(vaddr_t, pid_t);
  */
 void htable_init(void);
 
+/**
+ * This function initializes the TSB. All the entries are empty.
+ */
+void tsb_init(void);
+
+/**
+ * This function prints the current occupation of the hash table and the length of its longest cluster.
+ * It's called by vm_shutdown, together with print_stats.
+ */
+void htable_print_stats(void);
+
 #endif
\ No newline at end of file
@@ -19,6 +19,10 @@
 #include "vmstats.h"
 #include "opt-project.h"
 #include "opt-debug.h"
+#include "opt-readahead.h"
+#include "opt-zero_pool.h"
+#include "opt-text_share.h"
+#include "opt-page_cache.h"
 
 /**
  * Given the virtual address vaddr, it finds the corresponding page and it loads it into the provided paddr.
@@ -27,8 +31,60 @@
  * @param pid: pid of the process that caused the page fault
  * @param paddr: the physical address in which we'll load the page
  * 
- * @return 0 if everything goes fine, otherwise the error code returned from VOP_READ
+ * @return 1 if the page was read from the swapfile, 2 if it was read from the swapfile and its entry was kept (swap cache),
+ *         0 if it was read from the ELF file or zero-filled. In the last two cases the page can be dropped without saving it
+ *         as long as it's not written, since we can load it again in the same way.
  */
 int load_page(vaddr_t vaddr, pid_t pid, paddr_t paddr);
 
+#if OPT_ZERO_POOL
+/**
+ * It tells if load_page would zero-fill the whole page vaddr when it's not in the swapfile. In this case the page fault can use a frame
+ * taken from the pool of zeroed frames, without calling load_page.
+ * 
+ * @param vaddr: the virtual address that caused the page fault
+ * 
+ * @return 1 for a stack page, 2 for a page of the data segment after the end of the file, 0 otherwise
+ */
+int zero_fill_type(vaddr_t vaddr);
+#endif
+
+#if OPT_TEXT_SHARE
+/**
+ * It tells if vaddr belongs to the text segment (or, with the page cache, if it's a page of the data segment read from the ELF file),
+ * with the same checks of load_page. In this case it returns the key of the page in the file index: the vnode of the ELF file and the
+ * offset of the page in the file. It never sleeps, so it can be called with pt_spinlock held.
+ * 
+ * @param vaddr: the virtual address that caused the page fault
+ * @param v: set to the vnode of the ELF file
+ * @param offset: set to the offset of the page in the ELF file
+ * 
+ * @return 1 if vaddr is read from the ELF file and it can be in the file index, 0 otherwise
+ */
+int file_page_key(vaddr_t vaddr, struct vnode **v, off_t *offset);
+#endif
+
+#if OPT_READAHEAD
+/**
+ * It tells how many pages following vaddr can be read from the ELF file together with it (readahead).
+ * 
+ * @param vaddr: the virtual address that caused the page fault
+ * @param max: maximum number of pages to read in addition to vaddr
+ * 
+ * @return the number of pages after vaddr, in the same segment, that are entirely read from the ELF file (at most max). It's 0 if
+ *         vaddr itself isn't entirely read from the ELF file, so that load_page must be used
+ */
+int elf_readahead_window(vaddr_t vaddr, int max);
+
+/**
+ * It reads npages consecutive pages of the ELF file, starting from vaddr, with a single VOP_READ. The pages must have been checked
+ * with elf_readahead_window.
+ * 
+ * @param vaddr: the virtual address that caused the page fault
+ * @param paddrs: the physical addresses of the frames of the pages, that don't need to be contiguous
+ * @param npages: number of pages to read, including vaddr
+ */
+void load_elf_pages(vaddr_t vaddr, paddr_t *paddrs, int npages);
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+#include <types.h>
+#include <spinlock.h>
+#include "opt-slab.h"
+
+#if OPT_SLAB
+/*
+ * Object caches (slab allocator) for the small objects of fixed size that the kernel allocates and frees often: the threads, the
+ * processes, the sharers of the frames and the cells of the swapfile. Each cache takes whole pages with alloc_kpages (the slabs)
+ * and splits them in objects of its size, so the objects don't pay the rounding to the size classes of kmalloc, and the objects of
+ * the same type are contiguous in memory.
+ * An object is constructed (ctor) only when its slab is allocated, and it's returned to the cache in its constructed state, so the
+ * fields initialized by the constructor (e.g. the cv and the lock of a swap cell) are kept from a use to the next one. The destructor
+ * (dtor) is called only when an empty slab is given back.
+*/
+
+#define SLAB_SPARE 1 // empty slabs kept by each cache, so that an alloc/free pattern doesn't allocate and free a page every time
+
+/**
+ * Header of a slab, at the beginning of its page. The objects follow it, and each one is followed by the pointer to the next free
+ * object of the slab: in this way the link doesn't overwrite the fields initialized by the constructor.
+*/
+struct slab{
+    struct slab_cache *cache;//Cache that owns the slab
+    struct slab *next;//Next slab with free objects
+    struct slab *prev;//Previous slab with free objects
+    void *free;//First free object of the slab
+    unsigned inuse;//Number of allocated objects of the slab
+};
+
+/**
+ * A cache of objects of the same type. It's protected by its own spinlock, that is never held while a slab is allocated, freed,
+ * constructed or destroyed.
+*/
+struct slab_cache{
+    const char *name;
+    size_t size;//Size of the objects
+    size_t slot;//Size of an object plus its link, aligned
+    unsigned perslab;//Number of objects in a slab
+    void (*ctor)(void *);//Constructor, called for each object of a new slab (it can be NULL)
+    void (*dtor)(void *);//Destructor, called for each object of a slab that is given back (it can be NULL)
+    struct slab *partial;//Doubly linked list of the slabs with at least a free object (the full ones aren't in any list)
+    unsigned nslabs;//Number of slabs of the cache
+    unsigned nempty;//Number of slabs without allocated objects
+    unsigned inuse;//Number of allocated objects
+    unsigned peak;//Maximum number of allocated objects at the same time
+    uint32_t allocs, frees;
+    struct spinlock lock;
+    struct slab_cache *next;//Next cache in the list of all the caches (for slab_printstats)
+};
+
+/**
+ * This function creates a new cache of objects of the given size. It's called during the bootstrap of the subsystem that uses it
+ * (e.g. thread_bootstrap), and the caches are never destroyed.
+ *
+ * @param name: name of the cache, shown by slab_printstats
+ * @param size: size of the objects. It must be small enough that a slab contains at least one object
+ * @param ctor: constructor of the objects, or NULL
+ * @param dtor: destructor of the objects, or NULL
+ *
+ * @return the new cache
+*/
+struct slab_cache *slab_create(const char *name, size_t size, void (*ctor)(void *), void (*dtor)(void *));
+
+/**
+ * This function allocates an object from the cache, allocating a new slab if no slab has free objects. Like kmalloc, it must be
+ * called without holding any spinlock.
+ *
+ * @return the object, in its constructed state, or NULL if no page could be allocated
+*/
+void *slab_alloc(struct slab_cache *);
+
+/**
+ * This function returns an object to its cache. If its slab becomes empty and the cache already has SLAB_SPARE empty slabs, the
+ * slab is given back with free_kpages, so, like kfree, it must be called without holding any spinlock.
+*/
+void slab_free(struct slab_cache *, void *);
+
+/**
+ * This function prints, for each cache, the size of its objects, its slabs and the objects in use. It's called by the menu
+ * command kh, together with the statistics of the kernel heap.
+*/
+void slab_printstats(void);
+#endif
+
+#endif
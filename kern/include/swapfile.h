@@ -13,10 +13,31 @@
 #include "synch.h"
 #include "proc.h"
 #include "opt-sw_list.h"
+#include "opt-swap_cache.h"
+#include "opt-swap_cluster.h"
+#include "zswap.h"
 #include "vm.h"
 #include "opt-debug.h"
 #include "spl.h"
 #include "current.h"
+#include "spinlock.h"
+
+struct sharer;
+
+#if OPT_SWAP_CACHE && !OPT_SW_LIST
+#error "swap_cache needs the lists of the swapfile (sw_list)"
+#endif
+
+#if OPT_SWAP_CLUSTER
+#if !OPT_SW_LIST
+#error "swap_cluster needs the lists of the swapfile (sw_list)"
+#endif
+#define SWAP_CLUSTER_MAX 8 //Maximum number of pages written with a single I/O
+#endif
+
+#if OPT_ZSWAP && !OPT_SW_LIST
+#error "zswap needs the lists of the swapfile (sw_list)"
+#endif
 
 /**
  * Data structure to store the association 
@@ -24,18 +45,43 @@
  */
 struct swapfile{
     #if OPT_SW_LIST
-    struct swap_cell **text;//Array of lists of text pages in the swapfile (one for each pid)
-    struct swap_cell **data;//Array of lists of data pages in the swapfile (one for each pid)
-    struct swap_cell **stack;//Array of lists of stack pages in the swapfile (one for each pid)
-    struct swap_cell *free;//List of free pages in the swapfile
-    void *kbuf;//Buffer used during the copy of swap pages
+    uint32_t *freemap;//Bitmap of the pages of the swapfile: the bit of a page is set if the page is free
+    int nfree;//Number of free pages in the swapfile
+    int rotor;//Page of the swapfile from which we search a new extent for a process (see slot_alloc)
+    int head;//Page of the swapfile after the last one read or written, used to measure the seek distance
+    int *refs;//For each page of the swapfile, number of processes that share it after a fork (0 if the page is free)
+    struct swap_cell *spare;//Cells released while holding swap_lock. They can't be freed there, so they're reused by cell_create
+    #if OPT_ZSWAP
+    void *wb_buf;//Page where zswap_writeback decompresses the page it writes to the swapfile
+    struct lock *wb_lock;//It protects wb_buf
+    #endif
     #else
     struct swap_cell *elements;//Array of lists in the swapfile (one for each pid)
     #endif
     struct vnode *v;//vnode of the swapfile
     int size;//Number of pages stored in the swapfile
+    struct spinlock swap_lock;//Swap allocation lock: it protects the swap maps, the bitmap of the free pages and refs. It's never held during I/O, kmalloc or kfree
 };
 
+#if OPT_SW_LIST
+#define SWAP_MAP_MIN 16 //Initial number of buckets of a swap map (a power of 2)
+#define SWAP_MAP_LOAD 2 //Maximum average number of cells in a bucket: beyond it, the map doubles its buckets
+#define SWAP_NEAR 32 //Pages after the cursor of a process where we look for a free page before starting a new extent
+#define SWAP_EXTENT 16 //Free adjacent pages that a process needs to start a new extent
+
+/**
+ * Swap map of an address space: hash table of the cells of its pages that are in the swapfile, keyed by virtual page number.
+ * Each bucket is a doubly linked list of cells (next and prev of struct swap_cell), so a lookup, an insertion and a removal
+ * cost O(1) whatever the number of pages of the process in the swapfile. It's allocated with the address space.
+*/
+struct swap_map{
+    struct swap_cell **buckets;
+    unsigned nbuckets;//Number of buckets, always a power of 2
+    unsigned count;//Number of cells in the map
+    int cursor;//Page of the swapfile after the last one given to this process, -1 if it never stored a page
+};
+#endif
+
 /**
  * Information related to a single page of the swapfile
 */
@@ -43,10 +89,12 @@ struct swap_cell{
     vaddr_t vaddr;//Virtual address corresponding to the stored page
     int store;//Flag that tells to us if we're performing a store operation on a specific page or not
     #if OPT_SW_LIST
-    struct swap_cell *next;
+    struct swap_cell *next;//Next cell in the bucket of the swap map, in the spare cells or in a fork pool
+    struct swap_cell *prev;//Previous cell in the bucket of the swap map
     paddr_t offset;//Offset of the swap element within the swapfile
     struct cv *cell_cv;//Used to wait for the store operation to end
     struct lock *cell_lock;//Necessary to perform cv_wait
+    struct swap_cell *shared_next;//Used by store_swap to keep track of the cells of the sharers of the page being stored
     #else
     pid_t pid; //Pid of the process that owns that page. If pid=-1 the page is free
     #endif
@@ -59,10 +107,32 @@ struct swap_cell{
  * @param pid_t: pid of the process
  * @param paddr_t: physical address of the RAM frame to use
  * 
- * @return 1 if the page was found in the swapfile, 0 otherwise
+ * @return 1 if the page was found in the swapfile, 2 if it was found and its entry was kept (swap cache), 0 otherwise
 */
 int load_swap(vaddr_t, pid_t, paddr_t);
 
+/**
+ * This function releases the swapfile entry of a page, without reading it. It's used by the swap cache when the copy
+ * in the swapfile of a page in RAM becomes useless (the page was written) or when we need space in the swapfile.
+ *
+ * @param vaddr_t: virtual address of the page
+ * @param pid_t: pid of the process
+ *
+ * @return 1 if the entry was found, 0 otherwise
+*/
+int swap_release(vaddr_t, pid_t);
+
+/**
+ * This function tells if a page has an entry in the swapfile, without reading it. It's used by the readahead, since a page that
+ * is in the swapfile can't be read again from the ELF file. It's called also with pt_spinlock held, so it never sleeps.
+ *
+ * @param vaddr_t: virtual address of the page
+ * @param pid_t: pid of the process
+ *
+ * @return 1 if the entry was found, 0 otherwise
+*/
+int swap_contains(vaddr_t, pid_t);
+
 /**
  * This function saves a frame into the swapfile.
  * If the swapfile has size>9MB, it raises kernel panic.
@@ -70,16 +140,67 @@ int load_swap(vaddr_t, pid_t, paddr_t);
  * @param vaddr_t: virtual address that caused the page fault
  * @param pid_t: pid of the process
  * @param paddr_t: physical address of the RAM frame to save
+ * @param struct sharer *: other processes that shared the frame with pid after a fork (NULL if the frame was private). They all
+ * get an entry for the same page of the swapfile, so the frame is written only once
  * 
  * @return -1 in case of errors, 0 otherwise
 */
-int store_swap(vaddr_t, pid_t, paddr_t);
+int store_swap(vaddr_t, pid_t, paddr_t, struct sharer *);
+
+#if OPT_SWAP_CLUSTER
+/**
+ * This function saves n pages of the same process, with consecutive virtual addresses, in n adjacent pages of the swapfile with a
+ * single write. If the swapfile doesn't have n adjacent free pages, they're saved one at a time with store_swap.
+ * The frames must be private (no sharers).
+ *
+ * @param vaddr_t: virtual address of the first page
+ * @param pid_t: pid of the process
+ * @param paddr_t *: physical addresses of the frames of the pages, that don't need to be contiguous
+ * @param int: number of pages, at most SWAP_CLUSTER_MAX
+*/
+void store_swap_cluster(vaddr_t, pid_t, paddr_t *, int);
+
+/**
+ * This function tells how many pages following vaddr are stored in the swapfile right after vaddr, so that they can be read
+ * together with it (read-around). It's called with pt_spinlock held, so it never sleeps.
+ *
+ * @param vaddr_t: virtual address that caused the page fault
+ * @param pid_t: pid of the process
+ * @param int: maximum number of pages in addition to vaddr
+ *
+ * @return the number of following pages in adjacent pages of the swapfile (at most max), 0 if vaddr isn't in the swapfile
+*/
+int swap_cluster_window(vaddr_t, pid_t, int);
+
+/**
+ * This function reads with a single I/O npages pages of the current process, checked with swap_cluster_window.
+ *
+ * @param vaddr_t: virtual address that caused the page fault
+ * @param pid_t: pid of the process
+ * @param paddr_t *: physical addresses of the frames of the pages
+ * @param int: number of pages, including vaddr
+ *
+ * @return the same as load_swap, for all the pages
+*/
+int load_swap_pages(vaddr_t, pid_t, paddr_t *, int);
+#endif
 
 /**
  * This function initializes the swap file. In particular, it allocates the needed data structures and it opens the file that will store the pages.
 */
 int swap_init(void);
 
+#if OPT_SW_LIST
+/**
+ * They allocate and destroy the swap map of an address space. swap_map_destroy releases the pages still in the map, which
+ * happens only if the process never ran (e.g. when a fork fails): otherwise remove_process_from_swap already emptied it.
+ *
+ * @return the new map, NULL if there's no memory
+*/
+struct swap_map *swap_map_create(void);
+void swap_map_destroy(struct swap_map *);
+#endif
+
 /**
  * When a process terminates, we mark as free all its pages stored into the swapfile.
  * 
@@ -88,24 +209,68 @@ int swap_init(void);
 void remove_process_from_swap(pid_t);
 
 /**
- * When a fork is executed, we copy all the pages of the old process for the new process too.
+ * When a fork is executed, we share all the pages of the old process with the new process too. The pages in the swapfile
+ * are never copied: they're shared until when one of the processes loads and writes them.
+ * It must be called with swap_lock held after swap_pages_ready returned 1, so it never sleeps.
  * 
- * @param pid_t: pid of the old process.
  * @param pid_t: pid of the new process.
+ * @param pid_t: pid of the old process.
+ * @param struct swap_cell **: pool of cells reserved for this fork. The used ones are removed from it
+*/
+void copy_swap_pages(pid_t, pid_t, struct swap_cell **);
+
+/**
+ * This function prepares the cells that copy_swap_pages needs for a fork, and it waits for the stores in progress on the pages
+ * of the old process. It also grows the swap map of the new process, so that it can take all the cells. Since it may sleep
+ * (and so the old process may lose or gain pages), the caller must check with swap_pages_ready, holding swap_lock, that nothing is missing.
+ * 
+ * @param pid_t: pid of the new process. Its address space must already be set.
+ * @param pid_t: pid of the old process.
+ * @param struct swap_cell **: pool of cells of the fork, initially NULL
 */
-void copy_swap_pages(pid_t, pid_t);
+void reserve_swap_pages(pid_t, pid_t, struct swap_cell **);
 
 /**
- * Debugging function. Given the pid, it prints text, data and stack lists.
+ * This function tells if copy_swap_pages can be performed without sleeping. It must be called with swap_lock held.
+ * 
+ * @param pid_t: pid of the old process.
+ * @param struct swap_cell *: pool of cells of the fork
+ * 
+ * @return 1 if there are no stores in progress on the pages of old and the pool is big enough, 0 otherwise
+*/
+int swap_pages_ready(pid_t, struct swap_cell *);
+
+/**
+ * They acquire and release swap_lock. When both are needed, pt_spinlock must be acquired before swap_lock.
+*/
+void swap_lock_acquire(void);
+void swap_lock_release(void);
+
+/**
+ * This function destroys the cells reserved for a fork and not used by copy_swap_pages.
+ * 
+ * @param struct swap_cell *: pool of cells of the fork
+*/
+void release_swap_pool(struct swap_cell *);
+
+/**
+ * Debugging function. Given the pid, it prints its swap map.
  * 
  * @param pid_t: pid of the process.
 */
 void print_list(pid_t);
 
 /**
- * Optimization function. After the end of the whole program, we sort again all the pages in the swapfile.
- * In fact, the smaller the offset the faster the I/O, and so thanks to this function we don't worsen performances.
+ * Optimization function. After the end of the whole program, if the swapfile is empty the next extents are taken again from its
+ * beginning. In fact, the smaller the offset the faster the I/O, and so thanks to this function we don't worsen performances.
 */
 void reorder_swapfile(void);
 
+#if OPT_SW_LIST
+/**
+ * It prints the fragmentation of the free space of the swapfile: free pages, free extents and the largest one.
+*/
+void swap_print_stats(void);
+#endif
+
 #endif /* _SWAPFILE_H_ */
@@ -5,26 +5,84 @@
 #include "syscall.h"
 #include "proc.h"
 #include "opt-debug.h"
+#include "mips/tlb.h"
+#include "spinlock.h"
+#include <platform/maxcpus.h>
+#include "mips/utlb.h"
+#include "opt-utlb_refill.h"
+#include "opt-utlb_trace.h"
 
-pid_t previous_pid;
+#define TLB_RECENT_VICTIMS 16 // number of replaced pages remembered by each CPU, to count the faults on pages that were just replaced
 
 /*
- * Data structure to manage the algorithm used in tlb_remove.
- *
+ * Software shadow of the TLB. For each slot it records the index of the IPT entry that it maps, so that when a slot is
+ * overwritten or invalidated we can update the IPT in O(1) instead of searching the page in the whole IPT.
+ * It also keeps a stack of the invalid slots, so that we don't need to read the TLB to find a free one.
+ * Each CPU has its own TLB, so there's a shadow for each CPU. A CPU only accesses its own shadow, with the interrupts disabled.
+ * The first fields are also used by the UTLB handler (option utlb_refill), so their offsets must match the ones in mips/utlb.h.
  */
 struct tlb{
+    int ipt_index[NUM_TLB]; // IPT entry mapped by each slot, -1 if the slot is invalid
+    pid_t pid[NUM_TLB]; // process that inserted each slot. After a fork a frame may be mapped by more processes, so the IPT can't tell us
+    vaddr_t vaddr[NUM_TLB]; // virtual page mapped by each slot
+    int free_slots[NUM_TLB]; // stack of the invalid slots
+    int nfree; // number of elements in free_slots
+    int hand; // next slot visited by tlb_victim
+#if OPT_UTLB_REFILL
+    /*Refill table: the pages resident on this CPU, one for each set (refill_hi is 0 if the set is empty). It contains the pages of all
+    the valid slots, and the IPT considers in the TLB the frames of its entries, not the ones of the slots: the UTLB handler can write
+    one of them in any slot, overwriting a page that stays in the table, without calling the VM*/
+    uint32_t refill_hi[UTLB_SETS];
+    uint32_t refill_lo[UTLB_SETS];
+    int refill_ipt[UTLB_SETS]; // IPT entry of each resident page
+    pid_t refill_pid[UTLB_SETS]; // process that inserted each resident page
+    uint32_t fast_refills; // TLB misses handled by the UTLB handler on this CPU
+    uint32_t utlb_save[4]; // registers saved by the UTLB handler
+#endif
+    uint32_t asid_next; // next ASID to assign. ASID 0 is never assigned to a process
+    uint32_t asid_generation; // incremented each time the ASIDs are exhausted and the TLB is flushed
+    pid_t previous_pid; // process that ran on the CPU the last time an address space was activated
+    uint8_t ref[NUM_TLB]; // 1 if the slot has been referenced since tlb_victim last visited it (only tlb_nru clears it)
+    uint8_t hot[NUM_TLB]; // 1 if the slot maps a text or stack page (used by tlb_hot)
+    vaddr_t victim_vaddr[TLB_RECENT_VICTIMS]; // last pages replaced on this CPU, 0 if the element is empty
+    pid_t victim_pid[TLB_RECENT_VICTIMS];
+    int next_recent; // next element of victim_vaddr that will be overwritten
+};
 
+/*
+ * Completion counter of a TLB shootdown (see struct tlbshootdown in machine/vm.h). The sender waits until all the CPUs that
+ * received the shootdown have performed it.
+ */
+struct tlbshootdown_wait{
+    struct spinlock lock;
+    int pending; // number of CPUs that haven't performed the shootdown yet. It may become negative for a while, since the sender adds the CPUs after sending
 };
 
+struct addrspace;
+struct tlbshootdown;
+
+#if OPT_UTLB_REFILL
+struct tlb *tlb_shadows[MAXCPUS]; // shadow of each CPU, indexed by c_number. The UTLB handler finds here the one of its CPU
+#endif
+
 pid_t old_pid;
 
 /*not needed anymore, we leave it here in case we want it to be a wrapper for the mips instruction TLB_INVALIDATE*/
 int tlb_remove(void);
 
 /**
- * This function chooses the entry to sacrifice in the TLB and returns its index.
+ * This function chooses the entry to sacrifice in the TLB of the current CPU and returns its index, or -1 if the hardware must choose it
+ * (tlb_random). The policy is selected with the kernel options tlb_random, tlb_nru and tlb_hot (round robin if none is set).
 */
-int tlb_victim(void);
+int tlb_victim(struct tlb *sh);
+
+/**
+ * This function is used by tlb_nru: it's called by vm_fault before handling a TLB fault, and it tells if the page is still in the TLB
+ * with an entry that was disabled to sample its access bit. In this case the entry is enabled again and marked as referenced.
+ *
+ * @return 1 if the page was in the TLB, 0 if the fault must be handled
+*/
+int tlb_sampled_access(vaddr_t faultvaddr);
 
 /*this function tells me whether the address is in the text segment (code segment) and therefore is not writable*/
 int segment_is_readonly(vaddr_t vaddr);
@@ -36,6 +94,13 @@ int segment_is_readonly(vaddr_t vaddr);
 */
 int tlb_insert(vaddr_t vaddr, paddr_t faultpaddr);
 
+/**
+ * This function handles the first write on a clean or shared page (VM_FAULT_READONLY outside of the text segment).
+ * The page is marked as dirty in the IPT (after copying it, if it's shared with other processes) and its entry in the TLB
+ * becomes writable.
+*/
+void tlb_set_dirty(vaddr_t faultvaddr);
+
 /**
  * This function tells me if the entry in the TLB at index i is valid or not.
 */
@@ -50,10 +115,74 @@ int tlb_entry_is_valid(int i);
 int tlb_invalidate_entry(paddr_t paddr);
 
 /**
- * this function has to invalidate the TLB when there is a switch from a process to another. Indeed, 
- * the TLB is common for all processes and does not have a "pid" field.
+ * This function is called by as_activate. It makes the TLB match only the entries tagged with the ASID of the given
+ * address space, assigning it a new ASID if the one it has belongs to an old generation. The TLB is flushed only when
+ * the ASIDs are exhausted, so the entries of the other processes survive a context switch.
+*/
+void tlb_activate(struct addrspace *as);
+
+/**
+ * This function invalidates all the entries of the TLB, informing the IPT that they are not cached anymore.
+ * It's used when the ASIDs are exhausted.
+*/
+void tlb_flush(void);
+
+/**
+ * This function invalidates the entries of the TLB that map pages of the given process. It's used when a process ends,
+ * before its frames are freed, and when it forks, since its writable entries may map frames that are now shared.
+ * The process must be the current one. Its entries are invalidated on all the CPUs whose TLB may contain them (see tlb_cpus
+ * in struct addrspace), with a TLB shootdown.
+*/
+void tlb_invalidate_pid(pid_t pid);
+
+/**
+ * This function invalidates, on all the CPUs, the entries of the current process that map the given page. It's used when the page
+ * has been copied in a new frame (copy on write): the entries inserted on the other CPUs would still map the old frame.
+*/
+void tlb_invalidate_page(vaddr_t vaddr);
+
+/**
+ * This function removes the given frames (IPT indexes) from the TLBs of all the CPUs, sending a single shootdown for all of them.
+ * It's used by find_victim when all the frames that could be evicted are in some TLB. It must be called without holding any spinlock
+ * and with the interrupts enabled, since it waits for the other CPUs.
+*/
+void tlb_steal_frames(uint32_t *frames, unsigned n);
+
+/**
+ * This function performs on the TLB of the current CPU a shootdown sent by another CPU, and then it tells the sender that it's done.
+ * It's called by vm_tlbshootdown, in the handler of the IPI.
+*/
+void tlb_shootdown(const struct tlbshootdown *ts);
+
+/**
+ * This function initializes the shadows of the TLBs of all the CPUs. At boot all the slots are invalid.
+*/
+void tlb_init(void);
+
+/**
+ * This function returns the number of TLB misses handled by the UTLB handler without calling vm_fault (option utlb_refill),
+ * on all the CPUs. They aren't counted as TLB faults.
+*/
+uint32_t tlb_fast_refills(void);
+
+#if OPT_UTLB_TRACE
+/*
+ * Machine-dependent hooks of the option utlb_trace (arch/mips/vm/utlb_trace.c), used to measure the TLB refills with trace161.
+ * The trace starts at the UTLB vector and ends when the refill goes back to the process, so the VM only stops it when the fault
+ * turns out to be a page fault, and while it sleeps.
+*/
+
+/**
+ * This function looks for the trace device. It's called by tlb_init, after autoconf attached the devices.
+*/
+void tlb_trace_init(void);
+
+/**
+ * These functions turn the trace of the refills on and off.
 */
-void tlb_invalidate_all(void);
+void tlb_trace_on(void);
+void tlb_trace_off(void);
+#endif
 
 /**
  * Useful for debugging reasons eheh :^)
@@ -13,13 +13,115 @@
 #define DISK 1
 #define ELF 2
 #define SWAPFILE 3
+
+#define FREE_LIST_HIT 0
+#define VICTIM_SELECTION 1
+#define VICTIM_SCAN_STEP 2
+
+#define HASH_LOOKUPS 0
+#define HASH_PROBES 1
+#define HASH_MAX_PROBES 2
+#define HASH_RESIZES 3
+
+#define ASID_ROLLOVERS 0
+#define AVOIDED_RELOADS 1
+
+#define DIRTY_FAULT 0
+#define CLEAN_EVICTION 1
+
+#define AVOIDED_WRITE 0
+#define CACHE_RECLAIM 1
+
+#define COW_SHARED_PAGE 0
+#define COW_COPY 1
+#define COW_LAST_MAPPING 2
+
+#define SHOOTDOWNS 0
+#define SHOOTDOWN_IPIS 1
+#define SHOOTDOWN_SKIPPED_CPUS 2
+#define SHOOTDOWN_REMOTE_ENTRIES 3
+#define SHOOTDOWN_STOLEN_FRAMES 4
+
+#define TLB_POLICY_VICTIMS 0
+#define TLB_POLICY_REFAULTS 1
+#define TLB_POLICY_SPARED 2
+#define TLB_POLICY_SAMPLED 3
+
+#define TSB_HITS 0
+#define TSB_MISSES 1
+#define RELOAD_LATENCY 2
+
+#define READAHEAD_PAGES 0
+#define READAHEAD_HITS 1
+#define READAHEAD_WASTED 2
+
+#define SWAP_CLUSTER_WRITES 0
+#define SWAP_CLUSTER_PAGES 1
+#define SWAP_READAROUND_PAGES 2
+
+#define PAGEOUT_WAKEUPS 0
+#define PAGEOUT_DAEMON_FRAMES 1
+#define PAGEOUT_DIRECT 2
+#define FAULT_LATENCY 3
+
+#define ZERO_POOL_HITS 0
+#define ZERO_POOL_MISSES 1
+#define ZERO_POOL_FILLS 2
+#define ZERO_FILL_LATENCY 3
+
+#define TEXT_SHARE_HITS 0
+#define TEXT_SHARE_LOADS 1
+
+#define PAGE_CACHE_HITS 0
+#define PAGE_CACHE_MISSES 1
+#define PAGE_CACHE_RECLAIMS 2
+
+#define BUDDY_ALLOCS 0
+#define BUDDY_MERGES 1
+#define BUDDY_GROWS 2
+#define BUDDY_EVICTIONS 3
+#define BUDDY_FALLBACKS 4
+
+#define SWAP_SLOT_SEQUENTIAL 0
+#define SWAP_SLOT_NEAR 1
+#define SWAP_SLOT_EXTENTS 2
+#define SWAP_SLOT_SCATTERED 3
+#define SWAP_SLOT_IOS 4
+#define SWAP_SLOT_SEEK 5
+
+#define ZSWAP_STORES 0
+#define ZSWAP_REJECTS 1
+#define ZSWAP_HITS 2
+#define ZSWAP_WRITEBACKS 3
+#define ZSWAP_BYTES 4
 /**
  * Data structure with a field for each needed statistic.
 */
 struct stats{
     uint32_t tlb_faults, tlb_free_faults, tlb_replace_faults, tlb_invalidations, tlb_reloads,
             pt_zeroed_faults, pt_disk_faults, pt_elf_faults, pt_swapfile_faults,
-            swap_writes;
+            swap_writes,
+            free_list_hits, victim_selections, victim_scan_steps,
+            hash_lookups, hash_probes, hash_max_probes, hash_resizes,
+            asid_rollovers, avoided_reloads,
+            dirty_faults, clean_evictions,
+            swap_cache_avoided_writes, swap_cache_reclaims,
+            cow_shared_pages, cow_copies, cow_last_mappings,
+            shootdowns, shootdown_ipis, shootdown_skipped_cpus, shootdown_remote_entries, shootdown_stolen_frames,
+            tlb_policy_victims, tlb_policy_refaults, tlb_policy_spared, tlb_policy_sampled,
+            tsb_hits, tsb_misses,
+            readahead_pages, readahead_hits, readahead_wasted,
+            swap_cluster_writes, swap_cluster_pages, swap_readaround_pages,
+            pageout_wakeups, pageout_daemon_frames, pageout_direct,
+            zero_pool_hits, zero_pool_misses, zero_pool_fills,
+            text_share_hits, text_share_loads,
+            page_cache_hits, page_cache_misses, page_cache_reclaims,
+            buddy_allocs, buddy_merges, buddy_grows, buddy_evictions, buddy_fallbacks,
+            swap_slot_sequential, swap_slot_near, swap_slot_extents, swap_slot_scattered, swap_ios, swap_seek_pages,
+            zswap_stores, zswap_rejects, zswap_hits, zswap_writebacks, zswap_bytes;
+    uint64_t reload_ns; // total time spent by vm_fault on the TLB reloads, in nanoseconds
+    uint64_t fault_ns; // total time spent by vm_fault on the page faults (pages loaded or zeroed), in nanoseconds
+    uint64_t zero_fill_ns; // total time spent by get_page on the zero-fill faults, in nanoseconds
     struct spinlock lock; 
      /*It might be necessary to insert additional fields, for "temporary results"*/
 }stat;
@@ -75,6 +177,195 @@ uint32_t pt_fault_stats(int);
  */
 uint32_t swap_write_stat(void);
 
+/*
+ * This function returns the following statistics:
+ * -Free list hits
+ * -Victim selections
+ * -Victim scan steps
+ * 
+ * @param: type of statistic
+ */
+uint32_t frame_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Hash lookups
+ * -Hash probes (slots read by all the lookups)
+ * -Hash max probes (slots read by the longest lookup)
+ * -Hash resizes
+ * 
+ * @param: type of statistic
+ */
+uint32_t hash_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -ASID rollovers
+ * -Avoided reloads (TLB entries of a process still valid when it's scheduled again)
+ * 
+ * @param: type of statistic
+ */
+uint32_t asid_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Dirty faults (first writes on a clean page)
+ * -Clean evictions (victims dropped without writing them in the swapfile)
+ * 
+ * @param: type of statistic
+ */
+uint32_t dirty_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Swapfile writes avoided thanks to the swap cache
+ * -Swap cache entries released because the swapfile was full
+ * 
+ * @param: type of statistic
+ */
+uint32_t swap_cache_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Pages shared at fork instead of being copied
+ * -Copies performed on the first write on a shared page
+ * -Writes on a shared page that didn't need a copy, since the other processes had already left the frame
+ * 
+ * @param: type of statistic
+ */
+uint32_t cow_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -TLB shootdowns that had to reach other CPUs
+ * -IPIs sent for them
+ * -CPUs that didn't receive an IPI since their TLB had no entry of the process
+ * -Entries invalidated by the IPIs on the other CPUs
+ * -Frames removed from the TLBs because they were the only possible victims
+ * 
+ * @param: type of statistic
+ */
+uint32_t shootdown_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Victims chosen by the TLB replacement policy
+ * -TLB faults on pages that were among the last victims of the CPU (misses of the policy)
+ * -Slots spared by the policy (referenced with tlb_nru, text or stack with tlb_hot)
+ * -Accesses detected by sampling the access bit (tlb_nru)
+ * 
+ * @param: type of statistic
+ */
+uint32_t tlb_policy_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -IPT lookups satisfied by the TSB
+ * -IPT lookups that had to search the hash table
+ * -Average latency of a TLB reload (from the fault to the TLB insertion), in nanoseconds
+ * 
+ * @param: type of statistic
+ */
+uint32_t tsb_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Pages read ahead from the ELF file
+ * -Pages read ahead that were used (page faults avoided)
+ * -Pages read ahead that were evicted or freed without being used
+ * 
+ * @param: type of statistic
+ */
+uint32_t readahead_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Writes of more pages in adjacent pages of the swapfile
+ * -Pages saved by these writes
+ * -Pages read from the swapfile together with the page that caused a page fault
+ * 
+ * @param: type of statistic
+ */
+uint32_t swap_cluster_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Times the pageout daemon was woken up
+ * -Frames freed by the pageout daemon
+ * -Page faults that had to select a victim by themselves (direct reclaim)
+ * -Average latency of a page fault (from the fault to the TLB insertion), in nanoseconds
+ * 
+ * @param: type of statistic
+ */
+uint32_t pageout_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Zero-fill faults that found a zeroed frame in the pool
+ * -Zero-fill faults that had to zero the frame by themselves
+ * -Frames zeroed by the zeroing thread
+ * -Average latency of a zero-fill fault in get_page, in nanoseconds
+ * 
+ * @param: type of statistic
+ */
+uint32_t zero_pool_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Text page faults that mapped a frame loaded by another process running the same program
+ * -Pages read from the ELF file and added to the file index
+ * 
+ * @param: type of statistic
+ */
+uint32_t text_share_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Page faults on pages of the ELF file that found the page in the page cache
+ * -Page faults on pages of the ELF file that had to read it
+ * -Frames of the page cache evicted while no process mapped them
+ * 
+ * @param: type of statistic
+ */
+uint32_t page_cache_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Kernel allocations served by the buddy allocator
+ * -Merges of two free buddies into a bigger block
+ * -Chunks of frames taken from the IPT to grow the pool of the kernel pages
+ * -User pages evicted to grow the pool
+ * -Kernel allocations that had to scan the IPT because the pool couldn't grow
+ * 
+ * @param: type of statistic
+ */
+uint32_t buddy_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Pages of the swapfile given to a process right after its previous ones
+ * -Pages of the swapfile given to a process near its previous ones
+ * -New extents started by a process
+ * -Pages of the swapfile given anywhere, because no extent was free
+ * -Reads and writes on the swapfile
+ * -Total seek distance of these I/Os, in pages
+ * 
+ * @param: type of statistic
+ */
+uint32_t swap_slot_stats(int);
+
+/*
+ * This function returns the following statistics:
+ * -Pages stored in the compressed pool instead of the swapfile
+ * -Pages that didn't compress enough and went to the swapfile
+ * -Loads served by the compressed pool
+ * -Pages of the pool written back to the swapfile
+ * -Total size of the pages stored in the pool, once compressed, in bytes
+ * 
+ * @param: type of statistic
+ */
+uint32_t zswap_stats(int);
+
 /* ------ UTILITY FUNCTIONS------- */
 
 
@@ -118,6 +409,182 @@ void add_pt_type_fault(int);
 */
 void add_swap_writes(void);
 
+/**
+ * This function increments the value of the correct statistic on the allocation of frames in the page fault path. type can be either
+ * - FREE_LIST_HIT (0): a page fault got its frame directly from the free list
+ * - VICTIM_SELECTION (1): a page fault found the free list empty and had to select a victim
+ * - VICTIM_SCAN_STEP (2): an IPT entry was examined by the second chance algorithm
+ * as defined in this header file
+*/
+void add_frame_stat(int);
+
+/**
+ * This function updates the hash statistics after a lookup in the hash table that read "probes" slots.
+*/
+void add_hash_lookup(uint32_t probes);
+
+/**
+ * This function increments the value of "hash_resizes" each time the hash table is doubled.
+*/
+void add_hash_resize(void);
+
+/**
+ * This function increments the value of "asid_rollovers" each time the ASIDs are exhausted and the TLB is flushed.
+*/
+void add_asid_rollover(void);
+
+/**
+ * This function adds to "avoided_reloads" the number of TLB entries that a process finds still valid when it's scheduled again.
+*/
+void add_avoided_reloads(uint32_t);
+
+/**
+ * This function increments the value of the correct statistic on the dirty pages according to a type received as a parameter. This type can be either
+ * - DIRTY_FAULT (0): a write on a clean page was trapped to mark it as dirty
+ * - CLEAN_EVICTION (1): a clean victim was dropped without writing it in the swapfile
+ * as defined in this header file
+*/
+void add_dirty_stat(int);
+
+/**
+ * This function increments the value of "swap_cache_avoided_writes" each time a page is not written in the swapfile because
+ * the swap cache already has a copy of it. type must be AVOIDED_WRITE, as defined in this header file.
+*/
+void add_swap_cache_stat(int);
+
+/**
+ * This function adds to "swap_cache_reclaims" the number of swap cache entries released because the swapfile was full.
+*/
+void add_swap_cache_reclaim(uint32_t);
+
+/**
+ * This function increments the value of the correct statistic on copy on write according to a type received as a parameter. This type can be either
+ * - COW_SHARED_PAGE (0): a page was shared with the child during a fork
+ * - COW_COPY (1): a shared page was copied on the first write of a process
+ * - COW_LAST_MAPPING (2): a shared page was written without copying it, since it was not shared anymore
+ * as defined in this header file
+*/
+void add_cow_stat(int);
+
+/**
+ * This function adds n to the correct statistic on the TLB shootdowns according to a type received as a parameter. This type can be either
+ * - SHOOTDOWNS (0): a shootdown (with a batch of invalidations) had to be sent to other CPUs
+ * - SHOOTDOWN_IPIS (1): IPIs sent
+ * - SHOOTDOWN_SKIPPED_CPUS (2): CPUs that didn't receive the IPI thanks to the tracking of the CPUs used by each process
+ * - SHOOTDOWN_REMOTE_ENTRIES (3): entries invalidated by a CPU that received a shootdown
+ * - SHOOTDOWN_STOLEN_FRAMES (4): frames removed from the TLBs by find_victim
+ * as defined in this header file
+*/
+void add_shootdown_stat(int, uint32_t);
+
+/**
+ * This function increments the value of the correct statistic on the TLB replacement policy according to a type received as a parameter. This type can be either
+ * - TLB_POLICY_VICTIMS (0): a valid slot was replaced
+ * - TLB_POLICY_REFAULTS (1): a TLB fault was caused by one of the last pages replaced on the CPU
+ * - TLB_POLICY_SPARED (2): a slot visited by tlb_victim was kept
+ * - TLB_POLICY_SAMPLED (3): an access to a slot disabled by tlb_nru was detected
+ * as defined in this header file
+*/
+void add_tlb_policy_stat(int);
+
+/**
+ * This function adds n to the correct statistic on the TSB according to a type received as a parameter. This type can be either
+ * - TSB_HITS (0): lookups of a page found in the TSB
+ * - TSB_MISSES (1): lookups that searched the hash table
+ * - RELOAD_LATENCY (2): n nanoseconds spent on a TLB reload
+ * as defined in this header file
+*/
+void add_tsb_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the readahead according to a type received as a parameter. This type can be either
+ * - READAHEAD_PAGES (0): n pages were read ahead together with a page fault
+ * - READAHEAD_HITS (1): a page read ahead was used for the first time
+ * - READAHEAD_WASTED (2): a page read ahead left the RAM without being used
+ * as defined in this header file
+*/
+void add_readahead_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the clusters of the swapfile according to a type received as a parameter. This type can be either
+ * - SWAP_CLUSTER_WRITES (0): a group of pages was written with a single I/O
+ * - SWAP_CLUSTER_PAGES (1): n pages were written by a single I/O
+ * - SWAP_READAROUND_PAGES (2): n pages were read together with the page that caused a page fault
+ * as defined in this header file
+*/
+void add_swap_cluster_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the reclaim of the frames according to a type received as a parameter. This type can be either
+ * - PAGEOUT_WAKEUPS (0): the pageout daemon was woken up
+ * - PAGEOUT_DAEMON_FRAMES (1): n frames were freed by the pageout daemon
+ * - PAGEOUT_DIRECT (2): a page fault found no free frame and selected a victim
+ * - FAULT_LATENCY (3): n nanoseconds spent on a page fault
+ * as defined in this header file
+*/
+void add_pageout_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the pool of zeroed frames according to a type received as a parameter. This type can be either
+ * - ZERO_POOL_HITS (0): a zero-fill fault used a zeroed frame
+ * - ZERO_POOL_MISSES (1): a zero-fill fault didn't find a zeroed frame
+ * - ZERO_POOL_FILLS (2): a frame was zeroed by the zeroing thread
+ * - ZERO_FILL_LATENCY (3): n nanoseconds spent on a zero-fill fault
+ * as defined in this header file
+*/
+void add_zero_pool_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the sharing of the text pages according to a type received as a parameter. This type can be either
+ * - TEXT_SHARE_HITS (0): a text page fault shared the frame of another process
+ * - TEXT_SHARE_LOADS (1): a page was read from the ELF file and added to the file index
+ * as defined in this header file
+*/
+void add_text_share_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the page cache according to a type received as a parameter. This type can be either
+ * - PAGE_CACHE_HITS (0): a page of the ELF file was found in the page cache
+ * - PAGE_CACHE_MISSES (1): a page of the ELF file wasn't in the page cache, so it was read
+ * - PAGE_CACHE_RECLAIMS (2): a frame of the page cache that no process mapped was evicted
+ * as defined in this header file
+*/
+void add_page_cache_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the buddy allocator according to a type received as a parameter. This type can be either
+ * - BUDDY_ALLOCS (0): a kernel allocation was served by the buddy allocator
+ * - BUDDY_MERGES (1): two free buddies were merged
+ * - BUDDY_GROWS (2): a chunk of frames was added to the pool of the kernel pages
+ * - BUDDY_EVICTIONS (3): a user page was evicted to grow the pool
+ * - BUDDY_FALLBACKS (4): a kernel allocation had to scan the IPT
+ * as defined in this header file
+*/
+void add_buddy_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the allocation of the pages of the swapfile according to a type received as a parameter. This type can be either
+ * - SWAP_SLOT_SEQUENTIAL (0): n pages were given to a process right after the last one it got
+ * - SWAP_SLOT_NEAR (1): n pages were given to a process within SWAP_NEAR pages after the last one it got
+ * - SWAP_SLOT_EXTENTS (2): a process started a new extent
+ * - SWAP_SLOT_SCATTERED (3): n pages were given to a process anywhere in the swapfile
+ * - SWAP_SLOT_IOS (4): a read or a write on the swapfile was issued
+ * - SWAP_SLOT_SEEK (5): the head of the disk moved by n pages
+ * as defined in this header file
+*/
+void add_swap_slot_stat(int, uint32_t);
+
+/**
+ * This function adds n to the correct statistic on the compressed pool of the swapfile according to a type received as a parameter. This type can be either
+ * - ZSWAP_STORES (0): a page was stored in the pool
+ * - ZSWAP_REJECTS (1): a page didn't compress enough to be stored in the pool
+ * - ZSWAP_HITS (2): a load was served by the pool
+ * - ZSWAP_WRITEBACKS (3): a page of the pool was written to the swapfile
+ * - ZSWAP_BYTES (4): a page of n bytes, once compressed, was stored in the pool
+ * as defined in this header file
+*/
+void add_zswap_stat(int, uint32_t);
+
 /**
  * This function is called by vm_shutdown and prints the current statistics. In case of incorrect statistics, 
  * an error message is displayed. 
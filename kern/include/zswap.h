@@ -0,0 +1,65 @@
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+#include <types.h>
+#include "opt-zswap.h"
+
+#if OPT_ZSWAP
+/*
+ * Compressed swap pool (zswap): a tier of RAM in front of the swapfile. When a dirty page is evicted it's compressed with a small
+ * LZ compressor (LZSS) and kept in a pool of frames reserved at boot, so a later fault on it is served by a decompression instead
+ * of a read of lhd0raw:. Only when the pool is full its least recently used pages are decompressed and written to the swapfile.
+ * The pool is indexed by page of the swapfile: each page stored in the pool still owns its page of the swapfile, that is written
+ * only on writeback, so the swap maps, the sharing after a fork and the swap cache work as before.
+ * The pool is protected by its own spinlock, acquired after swap_lock.
+*/
+
+#define ZSWAP_PCT 10 // size of the pool, in percentage of the frames available at boot
+#define ZSWAP_CHUNK 64 // allocation unit of the pool, in bytes
+#define ZSWAP_CHUNKS (PAGE_SIZE / ZSWAP_CHUNK) // chunks in a frame of the pool (64, two words of its bitmap)
+#define ZSWAP_MAX_LEN (PAGE_SIZE * 3 / 4) // pages that don't shrink at least by a quarter go directly to the swapfile
+
+/**
+ * Initialization of the pool for a swapfile of nslots pages. It's called by swap_init, before the IPT takes the free RAM.
+*/
+void zswap_init(int nslots);
+
+/**
+ * It compresses the frame at paddr and stores it in the pool as the copy of the page slot of the swapfile.
+ *
+ * @return 1 if the page was stored, 0 if it's compressible but the pool has no room for it, -1 if it doesn't compress enough
+*/
+int zswap_store(int slot, paddr_t paddr);
+
+/**
+ * If the page slot of the swapfile is in the pool, it decompresses it in kbuf (a kernel buffer of a page). It's used both by the loads
+ * and by the writebacks, so the pool hits are counted by the callers in load_swap.
+ *
+ * @return 1 if the page was in the pool, 0 otherwise
+*/
+int zswap_load(int slot, void *kbuf);
+
+/**
+ * @return 1 if the page slot of the swapfile is in the pool, 0 otherwise. It's called with swap_lock held
+*/
+int zswap_contains(int slot);
+
+/**
+ * It takes the least recently used page of the pool out of the LRU list, so that it can be written back. It stays in the pool
+ * (and loads still find it) until zswap_drop. It's called with swap_lock held.
+ *
+ * @return the page of the swapfile, -1 if no page of the pool is waiting to be written back
+*/
+int zswap_victim(void);
+
+/**
+ * It removes the page slot of the swapfile from the pool, if it's there. It's called with swap_lock held.
+*/
+void zswap_drop(int slot);
+
+/**
+ * It prints the occupancy of the pool.
+*/
+void zswap_print_stats(void);
+#endif
+
+#endif
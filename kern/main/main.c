@@ -133,9 +133,6 @@ boot(void)
 	kheap_nextgeneration();
 
 	/* Late phase of initialization. */
-	#if OPT_PROJECT
-	create_sem_fork();
-	#endif
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
@@ -47,6 +47,10 @@
 #include "opt-net.h"
 #include "pt.h"
 #include "opt-debug.h"
+#include "opt-pageout.h"
+#include "opt-buddy.h"
+#include "opt-sw_list.h"
+#include <slab.h>
 
 /*
  * In-kernel menu and command dispatcher.
@@ -479,6 +483,9 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if OPT_SLAB
+	slab_printstats();
+#endif
 
 	return 0;
 }
@@ -512,6 +519,70 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_BUDDY
+/*
+ * Command for printing the state of the buddy allocator of the kernel pages.
+ */
+static
+int
+cmd_kfrag(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buddy_print_stats();
+
+	return 0;
+}
+#endif
+
+#if OPT_SW_LIST
+/*
+ * Command for printing the fragmentation of the swapfile.
+ */
+static
+int
+cmd_sfrag(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	swap_print_stats();
+
+	return 0;
+}
+#endif
+
+#if OPT_PAGEOUT
+/*
+ * Command for showing or changing the watermarks of the pageout daemon.
+ */
+static
+int
+cmd_pageout(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 3) {
+		result = pageout_set_watermarks(atoi(args[1]), atoi(args[2]));
+		if (result) {
+			kprintf("pageout: low and high must be 0 < low < high <= %d\n",
+				peps.ptSize / 2);
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: pageout [low high]\n");
+		return EINVAL;
+	}
+
+	kprintf("Pageout watermarks: low = %d frames, high = %d frames (%d free)\n",
+		peps.pageout_low, peps.pageout_high, peps.nfree);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -554,6 +625,9 @@ static const char *opsmenu[] = {
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
+#if OPT_PAGEOUT
+	"[pageout] Pageout watermarks        ",
+#endif
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -578,6 +652,7 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] kmalloc microbenchmark        ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -619,6 +694,12 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if OPT_BUDDY
+	"[kfrag] Kernel page fragmentation   ",
+#endif
+#if OPT_SW_LIST
+	"[sfrag] Swapfile fragmentation      ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -662,6 +743,9 @@ static struct {
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
+#if OPT_PAGEOUT
+	{ "pageout",	cmd_pageout },
+#endif
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -670,6 +754,12 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if OPT_BUDDY
+	{ "kfrag",      cmd_kfrag },
+#endif
+#if OPT_SW_LIST
+	{ "sfrag",      cmd_sfrag },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -680,6 +770,7 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
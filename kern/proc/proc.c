@@ -48,6 +48,7 @@
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <slab.h>
 
 static struct _processTable {
   int active;           /* initial value 0 */
@@ -61,6 +62,13 @@ static struct _processTable {
  */
 struct proc *kproc;
 
+#if OPT_SLAB
+/*
+ * Cache of the proc structures (see slab.h).
+ */
+static struct slab_cache *proc_cache;
+#endif
+
 /*
  * G.Cabodi - 2019
  * Initialize support for pid/waitpid.
@@ -132,13 +140,21 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
+#if OPT_SLAB
+	proc = slab_alloc(proc_cache);
+#else
 	proc = kmalloc(sizeof(*proc));
+#endif
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
+#if OPT_SLAB
+		slab_free(proc_cache, proc);
+#else
 		kfree(proc);
+#endif
 		return NULL;
 	}
 
@@ -244,7 +260,11 @@ proc_destroy(struct proc *proc)
 	proc_end_waitpid(proc);
 
 	kfree(proc->p_name);
+#if OPT_SLAB
+	slab_free(proc_cache, proc);
+#else
 	kfree(proc);
+#endif
 }
 
 /*
@@ -253,6 +273,9 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+#if OPT_SLAB
+	proc_cache = slab_create("proc", sizeof(struct proc), NULL, NULL);
+#endif
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
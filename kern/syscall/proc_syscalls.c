@@ -30,11 +30,10 @@
 void
 sys__exit(int status)
 {
-  int spl = splhigh(); // so that the control does nit pass to another waiting process.
-
   struct proc *p = curproc;
 
   #if OPT_PROJECT
+  tlb_invalidate_pid(p->p_pid); //The TLB entries of the ending process would refer to frames that are going to be freed
   free_pages(p->p_pid);
   remove_process_from_swap(p->p_pid);
   #endif
@@ -48,7 +47,6 @@ sys__exit(int status)
   p->ended=1; //Used since, otherwise, if the child ends before the parent waits for him, the parent will never be woken up
   cv_signal(p->p_cv, p->lock);
   lock_release(p->lock);
-  splx(spl);
   DEBUG(DB_VM,"process %d signaled end/n", curproc->p_pid);
   thread_exit();
 
@@ -58,7 +56,6 @@ sys__exit(int status)
 int
 sys_waitpid(pid_t pid, userptr_t statusp, int options)
 {
-  int spl = splhigh();
   struct proc *p = proc_search_pid(pid);
   int s;
   (void)statusp;
@@ -70,7 +67,6 @@ sys_waitpid(pid_t pid, userptr_t statusp, int options)
   DEBUG(DB_VM,"Process %d exited the proc wait of %d\n", curproc->p_pid, pid);
   if (statusp!=NULL) 
     *(int*)statusp = s;
-  splx(spl);
   return pid;
 }
 
@@ -93,13 +89,6 @@ call_enter_forked_process(void *tfv, unsigned long dummy) {
 
 int sys_fork(struct trapframe *ctf, pid_t *retval) {
 
-  int waited=0; //Used since the first kmalloc may occur before the initialization of sem_fork
-  if(sem_fork){
-    waited=1;
-    P(sem_fork); //Small optimization. Since fork calls as_copy, that locks some pages in the IPT (avoiding their removal) if we allow many fork in parallel we may have the IPT blocked.
-                 //To avoid it, we allow only one process at a time to perform the fork.
-  }
-  int spl = splhigh();
   struct trapframe *tf_child;
   struct proc *newp;
   #if OPT_PROJECT
@@ -160,10 +149,6 @@ int sys_fork(struct trapframe *ctf, pid_t *retval) {
   }
 
   *retval = newp->p_pid;
-  splx(spl);
-  if(waited){
-    V(sem_fork);
-  }
 
   return 0;
 }
@@ -37,6 +37,7 @@
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
 #include <test.h>
+#include <clock.h>
 
 #include "opt-dumbvm.h"
 
@@ -378,3 +379,108 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5
+
+/*
+ * kmalloc microbenchmark. Each of NTHREADS threads allocates a batch
+ * of KM5_BATCH small blocks, rotating through the sizes of the most
+ * common VM metadata, and then frees them, for a number of rounds
+ * given as an argument (KM5_ROUNDS by default). At the end we print
+ * the allocations per second and how many times the subpage allocator
+ * took its spinlock, together with the acquisitions saved by the
+ * per-cpu magazines (option magazine).
+ */
+
+#define KM5_ROUNDS 1000
+#define KM5_BATCH  16
+
+static
+void
+kmalloctest5thread(void *sm, unsigned long rounds)
+{
+#define NUM_KM5_SIZES 5
+	static const unsigned sizes[NUM_KM5_SIZES] = { 8, 20, 36, 100, 240 };
+
+	struct semaphore *sem = sm;
+	void *ptrs[KM5_BATCH];
+	unsigned long r;
+	unsigned i;
+
+	for (r=0; r<rounds; r++) {
+		for (i=0; i<KM5_BATCH; i++) {
+			ptrs[i] = kmalloc(sizes[i % NUM_KM5_SIZES]);
+			if (ptrs[i] == NULL) {
+				panic("kmalloctest5: allocating %u bytes "
+				      "failed\n", sizes[i % NUM_KM5_SIZES]);
+			}
+		}
+		for (i=0; i<KM5_BATCH; i++) {
+			kfree(ptrs[i]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec start, end;
+	uint32_t locks_before, saved_before, locks, saved, ms, allocs;
+	unsigned long rounds = KM5_ROUNDS;
+	unsigned i;
+	int result;
+
+	if (nargs == 2) {
+		rounds = atoi(args[1]);
+	}
+	if (nargs > 2 || rounds == 0) {
+		kprintf("Usage: km5 [rounds]\n");
+		return EINVAL;
+	}
+
+	sem = sem_create("kmalloctest5", 0);
+	if (sem == NULL) {
+		panic("kmalloctest5: sem_create failed\n");
+	}
+
+	kprintf("Starting kmalloc microbenchmark...\n");
+
+	kheap_lockstats(&locks_before, &saved_before);
+	gettime(&start);
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("kmalloctest5", NULL,
+				     kmalloctest5thread, sem, rounds);
+		if (result) {
+			panic("kmalloctest5: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		P(sem);
+	}
+
+	gettime(&end);
+	kheap_lockstats(&locks, &saved);
+	timespec_sub(&end, &start, &end);
+	sem_destroy(sem);
+
+	/* The counters include the few allocations of the forks. */
+	locks -= locks_before;
+	saved -= saved_before;
+	allocs = NTHREADS * rounds * KM5_BATCH;
+	ms = end.tv_sec * 1000 + end.tv_nsec / 1000000;
+	kprintf("%u allocations (and as many frees) in %u ms: "
+		"%u allocations per second\n", allocs, ms,
+		ms ? (uint32_t)((uint64_t)allocs * 1000 / ms) : allocs);
+	kprintf("Lock acquisitions: %u\tSaved by the magazines: %u\n",
+		locks, saved);
+	kprintf("kmalloc microbenchmark done\n");
+
+	return 0;
+}
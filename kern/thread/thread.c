@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <slab.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -69,6 +70,11 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+#if OPT_SLAB
+/* Cache of the thread structures (see slab.h). */
+static struct slab_cache *thread_cache;
+#endif
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -120,14 +126,22 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
+#if OPT_SLAB
+	thread = slab_alloc(thread_cache);
+#else
 	thread = kmalloc(sizeof(*thread));
+#endif
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
+#if OPT_SLAB
+		slab_free(thread_cache, thread);
+#else
 		kfree(thread);
+#endif
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -284,7 +298,11 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
+#if OPT_SLAB
+	slab_free(thread_cache, thread);
+#else
 	kfree(thread);
+#endif
 }
 
 /*
@@ -373,6 +391,12 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+#if OPT_SLAB
+	/* Must exist before cpu_create() creates the first thread. */
+	thread_cache = slab_create("thread", sizeof(struct thread),
+				   NULL, NULL);
+#endif
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -1140,23 +1164,19 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	while (target->c_numshootdown == TLBSHOOTDOWN_MAX) {
 		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
+		 * Wait until the target performs some of the queued
+		 * shootdowns. It takes them out of the queue without
+		 * needing anything we may hold: the VM system never
+		 * sends shootdowns while holding its own locks.
 		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+		spinlock_release(&target->c_ipi_lock);
+		spinlock_acquire(&target->c_ipi_lock);
 	}
+	n = target->c_numshootdown;
+	target->c_shootdown[n] = *mapping;
+	target->c_numshootdown = n+1;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
@@ -1164,6 +1184,37 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to each cpu, except the current one, whose
+ * number is set in the given mask. Returns the number of cpus the
+ * shootdown was sent to; the number of other cpus that were skipped
+ * because they aren't in the mask is stored in *skipped.
+ */
+unsigned
+ipi_tlbshootdown_mask(uint32_t mask, const struct tlbshootdown *mapping,
+		      unsigned *skipped)
+{
+	unsigned i, sent;
+	struct cpu *c;
+
+	sent = 0;
+	*skipped = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		if (mask & ((uint32_t)1 << c->c_number)) {
+			ipi_tlbshootdown(c, mapping);
+			sent++;
+		}
+		else {
+			(*skipped)++;
+		}
+	}
+	return sent;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1171,7 +1222,7 @@ void
 interprocessor_interrupt(void)
 {
 	uint32_t bits;
-	unsigned i;
+	struct tlbshootdown ts;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
@@ -1199,18 +1250,30 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+
+	curcpu->c_ipi_pending = 0;
+	spinlock_release(&curcpu->c_ipi_lock);
+
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * The VM system takes its page table lock in
+		 * vm_tlbshootdown, and it may send IPIs (e.g. to
+		 * wake up a thread) while holding that lock. So the
+		 * requests are taken out of the queue one at a time
+		 * and performed without holding the ipi lock. (One
+		 * at a time, so that we don't need a copy of the
+		 * whole queue on the stack.)
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		while (1) {
+			spinlock_acquire(&curcpu->c_ipi_lock);
+			if (curcpu->c_numshootdown == 0) {
+				spinlock_release(&curcpu->c_ipi_lock);
+				break;
+			}
+			curcpu->c_numshootdown--;
+			ts = curcpu->c_shootdown[curcpu->c_numshootdown];
+			spinlock_release(&curcpu->c_ipi_lock);
+			vm_tlbshootdown(&ts);
 		}
-		curcpu->c_numshootdown = 0;
 	}
-
-	curcpu->c_ipi_pending = 0;
-	spinlock_release(&curcpu->c_ipi_lock);
 }
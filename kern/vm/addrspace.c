@@ -56,6 +56,18 @@ as_create(void)
 	as->as_npages1 = 0;
 	as->as_vbase2 = 0;
 	as->as_npages2 = 0;
+	for (int i = 0; i < MAXCPUS; i++) {
+		as->asid[i] = 0;
+		as->asid_generation[i] = 0; //It will receive a valid ASID the first time it's activated on each CPU
+	}
+	as->tlb_cpus = 0; //No TLB contains entries of this address space yet
+#if OPT_SW_LIST
+	as->as_swap = swap_map_create(); //No page is in the swapfile yet
+	if (as->as_swap == NULL) {
+		kfree(as);
+		return NULL;
+	}
+#endif
 
 	return as;
 }
@@ -64,6 +76,8 @@ int
 as_copy(struct addrspace *old, struct addrspace **ret, pid_t oldp, pid_t newp)
 {
 	struct addrspace *newas;
+	struct sharer *sharers=NULL; //Per-fork buffers, filled by the reserve functions
+	struct swap_cell *cells=NULL;
 
 	newas = as_create();
 	if (newas==NULL) {
@@ -81,12 +95,36 @@ as_copy(struct addrspace *old, struct addrspace **ret, pid_t oldp, pid_t newp)
 	newas->initial_offset1 = old->initial_offset1;
 	newas->initial_offset2 = old->initial_offset2;
 
-	prepare_copy_pt(oldp); //Setup the page copy in the IPT
-	copy_swap_pages(newp, oldp); //Copy the swap pages
-	copy_pt_entries(oldp, newp); //Copy the IPT entries
-	end_copy_pt(oldp); //Restore the original situation
+	*ret = newas; //copy_swap_pages and the stores of the shared frames find the swap map of the new process through its address space
+
+	tlb_invalidate_pid(oldp); //The pages of old are going to be shared with the new process, so old can't keep its writable entries in the TLB
+
+	/**
+	 * The memory of old is shared with the new process holding both pt_spinlock and swap_lock, so that we see a consistent snapshot of it
+	 * without pinning any frame (i.e. other processes can still select them as victims while we fork). Everything that may sleep (allocations,
+	 * stores in progress and busy frames) is done before without holding any lock, and then we check that nothing is missing, since in the
+	 * meanwhile old may have lost or gained pages.
+	*/
+	while(1){
+		reserve_swap_pages(newp, oldp, &cells);
+		reserve_pt_entries(oldp, &sharers);
+		spinlock_acquire(&peps.pt_spinlock); //pt_spinlock is always acquired before swap_lock
+		swap_lock_acquire();
+		if(pt_entries_ready(oldp, sharers) && swap_pages_ready(oldp, cells)){
+			break;
+		}
+		swap_lock_release();
+		spinlock_release(&peps.pt_spinlock);
+	}
+
+	copy_swap_pages(newp, oldp, &cells); //Share the swap pages
+	copy_pt_entries(oldp, newp, &sharers); //Share the IPT entries (copy on write)
+	swap_lock_release();
+	spinlock_release(&peps.pt_spinlock);
+
+	release_swap_pool(cells); //Old may have lost some pages after we reserved the buffers
+	release_pt_pool(sharers);
 
-	*ret = newas;
 	return 0;
 }
 
@@ -99,6 +137,12 @@ as_destroy(struct addrspace *as)
 	else{
 		as->v->vn_refcount--; //We decrease the number of processes related to the ELF file
 	}
+	#if OPT_PAGE_CACHE
+	page_cache_reap(); //The page cache may still keep the file open, if some of its pages are cached
+	#endif
+	#if OPT_SW_LIST
+	swap_map_destroy(as->as_swap);
+	#endif
 
 	kfree(as);
 }
@@ -116,10 +160,11 @@ as_activate(void)
 		 * Kernel thread without an address space; leave the
 		 * prior address space in place.
 		 */
+		splx(spl);
 		return;
 	}
 
-	tlb_invalidate_all();//Since the TLB has not a PID field, we must invalidate it each time we activate a new process
+	tlb_activate(as);//The TLB entries are tagged with an ASID, so we just need to select the one of this address space
 	splx(spl);
 }
 
@@ -241,17 +286,29 @@ void vm_bootstrap(void){
 	swap_init(); //We initialize the swapfile. It's done before pt_init since in this way the pages allocated with kmalloc won't be stored in pt, causing an useless overhead since they'll never be removed.
 	pt_init(); //We initialize the page table
 	htable_init(); //We initialize the hash table
+	tsb_init(); //We initialize the translation cache in front of the hash table
+	tlb_init(); //We initialize the shadow of the TLB
+	#if OPT_PAGEOUT
+	pageout_start(); //The daemon keeps some free frames for the page faults
+	#endif
+	#if OPT_ZERO_POOL
+	zero_pool_start(); //The zeroing thread fills the pool of zeroed frames
+	#endif
 }
 
 void vm_tlbshootdown(const struct tlbshootdown *ts){
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	tlb_shootdown(ts); //Another CPU asked us to invalidate some entries of our TLB
 }
 
 void vm_shutdown(void){
 	
 	#if OPT_DEBUG
 	for(int i=0;i<peps.ptSize;i++){ //Print all the entries in the page table that haven't been correctly freed
+		#if OPT_BUDDY
+		if(peps.buddy_chunk[i >> BUDDY_MAX_ORDER]){
+			continue; //The frames of the pool of the kernel pages are always valid. The kmalloc pages not freed are counted by nkmalloc
+		}
+		#endif
 		if(peps.pt[i].ctl!=0){
 			kprintf("Entry%d has not been freed! ctl=%d, pid=%d\n",i,peps.pt[i].ctl,peps.pt[i].pid);
 		}
@@ -262,6 +319,13 @@ void vm_shutdown(void){
 	#endif
 
 	print_stats(); //Print statistics
+	htable_print_stats();
+	#if OPT_BUDDY
+	buddy_print_stats();
+	#endif
+	#if OPT_SW_LIST
+	swap_print_stats();
+	#endif
 }
 
 /**
@@ -280,8 +344,6 @@ getppages(unsigned long npages)
 
 vaddr_t alloc_kpages(unsigned npages){
 
-	int spl = splhigh(); //Disable the interrupts. In this way, we can't perform context switches during critical operations
-	
 	paddr_t p;
 
 	spinlock_acquire(&stealmem_lock); //Used to avoid race conditions on pt_active
@@ -294,14 +356,12 @@ vaddr_t alloc_kpages(unsigned npages){
 		nkmalloc+=npages;
 		#endif
 		spinlock_release(&stealmem_lock); //We must release the spinlock to avoid conflicts with the synchronization mechanisms of I/O operations
-		p = get_contiguous_pages(npages); //Get npages contiguous pages from the page table
+		p = get_contiguous_pages(npages); //Get npages contiguous pages from the page table. It's protected by pt_spinlock
 		spinlock_acquire(&stealmem_lock);
 	}
 
 	spinlock_release(&stealmem_lock);
 
-	splx(spl); //Enable again the interrupts
-
 	KASSERT(PADDR_TO_KVADDR(p)>0x80000000 && PADDR_TO_KVADDR(p)<=0x90000000);
 
 	return PADDR_TO_KVADDR(p);
@@ -309,8 +369,6 @@ vaddr_t alloc_kpages(unsigned npages){
 
 void free_kpages(vaddr_t addr){
 
-	int spl = splhigh();
-
 	spinlock_acquire(&stealmem_lock);
 
 	if(!pt_active || addr < PADDR_TO_KVADDR(peps.firstfreepaddr)){
@@ -325,8 +383,6 @@ void free_kpages(vaddr_t addr){
 	}
 
 	spinlock_release(&stealmem_lock);
-
-	splx(spl);
 }
 
 void addrspace_init(void){
@@ -334,6 +390,3 @@ void addrspace_init(void){
 	pt_active=0;
 }
 
-void create_sem_fork(void){
-	sem_fork = sem_create("sem_fork",1);
-}
@@ -31,7 +31,10 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include <cpu.h>
+#include <current.h>
 #include "spl.h"
+#include "opt-magazine.h"
 
 /*
  * Kernel malloc.
@@ -79,6 +82,17 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    The pages of each size that have at least one free block are
+//    kept in a doubly linked list, so kmalloc takes the first one
+//    and kfree can put back a page that was full, both in O(1). The
+//    page of a block is found by kfree through pagerefs_by_page,
+//    indexed by the physical page number, instead of searching all
+//    the pages.
+//
+//    With the option magazine, each CPU also keeps for each size a
+//    small stack of free blocks (a magazine), that kmalloc and kfree
+//    use with the interrupts off but without kmalloc_spinlock.
+//
 
 ////////////////////////////////////////
 
@@ -146,7 +160,7 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *prev_samesize;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -161,14 +175,20 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole thing. The magazines (see below) are
+ * per-cpu, so the blocks that they contain are allocated and freed
+ * without it.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * Number of times the subpage allocator took kmalloc_spinlock, and
+ * number of kmalloc/kfree served by a magazine instead. Both are read
+ * by kheap_lockstats.
+ */
+static uint32_t kmalloc_lockcount;
+
 ////////////////////////////////////////
 
 /*
@@ -268,6 +288,21 @@ allocpageref(void)
 		if (root->numinuse >= NPAGEREFS_PER_PAGE) {
 			continue;
 		}
+		if (root->page == NULL) {
+			/*
+			 * Get the page before marking an entry, since
+			 * the spinlock is released in the meanwhile:
+			 * an entry marked in use must always be valid
+			 * for the stats.
+			 */
+			allocpagerefpage(root);
+			if (root->page == NULL) {
+				return NULL;
+			}
+			if (root->numinuse >= NPAGEREFS_PER_PAGE) {
+				continue;
+			}
+		}
 
 		/*
 		 * This should probably not be a linear search.
@@ -281,12 +316,6 @@ allocpageref(void)
 				if ((root->pagerefs_inuse[i] & k)==0) {
 					root->pagerefs_inuse[i] |= k;
 					root->numinuse++;
-					if (root->page == NULL) {
-						allocpagerefpage(root);
-					}
-					if (root->page == NULL) {
-						return NULL;
-					}
 					return &root->page->refs[i*32 + j];
 				}
 			}
@@ -340,11 +369,68 @@ freepageref(struct pageref *p)
 ////////////////////////////////////////
 
 /*
- * Each pageref is on two linked lists: one list of pages of blocks of
- * that same size, and one of all blocks.
+ * Each pageref with at least one free block is on the list of the
+ * pages of blocks of that same size. All the pagerefs in use are in
+ * pagerefs_by_page, at the index of the physical page that they
+ * manage. Like kheaproots, it's sized for the 16M of System/161.
  */
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+
+#define NUM_HEAP_PAGES (16 * 1024 * 1024 / PAGE_SIZE)
+#define HEAP_PAGE_INDEX(va) (KVADDR_TO_PADDR(va) / PAGE_SIZE)
+
+static struct pageref *pagerefs_by_page[NUM_HEAP_PAGES];
+
+/*
+ * Return the pageref of the heap page that contains the address VA, or
+ * NULL if the page isn't a heap page.
+ */
+static
+struct pageref *
+lookup_pageref(vaddr_t va)
+{
+	vaddr_t index;
+
+	index = HEAP_PAGE_INDEX(va & PAGE_FRAME);
+	if (index >= NUM_HEAP_PAGES) {
+		return NULL;
+	}
+	return pagerefs_by_page[index];
+}
+
+/*
+ * Add a page that has free blocks to the list of its size, and remove
+ * it when it has none. Both are O(1).
+ */
+static
+void
+avail_push(struct pageref *pr, int blktype)
+{
+	pr->prev_samesize = NULL;
+	pr->next_samesize = sizebases[blktype];
+	if (sizebases[blktype] != NULL) {
+		sizebases[blktype]->prev_samesize = pr;
+	}
+	sizebases[blktype] = pr;
+}
+
+static
+void
+avail_remove(struct pageref *pr, int blktype)
+{
+	if (pr->prev_samesize != NULL) {
+		pr->prev_samesize->next_samesize = pr->next_samesize;
+	}
+	else {
+		KASSERT(sizebases[blktype] == pr);
+		sizebases[blktype] = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
+	}
+	pr->next_samesize = NULL;
+	pr->prev_samesize = NULL;
+}
 
 ////////////////////////////////////////
 
@@ -581,7 +667,7 @@ void
 checksubpages(void)
 {
 	struct pageref *pr;
-	int i;
+	unsigned i;
 	unsigned sc=0, ac=0;
 
 	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
@@ -589,18 +675,26 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
+			KASSERT(pr->nfree > 0);
+			KASSERT(pagerefs_by_page[HEAP_PAGE_INDEX(PR_PAGEADDR(pr))]
+				== pr);
 			KASSERT(sc < TOTAL_PAGEREFS);
 			sc++;
 		}
 	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+	for (i=0; i<NUM_HEAP_PAGES; i++) {
+		pr = pagerefs_by_page[i];
+		if (pr == NULL) {
+			continue;
+		}
 		checksubpage(pr);
 		KASSERT(ac < TOTAL_PAGEREFS);
 		ac++;
 	}
 
-	KASSERT(sc==ac);
+	/* The full pages aren't on any size list. */
+	KASSERT(sc<=ac);
 }
 #else
 #define checksubpages()
@@ -681,13 +775,12 @@ static
 void
 dump_subpages(unsigned generation)
 {
-	struct pageref *pr;
-	int i;
+	unsigned i;
 
 	kprintf("Remaining allocations from generation %u:\n", generation);
-	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
-			dump_subpage(pr, generation);
+	for (i=0; i<NUM_HEAP_PAGES; i++) {
+		if (pagerefs_by_page[i] != NULL) {
+			dump_subpage(pagerefs_by_page[i], generation);
 		}
 	}
 }
@@ -801,50 +894,29 @@ subpage_stats(struct pageref *pr)
 void
 kheap_printstats(void)
 {
-	struct pageref *pr;
+	unsigned i;
+	uint32_t locks, saved;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		subpage_stats(pr);
+	for (i=0; i<NUM_HEAP_PAGES; i++) {
+		if (pagerefs_by_page[i] != NULL) {
+			subpage_stats(pagerefs_by_page[i]);
+		}
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kheap_lockstats(&locks, &saved);
+	kprintf("Lock acquisitions: %u (%u saved by the magazines)\n",
+		locks, saved);
 }
 
 ////////////////////////////////////////
 
-/*
- * Remove a pageref from both lists that it's on.
- */
-static
-void
-remove_lists(struct pageref *pr, int blktype)
-{
-	struct pageref **guy;
-
-	KASSERT(blktype>=0 && blktype<NSIZES);
-
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
-	}
-
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
-	}
-}
-
 /*
  * Given a requested client size, return the block type, that is, the
  * index into the sizes[] array for the block size to use.
@@ -867,6 +939,203 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Take the first free block of the page managed by PR. If the page
+ * becomes full, it leaves the list of its size.
+ */
+static
+void *
+pr_popblock(struct pageref *pr, int blktype)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *block;
+
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	block = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+		avail_remove(pr, blktype);
+	}
+	return block;
+}
+
+/*
+ * The magazines don't know about guard bands and labels, so they're
+ * used only when both are off.
+ */
+#if OPT_MAGAZINE && !defined(GUARDS) && !defined(LABELS)
+#define USE_MAGAZINES 1
+#else
+#define USE_MAGAZINES 0
+#endif
+
+#if USE_MAGAZINES
+/*
+ * Per-cpu magazines. A magazine is a stack of up to KMAG_SIZE free
+ * blocks of one size that only its cpu uses, with the interrupts off,
+ * so kmalloc and kfree don't take kmalloc_spinlock as long as the
+ * magazine isn't empty (kmalloc) or full (kfree). When kmalloc finds
+ * it empty, subpage_kmalloc refills it with up to KMAG_BATCH blocks
+ * while it holds the spinlock anyway. When kfree finds it full, the
+ * block goes back to its page as before.
+ *
+ * The blocks in a magazine are still allocated from the point of view
+ * of their page, so a page with blocks in some magazine isn't freed.
+ * There are at most KMAG_SIZE * NSIZES such blocks per cpu.
+ */
+#define KMAG_MAXCPUS 32		/* System/161 has at most 32 cpus */
+#define KMAG_SIZE 8
+#define KMAG_BATCH 4
+
+struct kmagazine {
+	unsigned nblocks;
+	void *blocks[KMAG_SIZE];
+};
+
+static struct kmagazine kmagazines[KMAG_MAXCPUS][NSIZES];
+static uint32_t kmag_hits[KMAG_MAXCPUS];	/* lock acquisitions saved */
+
+/*
+ * Return the magazines of the current cpu, or NULL if there are none
+ * (before curcpu exists). Must be called with the interrupts off, so
+ * that we can't move to another cpu.
+ */
+static
+struct kmagazine *
+curmagazines(void)
+{
+	if (!CURCPU_EXISTS() || curcpu->c_number >= KMAG_MAXCPUS) {
+		return NULL;
+	}
+	return kmagazines[curcpu->c_number];
+}
+
+/*
+ * Take a block of type BLKTYPE from the magazine of this cpu. Return
+ * NULL if it's empty.
+ */
+static
+void *
+magazine_alloc(int blktype)
+{
+	struct kmagazine *mags;
+	void *block = NULL;
+	int spl;
+
+	spl = splhigh();
+	mags = curmagazines();
+	if (mags != NULL && mags[blktype].nblocks > 0) {
+		block = mags[blktype].blocks[--mags[blktype].nblocks];
+		kmag_hits[curcpu->c_number]++;
+	}
+	splx(spl);
+
+	return block;
+}
+
+/*
+ * Refill the magazine of this cpu from the pages of type BLKTYPE that
+ * have free blocks. Called by subpage_kmalloc with the spinlock held.
+ */
+static
+void
+magazine_fill(int blktype)
+{
+	struct kmagazine *mags;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	mags = curmagazines();
+	if (mags == NULL) {
+		return;
+	}
+	while (mags[blktype].nblocks < KMAG_BATCH &&
+	       sizebases[blktype] != NULL) {
+		mags[blktype].blocks[mags[blktype].nblocks++] =
+			pr_popblock(sizebases[blktype], blktype);
+	}
+}
+
+/*
+ * Put a block in the magazine of this cpu. Return -1 if the block
+ * isn't a subpage block or if the magazine is full.
+ *
+ * We don't hold the spinlock, but the page of an allocated block
+ * can't be freed, so its entry in pagerefs_by_page doesn't change.
+ */
+static
+int
+magazine_free(void *ptr)
+{
+	struct pageref *pr;
+	struct kmagazine *mags;
+	vaddr_t offset;
+	int blktype, spl, result = -1;
+
+	pr = lookup_pageref((vaddr_t)ptr);
+	if (pr == NULL) {
+		return -1;
+	}
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+	offset = (vaddr_t)ptr - PR_PAGEADDR(pr);
+	if (offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+	/* As in subpage_kfree, to catch uses of dangling pointers. */
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	spl = splhigh();
+	mags = curmagazines();
+	if (mags != NULL && mags[blktype].nblocks < KMAG_SIZE) {
+		mags[blktype].blocks[mags[blktype].nblocks++] = ptr;
+		kmag_hits[curcpu->c_number]++;
+		result = 0;
+	}
+	splx(spl);
+
+	return result;
+}
+#endif /* USE_MAGAZINES */
+
+/*
+ * Return the number of times the subpage allocator took its spinlock
+ * and the number of allocations and frees served by the magazines
+ * without taking it.
+ */
+void
+kheap_lockstats(uint32_t *locks, uint32_t *saved)
+{
+	spinlock_acquire(&kmalloc_spinlock);
+	*locks = kmalloc_lockcount;
+	spinlock_release(&kmalloc_spinlock);
+
+	*saved = 0;
+#if USE_MAGAZINES
+	for (unsigned i=0; i<KMAG_MAXCPUS; i++) {
+		*saved += kmag_hits[i];
+	}
+#endif
+}
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -909,50 +1178,36 @@ subpage_kmalloc(size_t sz
 #endif
 
 	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lockcount++;
 
 	checksubpages();
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	/* All the pages on the list have free blocks. */
+	pr = sizebases[blktype];
+	if (pr != NULL) {
 
 		/* check for corruption */
 		KASSERT(PR_BLOCKTYPE(pr) == blktype);
 		checksubpage(pr);
 
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
-
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+	doalloc: /* comes here after getting a whole fresh page */
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+		retptr = pr_popblock(pr, blktype);
 #ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
+		retptr = establishguardband(retptr, clientsz, sz);
 #endif
 #ifdef LABELS
-			retptr = establishlabel(retptr, label);
+		retptr = establishlabel(retptr, label);
+#endif
+#if USE_MAGAZINES
+		/* We hold the spinlock anyway: refill the magazine. */
+		magazine_fill(blktype);
 #endif
 
-			checksubpages();
+		checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
+		spinlock_release(&kmalloc_spinlock);
+		return retptr;
 	}
 
 	/*
@@ -977,6 +1232,7 @@ subpage_kmalloc(size_t sz
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lockcount++;
 
 	pr = allocpageref();
 	if (pr==NULL) {
@@ -1008,11 +1264,10 @@ subpage_kmalloc(size_t sz
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	KASSERT(HEAP_PAGE_INDEX(prpage) < NUM_HEAP_PAGES);
+	KASSERT(pagerefs_by_page[HEAP_PAGE_INDEX(prpage)] == NULL);
+	pagerefs_by_page[HEAP_PAGE_INDEX(prpage)] = pr;
+	avail_push(pr, blktype);
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -1063,33 +1318,24 @@ subpage_kfree(void *ptr)
 #endif
 
 	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lockcount++;
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = lookup_pageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1118,6 +1364,8 @@ subpage_kfree(void *ptr)
 	fl = (struct freelist *)fla;
 	if (pr->freelist_offset == INVALID_OFFSET) {
 		fl->next = NULL;
+		/* The page was full, so it wasn't on the list. */
+		avail_push(pr, blktype);
 	} else {
 		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
 
@@ -1141,7 +1389,8 @@ subpage_kfree(void *ptr)
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
-		remove_lists(pr, blktype);
+		avail_remove(pr, blktype);
+		pagerefs_by_page[HEAP_PAGE_INDEX(prpage)] = NULL;
 		freepageref(pr);
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
@@ -1201,6 +1450,12 @@ kmalloc(size_t sz)
 #ifdef LABELS
 	return subpage_kmalloc(sz, label);
 #else
+#if USE_MAGAZINES
+	void *block = magazine_alloc(blocktype(sz));
+	if (block != NULL) {
+		return block;
+	}
+#endif
 	void* ret = subpage_kmalloc(sz);
 	return ret;
 #endif
@@ -1217,7 +1472,13 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if USE_MAGAZINES
+	else if (magazine_free(ptr) == 0) {
+		return;
+	}
+#endif
+	else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -7,12 +7,21 @@
 #define TLBBITONE(a) (a | 4)
 #define TLBBITZERO(a) (a & ~4)
 #define GETTLBBIT(a) (a & 4)
-#define IOBITONE(a) (a | 8)
-#define IOBITZERO(a) (a & ~8)
-#define GETIOBIT(a) (a & 8)
-#define SWAPBITONE(a) (a | 16)
-#define SWAPBITZERO(a) (a & ~16)
-#define GETSWAPBIT(a) (a & 16)
+#define BUSYBITONE(a) (a | 8)
+#define BUSYBITZERO(a) (a & ~8)
+#define GETBUSYBIT(a) (a & 8)
+#define DIRTYBITONE(a) (a | 32)
+#define DIRTYBITZERO(a) (a & ~32)
+#define GETDIRTYBIT(a) (a & 32)
+#define CACHEDBITONE(a) (a | 64)
+#define CACHEDBITZERO(a) (a & ~64)
+#define GETCACHEDBIT(a) (a & 64)
+#define RABITONE(a) (a | 16)
+#define RABITZERO(a) (a & ~16)
+#define GETRABIT(a) (a & 16)
+#define ZEROEDBITONE(a) (a | 128)
+#define ZEROEDBITZERO(a) (a & ~128)
+#define GETZEROEDBIT(a) (a & 128) //Used only for the free frames: the frame has been zeroed by the zeroing thread
 
 #define KMALLOC_PAGE 1 //Since all the valid pages will end with 0x...000, we are sure that no entry will have 0x1 as value
 
@@ -23,14 +32,354 @@
 #include "cpu.h"
 #include "types.h"
 #include "spinlock.h"
+#include "wchan.h"
 #include "pt.h"
 #include "segments.h"
 #include "proc.h"
 #include "current.h"
 #include "vmstats.h"
+#include "opt-swap_cache.h"
+#include "thread.h"
+#include "clock.h"
+#include "slab.h"
 
 int lastIndex = 0; //Used to implement second chance replacement policy
 
+#if OPT_SWAP_CACHE
+#define SWAP_CACHE_RECLAIM 32 //Number of swap cache entries released each time the swapfile is full
+static int reclaimIndex = 0; //Round robin index used to choose the swap cache entries to release
+#endif
+
+#if OPT_READAHEAD
+static int ra_window[MAX_PROC + 1]; //Readahead window of each process (in pages), indexed by pid (1..MAX_PROC). It's protected by pt_spinlock
+#endif
+
+/**
+ * Free list helpers. A frame is in the free list if and only if its validity bit is 0, so every time we clear the validity bit
+ * we must push the frame and every time we set it on a frame that was free we must remove it. Since the list is doubly linked,
+ * all these operations are O(1), so getting a free frame doesn't depend anymore on the size of the RAM.
+ * The frames are pushed in head, except the zeroed ones that are pushed in tail: findspace takes first the frames that aren't zeroed,
+ * while the zero-fill faults look for a zeroed frame in tail.
+*/
+static void freelist_push(int i)
+{
+    KASSERT(!GETZEROEDBIT(peps.pt[i].ctl));
+    peps.free_prev[i] = -1;
+    peps.free_next[i] = peps.free_head; //Insertion in head
+    if (peps.free_head != -1)
+    {
+        peps.free_prev[peps.free_head] = i;
+    }
+    else
+    {
+        peps.free_tail = i;
+    }
+    peps.free_head = i;
+    peps.nfree++;
+}
+
+#if OPT_ZERO_POOL
+static void freelist_push_zeroed(int i)
+{
+    peps.pt[i].ctl = ZEROEDBITONE(peps.pt[i].ctl);
+    peps.free_next[i] = -1;
+    peps.free_prev[i] = peps.free_tail; //Insertion in tail
+    if (peps.free_tail != -1)
+    {
+        peps.free_next[peps.free_tail] = i;
+    }
+    else
+    {
+        peps.free_head = i;
+    }
+    peps.free_tail = i;
+    peps.nfree++;
+    peps.nzeroed++;
+}
+#endif
+
+static void freelist_remove(int i)
+{
+    if (peps.free_prev[i] != -1)
+    {
+        peps.free_next[peps.free_prev[i]] = peps.free_next[i];
+    }
+    else
+    {
+        KASSERT(peps.free_head == i);
+        peps.free_head = peps.free_next[i]; //Removal from head
+    }
+    if (peps.free_next[i] != -1)
+    {
+        peps.free_prev[peps.free_next[i]] = peps.free_prev[i];
+    }
+    else
+    {
+        KASSERT(peps.free_tail == i);
+        peps.free_tail = peps.free_prev[i]; //Removal from tail
+    }
+    peps.free_next[i] = -1;
+    peps.free_prev[i] = -1;
+    peps.nfree--;
+    #if OPT_ZERO_POOL
+    if (GETZEROEDBIT(peps.pt[i].ctl))
+    {
+        peps.pt[i].ctl = ZEROEDBITZERO(peps.pt[i].ctl); //The bit is meaningful only in the free list
+        peps.nzeroed--;
+    }
+    #endif
+}
+
+/**
+ * Copy on write helpers. A frame shared after a fork is mapped by its owner (pid field of the IPT entry) and by all the processes
+ * in peps.sharers. All of them have an entry in the hash table that points to the frame.
+*/
+static int maps_frame(int i, pid_t pid)
+{
+    struct sharer *s;
+
+    if (peps.pt[i].pid == pid)
+    {
+        return 1;
+    }
+    for (s = peps.sharers[i]; s != NULL; s = s->next)
+    {
+        if (s->pid == pid)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#if OPT_SLAB
+static struct slab_cache *sharer_cache; //Cache of the sharers (see slab.h)
+#endif
+
+/**
+ * Allocation of the sharers, from their object cache if we have it. They must be called without holding pt_spinlock.
+*/
+static struct sharer *sharer_alloc(void)
+{
+    #if OPT_SLAB
+    return slab_alloc(sharer_cache);
+    #else
+    return kmalloc(sizeof(struct sharer));
+    #endif
+}
+
+static void sharer_free(struct sharer *s)
+{
+    #if OPT_SLAB
+    slab_free(sharer_cache, s);
+    #else
+    kfree(s);
+    #endif
+}
+
+/**
+ * Sharers are released while holding pt_spinlock, where we can't call kfree (it may need to free a frame), so we keep them for the next forks.
+*/
+static void put_sharer(struct sharer *s)
+{
+    s->next = peps.spare_sharers;
+    peps.spare_sharers = s;
+}
+
+static void add_sharer(int i, pid_t pid, struct sharer *s)
+{
+    s->pid = pid;
+    s->next = peps.sharers[i]; //Insertion in head
+    peps.sharers[i] = s;
+}
+
+/**
+ * It removes pid from the processes that map frame i. If pid was the owner, the first sharer becomes the new owner.
+ * It returns 1 if the frame is still mapped by some process, 0 otherwise.
+*/
+static int remove_mapping(int i, pid_t pid)
+{
+    struct sharer *s, *prev = NULL;
+
+    if (peps.pt[i].pid == pid)
+    {
+        s = peps.sharers[i];
+        if (s == NULL)
+        {
+            return 0; //The frame was private
+        }
+        peps.pt[i].pid = s->pid;
+        peps.sharers[i] = s->next;
+        put_sharer(s);
+        return 1;
+    }
+    for (s = peps.sharers[i]; s != NULL; prev = s, s = s->next)
+    {
+        if (s->pid == pid)
+        {
+            if (prev == NULL)
+            {
+                peps.sharers[i] = s->next;
+            }
+            else
+            {
+                prev->next = s->next;
+            }
+            put_sharer(s);
+            return 1;
+        }
+    }
+    panic("The process doesn't map the frame!");
+}
+
+static void free_sharers(struct sharer *s)
+{
+    struct sharer *next;
+
+    for (; s != NULL; s = next)
+    {
+        next = s->next;
+        put_sharer(s);
+    }
+}
+
+#if OPT_TEXT_SHARE
+/**
+ * File index helpers. A frame is in the file index while it contains a clean text page read from the ELF file. The other processes
+ * that run the same program find it with (vnode, offset) and become sharers of the frame, exactly as after a fork. A frame leaves
+ * the index when it's evicted, freed or written (file_forget). The vnode can't be closed while the frame is in the index, since all
+ * the processes that map it keep the ELF file open until free_pages. With the page cache the frames outlive their processes, so the
+ * page cache itself keeps a reference to each vnode that has frames in the index (cache_vnodes).
+ * They must be called with pt_spinlock held.
+*/
+static int file_bucket(struct vnode *vn, off_t offset)
+{
+    return (int)((((uint32_t)vn) >> 4) ^ (((uint32_t)offset) >> 12)) & (FILE_BUCKETS - 1);
+}
+
+static int file_lookup(struct vnode *vn, off_t offset, vaddr_t v)
+{
+    int i;
+
+    for (i = peps.file_buckets[file_bucket(vn, offset)]; i != -1; i = peps.file_next[i])
+    {
+        if (peps.file_vnode[i] == vn && peps.file_offset[i] == offset && peps.pt[i].page == v) //The sharers use the same virtual address
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#if OPT_PAGE_CACHE
+/**
+ * It returns the slot of vn in cache_vnodes, taking a reference to vn if it wasn't there. VOP_INCREF only acquires the spinlock
+ * of the vnode, so it can be called here. The slots of the files without frames can't be reused until page_cache_reap closes them.
+ *
+ * @return the slot, -1 if the page cache already references PCACHE_VNODES files
+*/
+static int cache_vnode_slot(struct vnode *vn)
+{
+    int k, empty = -1;
+
+    for (k = 0; k < PCACHE_VNODES; k++)
+    {
+        if (peps.cache_vnodes[k] == vn)
+        {
+            return k;
+        }
+        if (peps.cache_vnodes[k] == NULL && empty == -1)
+        {
+            empty = k;
+        }
+    }
+    if (empty != -1)
+    {
+        VOP_INCREF(vn);
+        peps.cache_vnodes[empty] = vn;
+        peps.cache_vnode_pages[empty] = 0;
+    }
+    return empty;
+}
+#endif
+
+static void file_insert(int i, struct vnode *vn, off_t offset)
+{
+    int b = file_bucket(vn, offset);
+
+    KASSERT(peps.file_vnode[i] == NULL);
+    #if OPT_PAGE_CACHE
+    int k = cache_vnode_slot(vn);
+    if (k == -1)
+    {
+        return; //Too many files in the page cache: the frame stays private
+    }
+    peps.cache_vnode_pages[k]++;
+    #endif
+    peps.file_vnode[i] = vn;
+    peps.file_offset[i] = offset;
+    peps.file_next[i] = peps.file_buckets[b]; //Insertion in head
+    peps.file_buckets[b] = i;
+    add_text_share_stat(TEXT_SHARE_LOADS, 1);
+}
+
+static void file_forget(int i)
+{
+    int *link;
+
+    if (peps.file_vnode[i] == NULL)
+    {
+        return; //The frame isn't in the index
+    }
+    for (link = &peps.file_buckets[file_bucket(peps.file_vnode[i], peps.file_offset[i])]; *link != i; link = &peps.file_next[*link])
+    {
+        KASSERT(*link != -1);
+    }
+    *link = peps.file_next[i];
+    #if OPT_PAGE_CACHE
+    for (int k = 0; k < PCACHE_VNODES; k++)
+    {
+        if (peps.cache_vnodes[k] == peps.file_vnode[i])
+        {
+            peps.cache_vnode_pages[k]--; //At 0 the file will be closed by page_cache_reap
+            break;
+        }
+    }
+    #endif
+    peps.file_next[i] = -1;
+    peps.file_vnode[i] = NULL;
+}
+
+#if OPT_PAGE_CACHE
+/**
+ * It tells if frame i is in the file index. Its page must never be written, so a write copies it even if only one process maps it.
+*/
+static int in_file_index(int i)
+{
+    return peps.file_vnode[i] != NULL;
+}
+#endif
+#endif
+
+/**
+ * Busy frames. A frame is busy while a page is loaded in it, while its page is stored in the swapfile, while it's copied after a fork
+ * and while it's reserved for a kmalloc. All these operations release pt_spinlock, and the busy bit tells the other threads that they must
+ * neither select the frame as a victim nor use its page. The threads that need the page sleep on the wait channel of the frame.
+ * They must be called with pt_spinlock held.
+*/
+static void wait_frame(int i)
+{
+    wchan_sleep(peps.frame_wchan[i % FRAME_WCHANS], &peps.pt_spinlock);
+}
+
+static void frame_ready(int i)
+{
+    KASSERT(GETBUSYBIT(peps.pt[i].ctl));
+    peps.pt[i].ctl = BUSYBITZERO(peps.pt[i].ctl);
+    wchan_wakeall(peps.frame_wchan[i % FRAME_WCHANS], &peps.pt_spinlock);
+    wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //The frame may be selected as a victim again
+}
+
 void pt_init(void)
 {
     spinlock_acquire(&stealmem_lock);
@@ -51,115 +400,636 @@ void pt_init(void)
         panic("error allocating IPT!!");
     }
     
-    peps.pt_lock = lock_create("pagetable-lock");
-    if(peps.pt_lock==NULL){
-        panic("error!! lock not initialized...");
+    spinlock_init(&peps.pt_spinlock);
+    spinlock_release(&stealmem_lock);
+    for (int i = 0; i < FRAME_WCHANS; i++)
+    {
+        peps.frame_wchan[i] = wchan_create("frame-wchan");
+        if (peps.frame_wchan[i] == NULL)
+        {
+            panic("error!! wchan not initialized...");
+        }
     }
-    peps.pt_cv = cv_create("pagetable-cv");
-    if(peps.pt_lock==NULL){
-        panic("error!! cv not initialized...");
+    peps.victim_wchan = wchan_create("victim-wchan");
+    if (peps.victim_wchan == NULL)
+    {
+        panic("error!! wchan not initialized...");
     }
-    spinlock_release(&stealmem_lock);
+    #if OPT_PAGEOUT
+    peps.pageout_wchan = wchan_create("pageout-wchan");
+    if (peps.pageout_wchan == NULL)
+    {
+        panic("error!! wchan not initialized...");
+    }
+    #endif
+    #if OPT_ZERO_POOL
+    peps.zero_wchan = wchan_create("zero-wchan");
+    if (peps.zero_wchan == NULL)
+    {
+        panic("error!! wchan not initialized...");
+    }
+    #endif
     peps.contiguous = kmalloc(sizeof(int) * numFrames);
     spinlock_acquire(&stealmem_lock);
     if (peps.contiguous == NULL)
     {
         panic("error allocating contiguous!!");
     }
+    spinlock_release(&stealmem_lock);
+    peps.free_next = kmalloc(sizeof(int) * numFrames);
+    peps.free_prev = kmalloc(sizeof(int) * numFrames);
+    spinlock_acquire(&stealmem_lock);
+    if (peps.free_next == NULL || peps.free_prev == NULL)
+    {
+        panic("error allocating the free list!!");
+    }
+    spinlock_release(&stealmem_lock);
+    peps.sharers = kmalloc(sizeof(struct sharer *) * numFrames);
+    #if OPT_SLAB
+    sharer_cache = slab_create("sharer", sizeof(struct sharer), NULL, NULL);
+    #endif
+    spinlock_acquire(&stealmem_lock);
+    if (peps.sharers == NULL)
+    {
+        panic("error allocating sharers!!");
+    }
+    #if OPT_TEXT_SHARE
+    spinlock_release(&stealmem_lock);
+    peps.file_vnode = kmalloc(sizeof(struct vnode *) * numFrames);
+    peps.file_offset = kmalloc(sizeof(off_t) * numFrames);
+    peps.file_next = kmalloc(sizeof(int) * numFrames);
+    peps.file_buckets = kmalloc(sizeof(int) * FILE_BUCKETS);
+    spinlock_acquire(&stealmem_lock);
+    if (peps.file_vnode == NULL || peps.file_offset == NULL || peps.file_next == NULL || peps.file_buckets == NULL)
+    {
+        panic("error allocating the file index!!");
+    }
+    for (int i = 0; i < FILE_BUCKETS; i++)
+    {
+        peps.file_buckets[i] = -1;
+    }
+    #endif
+    #if OPT_PAGE_CACHE
+    for (int i = 0; i < PCACHE_VNODES; i++)
+    {
+        peps.cache_vnodes[i] = NULL;
+        peps.cache_vnode_pages[i] = 0;
+    }
+    #endif
+    #if OPT_BUDDY
+    spinlock_release(&stealmem_lock);
+    peps.buddy_order = kmalloc(sizeof(int) * numFrames);
+    peps.buddy_chunk = kmalloc(sizeof(uint8_t) * ((numFrames >> BUDDY_MAX_ORDER) + 1));
+    spinlock_acquire(&stealmem_lock);
+    if (peps.buddy_order == NULL || peps.buddy_chunk == NULL)
+    {
+        panic("error allocating the buddy allocator!!");
+    }
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++)
+    {
+        peps.buddy_free[i] = -1;
+    }
+    for (int i = 0; i <= numFrames >> BUDDY_MAX_ORDER; i++)
+    {
+        peps.buddy_chunk[i] = 0; //The pool is empty: it grows with the first kmalloc after pt_active
+    }
+    peps.buddy_chunks = 0;
+    peps.buddy_free_chunks = 0;
+    peps.buddy_nfree = 0;
+    #endif
     for (int i = 0; i < numFrames; i++) // We initialize all the entries with default values
     {
         peps.pt[i].ctl = 0;
+        peps.pt[i].tlb = 0;
         peps.contiguous[i]=-1;
+        peps.sharers[i]=NULL;
+        #if OPT_TEXT_SHARE
+        peps.file_vnode[i]=NULL;
+        peps.file_next[i]=-1;
+        #endif
+        #if OPT_BUDDY
+        peps.buddy_order[i]=-1;
+        #endif
     }
+    peps.spare_sharers = NULL;
+    #if OPT_READAHEAD
+    for (int i = 0; i <= MAX_PROC; i++)
+    {
+        ra_window[i] = RA_WINDOW_INIT;
+    }
+    #endif
 
     DEBUG(DB_VM,"Ram size :0x%x, first free address: 0x%x, available memory: 0x%x",mainbus_ramsize(),ram_stealmem(0),mainbus_ramsize()-ram_stealmem(0));
 
     peps.ptSize = ((mainbus_ramsize() - ram_stealmem(0)) / PAGE_SIZE) - 1; //ram_stealmem(0) allows us to get the first free physical address, i.e. from where our IPT starts.    
     peps.firstfreepaddr = ram_stealmem(0);
 
+    //At the beginning all the frames are free. We insert them in reverse order so that the first pages used will be the ones with the lowest index
+    peps.free_head = -1;
+    peps.free_tail = -1;
+    peps.nfree = 0;
+    for (int i = peps.ptSize - 1; i >= 0; i--)
+    {
+        freelist_push(i);
+    }
+    #if OPT_PAGEOUT
+    peps.pageout_low = peps.ptSize * PAGEOUT_LOW_PCT / 100;
+    peps.pageout_high = peps.ptSize * PAGEOUT_HIGH_PCT / 100;
+    #endif
+    #if OPT_ZERO_POOL
+    peps.nzeroed = 0;
+    peps.zero_target = peps.ptSize * ZERO_POOL_PCT / 100;
+    #endif
+
     pt_active=1; //We configured correctly our IPT, so from now on kmalloc operations can be handled by it.
 
     spinlock_release(&stealmem_lock);
 }
 
+#define HASH_MULTIPLIER 2654435769U //2^32 divided by the golden ratio, used for Fibonacci hashing
+
+/**
+ * It allocates a table of 2^bits empty slots
+*/
+static struct hashentry *htable_alloc(int bits){
+    struct hashentry *table;
+    int size = 1 << bits;
+
+    table = kmalloc(sizeof(struct hashentry) * size);
+    if (!table)
+    {
+        panic("Error during hash table allocation");
+    }
+    for (int ii = 0; ii < size; ii++)
+    {
+        table[ii].vad = 0; // all the slots are empty
+        table[ii].pid = 0;
+        table[ii].iptentry = -1;
+    }
+    return table;
+}
+
 void htable_init(void){
-    htable.size = 2 * peps.ptSize;  // size of hash table   
+    htable.bits = 1;
+    while ((1 << htable.bits) < 2 * peps.ptSize) // size of hash table: the first power of 2 bigger than 2 times the IPT
+    {
+        htable.bits++;
+    }
+    htable.size = 1 << htable.bits;
+    htable.count = 0;
+    htable.table = htable_alloc(htable.bits); // alloc hash table
+}
+
+/**
+ * It doubles the size of the hash table, rehashing all the entries. It's called with pt_spinlock held.
+ * Please notice that kmalloc may need to free some frames in the IPT, removing their entries from the hash table. For this reason
+ * we release the lock and we allocate the new table before looking at the old one. If another thread resized the table in the meanwhile
+ * we just give back our one.
+*/
+static void htable_grow(void){
+    struct hashentry *new_table, *old_table;
+    int old_size, old_bits = htable.bits, val;
 
-    htable.table = kmalloc(sizeof(struct hashentry *) * htable.size); // alloc hash table
-    for (int ii = 0; ii < htable.size; ii++) 
+    spinlock_release(&peps.pt_spinlock);
+    new_table = htable_alloc(old_bits + 1);
+    spinlock_acquire(&peps.pt_spinlock);
+
+    if (htable.bits != old_bits)
     {
-        htable.table[ii] = NULL; // no pointers for now inside the array of lists
+        spinlock_release(&peps.pt_spinlock);
+        kfree(new_table);
+        spinlock_acquire(&peps.pt_spinlock);
+        return;
     }
 
-    unusedptrlist = NULL;  
-    struct hashentry *tmp; 
-    for (int jj = 0; jj <  peps.ptSize; jj++) // initialize unused ptr list
+    old_table = htable.table;
+    old_size = htable.size;
+    htable.table = new_table;
+    htable.bits++;
+    htable.size = 1 << htable.bits;
+
+    for (int i = 0; i < old_size; i++)
     {
-        tmp = kmalloc(sizeof(struct hashentry));
-        KASSERT((unsigned int)tmp>0x80000000);
-        if (!tmp)
+        if (old_table[i].vad == 0)
+        {
+            continue;
+        }
+        val = get_hash_func(old_table[i].vad, old_table[i].pid);
+        while (htable.table[val].vad != 0) // linear probing
         {
-            panic("Error during hashpt elements allocation");
+            val = (val + 1) & (htable.size - 1);
         }
-        tmp->next = unusedptrlist; 
-        unusedptrlist = tmp;
-    }  // fill all the unused ptr list with size ptSize
+        htable.table[val] = old_table[i];
+    }
 
+    spinlock_release(&peps.pt_spinlock); //Nobody can see the old table anymore
+    kfree(old_table);
+    spinlock_acquire(&peps.pt_spinlock);
+    add_hash_resize();
+
+    DEBUG(DB_VM,"Hash table resized to %d slots\n",htable.size);
 }
 
 static int findspace()
 {
-    int val = -1;
-    for (int i = 0; i < peps.ptSize; i++)
+    int i = peps.free_head; //The free list contains all and only the frames with validity bit=0, so we just take its head
+    if (i == -1)
     {
-        val = GETVALBIT(peps.pt[i].ctl); // 1 if validity bit=1
-        if (!val && peps.pt[i].page!=KMALLOC_PAGE && !GETIOBIT(peps.pt[i].ctl) && !GETSWAPBIT(peps.pt[i].ctl)) //These are all the conditions that make a page not free, i.e. not removable
-        {
-            return i; // return the position of empty entry in PT
-        }
+        return -1; // no free frames
     }
-    return -1;
+    KASSERT(!GETVALBIT(peps.pt[i].ctl));
+    KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
+    KASSERT(!GETBUSYBIT(peps.pt[i].ctl));
+    freelist_remove(i);
+    return i; // return the position of empty entry in PT
 }
 
-#if OPT_DEBUG
-static int n=0;
-#endif
+#if OPT_READAHEAD
+/**
+ * Readahead helpers. A frame read ahead has the readahead bit set until its page is used for the first time. If this never happens
+ * (the frame is evicted or freed with the bit set) it was wasted. The window of the process is updated accordingly.
+ * They must be called with pt_spinlock held.
+*/
+static void readahead_used(int i, pid_t p)
+{
+    peps.pt[i].ctl = RABITZERO(peps.pt[i].ctl);
+    add_readahead_stat(READAHEAD_HITS, 1);
+    if (ra_window[p] < RA_WINDOW_MAX)
+    {
+        ra_window[p]++;
+    }
+}
 
-int find_victim(vaddr_t vaddr, pid_t pid)
+static void readahead_wasted(int i)
 {
-    int i, start_i=lastIndex, niter=0, old_validity=0;
-    pid_t old_pid;
-    vaddr_t old_v;
-    #if OPT_DEBUG
-    if(n==0){
-        DEBUG(DB_VM,"FIRST FIND VICTIM\n");
-        n++;
+    pid_t p = peps.pt[i].pid; //The process that read the page ahead
+    peps.pt[i].ctl = RABITZERO(peps.pt[i].ctl);
+    add_readahead_stat(READAHEAD_WASTED, 1);
+    if (ra_window[p] > 1)
+    {
+        ra_window[p] /= 2; //We never go below 1 page, otherwise the window couldn't grow again
+    }
+}
+
+/**
+ * It reserves the frames for the pages that follow v and that can be read ahead: at most max pages, stopping at the first page that is
+ * already in RAM or when the free frames are few. If we read the ELF file (in_swap=0) we stop also at the first page that is in the
+ * swapfile, since the copy in the ELF file is old; if we read the swapfile (in_swap=1) all the pages must be there. The pages are added
+ * to the hash table and the frames are busy, so whoever needs them waits until the end of the read. No victim is selected.
+ *
+ * @return the number of frames reserved, stored in frames
+*/
+static int reserve_readahead(vaddr_t v, pid_t pid, int max, int *frames, int in_swap)
+{
+    int n, i;
+    vaddr_t u;
+    #if OPT_TEXT_SHARE
+    struct vnode *vn;
+    off_t offset;
+    int file_page;
+    #endif
+
+    for (n = 0; n < max && peps.nfree > RA_MIN_FREE; n++)
+    {
+        u = v + (n + 1) * PAGE_SIZE;
+        if (get_index_from_hash(u, pid) != -1 || swap_contains(u, pid) != in_swap)
+        {
+            break;
+        }
+        #if OPT_TEXT_SHARE
+        file_page = !in_swap && file_page_key(u, &vn, &offset);
+        if (file_page && file_lookup(vn, offset, u) != -1)
+        {
+            break; //Another process has the page in RAM, so it will be shared on the first access
+        }
+        #endif
+        i = findspace();
+        KASSERT(i != -1);
+        peps.pt[i].ctl = VALBITONE(peps.pt[i].ctl);
+        peps.pt[i].ctl = BUSYBITONE(peps.pt[i].ctl);
+        peps.pt[i].ctl = RABITONE(peps.pt[i].ctl); //The reference bit stays 0: if the page isn't used, it will be the first victim
+        peps.pt[i].page = u;
+        peps.pt[i].pid = pid;
+        add_in_hash(u, pid, i); //It may release pt_spinlock, but our frames are busy and the pages of pid are only loaded by this thread
+        #if OPT_TEXT_SHARE
+        if (file_page && file_lookup(vn, offset, u) == -1) //Another process may have loaded the page while the lock was released
+        {
+            file_insert(i, vn, offset);
+        }
+        #endif
+        frames[n] = i;
+    }
+    return n;
+}
+#endif
+
+#if OPT_TEXT_SHARE
+/**
+ * It maps for (v, pid) the frame of the file index that contains the same page of the same ELF file, if any. pid becomes a sharer of the
+ * frame (or its owner, if it's a frame of the page cache that no process maps), and the frame is marked as being in the TLB, since the
+ * caller inserts it. If the frame is busy (i.e. another process is reading it) we wait for the end of the read. The sharer and the room
+ * in the hash table are obtained before modifying anything, since they may release pt_spinlock.
+ *
+ * @return the index of the frame, -1 if the page must be loaded from the ELF file
+*/
+static int share_file_frame(vaddr_t v, pid_t pid, struct vnode *vn, off_t offset)
+{
+    struct sharer *s;
+    int i;
+
+    while (1)
+    {
+        while ((htable.count + 1) * 2 > htable.size) //add_in_hash won't need to grow the table
+        {
+            htable_grow();
+        }
+        i = file_lookup(vn, offset, v);
+        if (i == -1)
+        {
+            return -1;
+        }
+        if (GETBUSYBIT(peps.pt[i].ctl))
+        {
+            wait_frame(i); //When we wake up the frame may have been evicted, so we search again
+            continue;
+        }
+        #if OPT_PAGE_CACHE
+        if (peps.pt[i].pid == PCACHE_PID)
+        {
+            break; //No sharer is needed
+        }
+        #endif
+        if (peps.spare_sharers == NULL)
+        {
+            spinlock_release(&peps.pt_spinlock);
+            s = sharer_alloc();
+            spinlock_acquire(&peps.pt_spinlock);
+            if (s == NULL)
+            {
+                return -1; //We load our own copy of the page
+            }
+            put_sharer(s);
+            continue;
+        }
+        break;
+    }
+
+    KASSERT(GETVALBIT(peps.pt[i].ctl));
+    KASSERT(!GETDIRTYBIT(peps.pt[i].ctl));
+    KASSERT(!maps_frame(i, pid));
+    #if OPT_PAGE_CACHE
+    if (peps.pt[i].pid == PCACHE_PID)
+    {
+        KASSERT(peps.sharers[i] == NULL);
+        peps.pt[i].pid = pid; //The page stayed in the page cache after the end of the processes that used it
+    }
+    else
+    #endif
+    {
+        s = peps.spare_sharers;
+        peps.spare_sharers = s->next;
+        add_sharer(i, pid, s);
+        add_text_share_stat(TEXT_SHARE_HITS, 1);
+    }
+    add_in_hash(v, pid, i);
+    #if OPT_READAHEAD
+    if (GETRABIT(peps.pt[i].ctl))
+    {
+        readahead_used(i, pid); //Another process read the page ahead, and it's used for the first time
+    }
+    #endif
+    peps.pt[i].ctl = TLBBITONE(peps.pt[i].ctl);
+    peps.pt[i].tlb++;
+    return i;
+}
+#endif
+
+#if OPT_SWAP_CLUSTER
+/**
+ * Swap clustering helpers. When a dirty page is evicted, the dirty pages of the same process that follow it and that would be good
+ * victims too (not busy, not in the TLB, not referenced and private) are written with it in adjacent pages of the swapfile, and then
+ * their frames are freed. In this way a single I/O writes up to SWAP_CLUSTER_MAX pages, and a later page fault on one of them can read
+ * the following ones with it (see get_page).
+ * They're called with pt_spinlock held.
+*/
+static int gather_cluster(vaddr_t v, pid_t pid, int *cluster)
+{
+    int n, j;
+
+    for (n = 0; n < SWAP_CLUSTER_MAX - 1; n++)
+    {
+        j = get_index_from_hash(v + (n + 1) * PAGE_SIZE, pid);
+        if (j == -1 || peps.pt[j].page == KMALLOC_PAGE || peps.pt[j].pid != pid || peps.sharers[j] != NULL ||
+            GETBUSYBIT(peps.pt[j].ctl) || GETTLBBIT(peps.pt[j].ctl) || GETREFBIT(peps.pt[j].ctl) || !GETDIRTYBIT(peps.pt[j].ctl))
+        {
+            break; //The pages must be consecutive, so that their order in the swapfile is the same as in the address space
+        }
+        peps.pt[j].ctl = BUSYBITONE(peps.pt[j].ctl); //Nobody can take the frame while we're storing the page
+        cluster[n] = j;
+    }
+    return n;
+}
+
+static void release_cluster_frame(int j)
+{
+    KASSERT(GETBUSYBIT(peps.pt[j].ctl));
+    KASSERT(!GETTLBBIT(peps.pt[j].ctl));
+    KASSERT(!GETCACHEDBIT(peps.pt[j].ctl));
+    KASSERT(peps.sharers[j] == NULL);
+    remove_from_hash(peps.pt[j].page, peps.pt[j].pid); //The page is in the swapfile now
+    #if OPT_READAHEAD
+    if (GETRABIT(peps.pt[j].ctl))
+    {
+        readahead_wasted(j); //A page read around in the swapfile that was never used
+    }
+    #endif
+    peps.pt[j].ctl = 0;
+    peps.pt[j].tlb = 0;
+    peps.pt[j].page = 0;
+    peps.pt[j].pid = 0;
+    freelist_push(j);
+    wchan_wakeall(peps.frame_wchan[j % FRAME_WCHANS], &peps.pt_spinlock); //The processes waiting for the page will find it in the swapfile
+}
+#endif
+
+#if OPT_DEBUG
+static int n=0;
+#endif
+
+/**
+ * It removes from RAM the page that is in frame i, that the caller already marked as busy. If the page was written we store it in the
+ * swapfile, where the sharers will share its entry with the owner. pt_spinlock is released during the store, but the page stays in the
+ * hash table until the end: in this way the processes that access it wait for the frame, instead of reading an old copy from the ELF file
+ * because the swapfile entry isn't there yet. Then all the processes that mapped the frame lose it, so they're removed from the hash table.
+ * It returns the number of other frames that were freed because their pages were stored together with this one (swap clusters).
+*/
+static int evict_page(int i)
+{
+    struct sharer *s;
+    vaddr_t old_v = peps.pt[i].page;
+    pid_t old_pid = peps.pt[i].pid;
+
+    KASSERT(GETVALBIT(peps.pt[i].ctl));
+    KASSERT(GETBUSYBIT(peps.pt[i].ctl));
+    KASSERT(!GETTLBBIT(peps.pt[i].ctl));
+    KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
+
+    #if OPT_SWAP_CLUSTER
+    int cluster[SWAP_CLUSTER_MAX - 1], ncluster = 0;
+    paddr_t paddrs[SWAP_CLUSTER_MAX];
+    #endif
+
+    if (GETDIRTYBIT(peps.pt[i].ctl))
+    {
+        #if OPT_SWAP_CLUSTER
+        if (peps.sharers[i] == NULL)
+        {
+            ncluster = gather_cluster(old_v, old_pid, cluster); //The following dirty pages of the process are written together with old_v
+        }
+        #endif
+        spinlock_release(&peps.pt_spinlock);
+        #if OPT_SWAP_CLUSTER
+        if (ncluster > 0)
+        {
+            paddrs[0] = i * PAGE_SIZE + peps.firstfreepaddr;
+            for (int k = 0; k < ncluster; k++)
+            {
+                paddrs[k + 1] = cluster[k] * PAGE_SIZE + peps.firstfreepaddr;
+            }
+            store_swap_cluster(old_v, old_pid, paddrs, ncluster + 1);
+        }
+        else
+        {
+            store_swap(old_v, old_pid, i * PAGE_SIZE + peps.firstfreepaddr, peps.sharers[i]);
+        }
+        #else
+        store_swap(old_v, old_pid, i * PAGE_SIZE + peps.firstfreepaddr, peps.sharers[i]); //The sharers can't change while the frame is busy
+        #endif
+        spinlock_acquire(&peps.pt_spinlock);
+    }
+    else
+    {
+        add_dirty_stat(CLEAN_EVICTION); //The page was never written since it was loaded, so we can load it again from the ELF file (or zero-fill it)
+        if (GETCACHEDBIT(peps.pt[i].ctl))
+        {
+            add_swap_cache_stat(AVOIDED_WRITE); //The page is still in the swapfile, so we can load it again from there
+        }
+    }
+
+    #if OPT_PAGE_CACHE
+    if (old_pid == PCACHE_PID)
+    {
+        add_page_cache_stat(PAGE_CACHE_RECLAIMS, 1); //No process maps the page, so it isn't in the hash table
+    }
+    else
+    #endif
+    remove_from_hash(old_v, old_pid); //We remove the page from the hash table too
+    for (s = peps.sharers[i]; s != NULL; s = s->next)
+    {
+        remove_from_hash(old_v, s->pid);
+    }
+    free_sharers(peps.sharers[i]);
+    peps.sharers[i] = NULL;
+    #if OPT_TEXT_SHARE
+    file_forget(i); //The next process that runs the program will read the page again
+    #endif
+    #if OPT_READAHEAD
+    if (GETRABIT(peps.pt[i].ctl))
+    {
+        readahead_wasted(i); //The page was read ahead but never used
+    }
+    #endif
+    peps.pt[i].ctl = DIRTYBITZERO(peps.pt[i].ctl); //The new page is clean until the first write
+    peps.pt[i].ctl = CACHEDBITZERO(peps.pt[i].ctl);
+    wchan_wakeall(peps.frame_wchan[i % FRAME_WCHANS], &peps.pt_spinlock); //The processes waiting for the old page will now find it in the swapfile
+    #if OPT_SWAP_CLUSTER
+    for (int k = 0; k < ncluster; k++)
+    {
+        release_cluster_frame(cluster[k]);
+    }
+    if (ncluster > 0)
+    {
+        wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //We freed some frames
+    }
+    return ncluster;
+    #else
+    return 0;
+    #endif
+}
+
+/**
+ * It's called by find_victim when it can't find any victim. With more CPUs the TLBs can contain more frames than the ones available for
+ * the user pages, and a frame that stays in the TLB of a CPU where its process isn't running anymore would never leave it. So we take up
+ * to TS_BATCH frames that can't be evicted only because they're in some TLB, and we remove all of them from the TLBs with a single shootdown.
+ * It must be called with pt_spinlock held, and it returns with pt_spinlock held, but the lock is released during the shootdown.
+ *
+ * @return 1 if some frame has been removed from the TLBs, 0 otherwise
+ */
+static int steal_tlb_frames(void)
+{
+    uint32_t frames[TS_BATCH];
+    unsigned n = 0, j;
+    int i;
+
+    if (curcpu->c_spinlocks != 1 || curthread->t_iplhigh_count != 1)
+    {
+        return 0; //The caller holds other spinlocks or disabled the interrupts, so we couldn't receive the shootdowns of the other CPUs while we wait for ours
+    }
+    for (i = 0; i < peps.ptSize && n < TS_BATCH; i++)
+    {
+        if (GETVALBIT(peps.pt[i].ctl) && GETTLBBIT(peps.pt[i].ctl) && !GETBUSYBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE)
+        {
+            peps.pt[i].ctl = BUSYBITONE(peps.pt[i].ctl); //No process can insert the frame in the TLB again while it's busy
+            frames[n++] = i;
+        }
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    spinlock_release(&peps.pt_spinlock); //The other CPUs need pt_spinlock to remove the frames from their TLB
+    tlb_steal_frames(frames, n);
+    spinlock_acquire(&peps.pt_spinlock);
+    for (j = 0; j < n; j++)
+    {
+        frame_ready(frames[j]); //The frames are not in any TLB now (unless get_writable_page is pinning one of them), so they can be selected as victims
+    }
+    return 1;
+}
+
+int find_victim(vaddr_t vaddr, pid_t pid)
+{
+    int i, start_i=lastIndex, niter=0;
+    #if OPT_DEBUG
+    if(n==0){
+        DEBUG(DB_VM,"FIRST FIND VICTIM\n");
+        n++;
     }
     #endif
     // if I am here there will be a replacement since all pages are valid
     for (i = lastIndex;; i = (i + 1) % peps.ptSize)
     {       // enhanced second chance alg. looking for TLB bit and RB bit 
-        if (peps.pt[i].page!=KMALLOC_PAGE && !GETTLBBIT(peps.pt[i].ctl) && !GETIOBIT(peps.pt[i].ctl) && !GETSWAPBIT(peps.pt[i].ctl)) //If so the page can be swapped out
-        {   // page to be valid == no IO, no SWAP, no contiguous and no in TLB
+        add_frame_stat(VICTIM_SCAN_STEP);
+        if (peps.pt[i].page!=KMALLOC_PAGE && !GETTLBBIT(peps.pt[i].ctl) && !GETBUSYBIT(peps.pt[i].ctl)) //If so the page can be swapped out
+        {   // page to be valid == not busy, no contiguous and no in TLB
             if (GETREFBIT(peps.pt[i].ctl) == 0) // if Ref bit==0 victim found
             {
                 KASSERT(!GETTLBBIT(peps.pt[i].ctl));
-                KASSERT(!GETIOBIT(peps.pt[i].ctl));
-                KASSERT(!GETSWAPBIT(peps.pt[i].ctl));
+                KASSERT(!GETBUSYBIT(peps.pt[i].ctl));
                 KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
-                old_pid=peps.pt[i].pid; //Due to issues with synchronization, we need to set all the new values before load/store operations, i.e. before sleeping. 
-                peps.pt[i].pid=pid;             //However, we save the old values before modifying them to use them in the future store.
-                old_validity=GETVALBIT(peps.pt[i].ctl);
-                peps.pt[i].ctl = IOBITONE(peps.pt[i].ctl); //We'll perform an I/O operation (for sure read, and if necessary store too)
-                peps.pt[i].ctl = VALBITONE(peps.pt[i].ctl);
-                old_v = peps.pt[i].page;
-                peps.pt[i].page = vaddr;
-                if(old_validity){ //If the page was valid we save it in the swapfile before proceeding
-                    remove_from_hash(old_v, old_pid); //We remove the page from the hash table too
-                    store_swap(old_v,old_pid,i * PAGE_SIZE + peps.firstfreepaddr);  // then we swap
+                lastIndex = (i + 1) % peps.ptSize; //New index for second chance. We update it before releasing the lock, so that other threads don't scan the same frames
+                if(GETVALBIT(peps.pt[i].ctl)){ //If the page was valid we save it in the swapfile before proceeding
+                    peps.pt[i].ctl = BUSYBITONE(peps.pt[i].ctl); //Nobody else can take the frame while we're storing the old page
+                    evict_page(i);
                 } 
-                add_in_hash(vaddr, pid, i); //We add the new page to the hash table
-                lastIndex = (i + 1) % peps.ptSize; //New index for second chance
+                else{ //The frame was freed while we were waiting on the wchan, so it's still in the free list
+                    KASSERT(peps.sharers[i]==NULL);
+                    freelist_remove(i);
+                    peps.pt[i].ctl = VALBITONE(peps.pt[i].ctl);
+                    peps.pt[i].ctl = BUSYBITONE(peps.pt[i].ctl);
+                }
+                peps.pt[i].pid = pid; //The frame stays busy until the caller loads the new page
+                peps.pt[i].page = vaddr;
                 return i; // return index of that frame
             }
             else
@@ -172,11 +1042,12 @@ int find_victim(vaddr_t vaddr, pid_t pid)
                 niter++;
                 continue; 
             }
-            else{ //We didn't find any victim. Since sizeof(IPT)>sizeof(TLB)+n_kmallocs, it means that there are potential victims but they can't be removed because currently they're involved in a I/O or in a swap.
-                  //To avoid starvation (that would cause a deadlock since we disabled the interrupts) we wait until something changes.
-                lock_acquire(peps.pt_lock);
-                cv_wait(peps.pt_cv,peps.pt_lock); //To wait, we wait on the condition variable. then someone will broadcast 
-                lock_release(peps.pt_lock);
+            else{ //We didn't find any victim. All the frames are allocated with kmalloc, busy or in some TLB.
+                if(!steal_tlb_frames()){
+                    //There are potential victims but they can't be removed because currently they're busy.
+                    //We sleep until a frame is released or it's not busy anymore (wchan_sleep releases pt_spinlock atomically, so we can't miss the wakeup).
+                    wchan_sleep(peps.victim_wchan, &peps.pt_spinlock);
+                }
                 niter=0; //We allow again 2 iterations
             }
         }
@@ -184,232 +1055,1286 @@ int find_victim(vaddr_t vaddr, pid_t pid)
     panic("no victims! it's a problem...");
 }
 
-int get_hash_func(vaddr_t v, pid_t p)
+/**
+ * TSB helpers. The slot of a page is chosen by its virtual page number, and the pid moves the pages of different processes to different
+ * slots, since all the processes use the same virtual addresses. They must be called with pt_spinlock held.
+*/
+static int tsb_slot(vaddr_t v, pid_t p)
+{
+    return (int)((((uint32_t)v) >> 12) + (((uint32_t)p) << 7)) & (TSB_SIZE - 1);
+}
+
+static void tsb_invalidate(vaddr_t v, pid_t p)
+{
+    struct hashentry *e = &tsb[tsb_slot(v, p)];
+    if (e->vad == v && e->pid == p)
+    {
+        e->vad = 0;
+        e->pid = 0;
+        e->iptentry = -1;
+    }
+}
+
+/**
+ * It returns the IPT index of (v, p), looking in the TSB first and then in the hash table. A page found in the hash table is inserted in
+ * the TSB, replacing the page that used the slot. It's called with pt_spinlock held.
+*/
+static int lookup_frame(vaddr_t v, pid_t p)
+{
+    struct hashentry *e = &tsb[tsb_slot(v, p)];
+    int i;
+
+    if (e->vad == v && e->pid == p)
+    {
+        add_tsb_stat(TSB_HITS, 1);
+        return e->iptentry;
+    }
+    add_tsb_stat(TSB_MISSES, 1);
+    i = get_index_from_hash(v, p);
+    if (i != -1)
+    {
+        e->vad = v;
+        e->pid = p;
+        e->iptentry = i;
+    }
+    return i;
+}
+
+void tsb_init(void){
+    tsb = kmalloc(sizeof(struct hashentry) * TSB_SIZE);
+    if (!tsb)
+    {
+        panic("Error during TSB allocation");
+    }
+    for (int ii = 0; ii < TSB_SIZE; ii++)
+    {
+        tsb[ii].vad = 0; // all the entries are empty
+        tsb[ii].pid = 0;
+        tsb[ii].iptentry = -1;
+    }
+}
+
+int get_hash_func(vaddr_t v, pid_t p)
+{
+    uint32_t key = (((uint32_t)v) >> 12) ^ (((uint32_t)p) << 20); // user virtual page numbers have less than 20 bits, so each (vaddr, pid) pair gets a different key
+    return (int)((key * HASH_MULTIPLIER) >> (32 - htable.bits)); // the multiplication spreads the key on all the bits, and we take the most significant ones
+}
+
+#if OPT_DEBUG
+static int add=0;
+#endif
+
+void add_in_hash(vaddr_t vad, pid_t pid, int pos) // NEW - pos = position of the IPT
+{   // take the first empty slot starting from the hash of the entry
+    KASSERT(vad!=0);
+    KASSERT(pid!=0);
+    #if OPT_DEBUG
+    add++;
+    #endif
+    DEBUG(DB_VM,"Adding in hash 0x%x for process %d, pos %d\n",vad,pid,pos);
+    while ((htable.count + 1) * 2 > htable.size) // we keep the load factor below 1/2, so that clusters remain short. Since htable_grow releases the lock, we check again
+    {
+        htable_grow();
+    }
+    int val = get_hash_func(vad, pid); //We get the index to use to access the hash table
+    while (htable.table[val].vad != 0) // linear probing: the slot is used, so we try the next one
+    {
+        KASSERT(htable.table[val].vad != vad || htable.table[val].pid != pid); // the same page can't be inserted twice
+        val = (val + 1) & (htable.size - 1);
+    }
+    htable.table[val].vad = vad; // update values
+    htable.table[val].pid = pid;
+    htable.table[val].iptentry = pos;
+    htable.count++;
+    DEBUG(DB_VM,"Allocated slot %d\n",val);
+}
+
+/**
+ * It returns the slot that contains (vad, pid), -1 if it's not in the hash table.
+ * The number of slots read is saved in probes.
+*/
+static int find_slot(vaddr_t vad, pid_t pid, uint32_t *probes)
+{
+    int val = get_hash_func(vad, pid);   //take the correct entry
+    *probes = 1;
+    while (htable.table[val].vad != 0)  // an empty slot ends the cluster, so the entry isn't in the table
+    {
+        if (htable.table[val].vad == vad && htable.table[val].pid == pid)     //if found 
+        {
+            return val;
+        }
+        val = (val + 1) & (htable.size - 1);
+        (*probes)++;
+    }
+    return -1;
+}
+
+int get_index_from_hash(vaddr_t vad, pid_t pid)
+{
+    uint32_t probes;
+    int val = find_slot(vad, pid, &probes);
+    add_hash_lookup(probes); //Update statistics
+    if (val == -1)
+    {
+        return -1; //We didn't find any entry, so the accessed vad is not in the IPT currently
+    }
+    return htable.table[val].iptentry; // return the correct value
+}
+
+#if OPT_DEBUG
+static int rem=0;
+#endif
+
+void remove_from_hash(vaddr_t vad, pid_t pid)
+{
+    #if OPT_DEBUG   
+    rem++;
+    #endif
+    uint32_t probes;
+    int i, j, home, mask = htable.size - 1;
+
+    i = find_slot(vad, pid, &probes);
+    DEBUG(DB_VM,"Removing from hash 0x%x for process %d, pos %d\n",vad,pid,i);
+    if (i == -1)
+    {
+        panic("nothing to remove found!!"); //Error: we tried to remove an entry that was never inserted
+    }
+    tsb_invalidate(vad, pid); //The TSB can't keep a page that isn't in the hash table
+
+    /**
+     * Backward shift deletion. We scan the rest of the cluster and we move back in the hole each entry that can't be
+     * reached anymore from its home slot, i.e. each entry whose home slot is not cyclically in (i, j].
+    */
+    j = i;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (htable.table[j].vad == 0)
+        {
+            break; // end of the cluster
+        }
+        home = get_hash_func(htable.table[j].vad, htable.table[j].pid);
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j)))
+        {
+            htable.table[i] = htable.table[j];
+            i = j;
+        }
+    }
+
+    htable.table[i].vad = 0; //Reset the values
+    htable.table[i].pid = 0;
+    htable.table[i].iptentry = -1;
+    htable.count--;
+}
+
+void htable_print_stats(void)
+{
+    int i, start, len, max_len = 0, clusters = 0;
+
+    //We look for the first empty slot, so that we never start counting in the middle of a cluster
+    for (start = 0; start < htable.size && htable.table[start].vad != 0; start++);
+    if (start == htable.size)
+    {
+        return;
+    }
+
+    len = 0;
+    for (i = 1; i <= htable.size; i++)
+    {
+        if (htable.table[(start + i) & (htable.size - 1)].vad != 0)
+        {
+            len++;
+            continue;
+        }
+        if (len > 0)
+        {
+            clusters++;
+            if (len > max_len)
+            {
+                max_len = len;
+            }
+        }
+        len = 0;
+    }
+
+    kprintf("Hash table: size = %d\tused slots = %d\tclusters = %d\tlongest cluster = %d\n", htable.size, htable.count, clusters, max_len);
+}
+
+#if OPT_ZERO_POOL
+/**
+ * It takes a zeroed frame from the tail of the free list. It's called with pt_spinlock held.
+ *
+ * @return the index of the frame, -1 if the pool is empty
+*/
+static int find_zeroed(void)
+{
+    int i = peps.free_tail;
+
+    if (i == -1 || !GETZEROEDBIT(peps.pt[i].ctl))
+    {
+        add_zero_pool_stat(ZERO_POOL_MISSES, 1);
+        i = -1;
+    }
+    else
+    {
+        add_zero_pool_stat(ZERO_POOL_HITS, 1);
+        freelist_remove(i);
+    }
+    if (peps.nzeroed < peps.zero_target)
+    {
+        wchan_wakeone(peps.zero_wchan, &peps.pt_spinlock); //The zeroing thread refills the pool
+    }
+    return i;
+}
+#endif
+
+/**
+ * It gets a frame for (v, pid), from the free list or by selecting a victim. The frame is returned valid and busy,
+ * but it's not added to the hash table. It's called with pt_spinlock held, that may be released while the victim is stored.
+ * If zeroed isn't NULL the page will be zero-filled, so we try first the pool of zeroed frames, and zeroed tells if we succeeded.
+*/
+static int alloc_frame(vaddr_t v, pid_t pid, int *zeroed)
+{
+    int pos = -1;
+    #if OPT_ZERO_POOL
+    if (zeroed != NULL)
+    {
+        pos = find_zeroed();
+        *zeroed = pos != -1;
+    }
+    #else
+    if (zeroed != NULL)
+    {
+        *zeroed = 0;
+    }
+    #endif
+    if (pos == -1)
+    {
+        pos = findspace(); // find a free space
+    }
+    if (pos == -1) //No free space, so we select the victim
+    {
+        add_frame_stat(VICTIM_SELECTION);
+        add_pageout_stat(PAGEOUT_DIRECT, 1); //The fault has to reclaim a frame by itself
+        pos = find_victim(v, pid);
+    }
+    else{   //we found a space
+        add_frame_stat(FREE_LIST_HIT);
+        peps.pt[pos].ctl = VALBITONE(peps.pt[pos].ctl); //Now the page is valid
+        peps.pt[pos].ctl = BUSYBITONE(peps.pt[pos].ctl); //We'll perform an I/O to load the page, so the frame is busy
+        peps.pt[pos].page = v;
+        peps.pt[pos].pid = pid;
+    }
+    KASSERT(pos<peps.ptSize);
+    #if OPT_PAGEOUT
+    if (peps.nfree < peps.pageout_low)
+    {
+        wchan_wakeone(peps.pageout_wchan, &peps.pt_spinlock); //The daemon frees some frames before the next faults need them
+    }
+    #endif
+    return pos;
+}
+
+#if OPT_PAGEOUT
+/**
+ * It selects a frame that the pageout daemon can free, with the same clock (lastIndex) and the same second chance of find_victim.
+ * Unlike find_victim it never sleeps and it never takes free frames: after two full rounds without a victim it gives up.
+ * It's called with pt_spinlock held.
+ *
+ * @return the index of the frame, -1 if no frame can be freed now
+*/
+static int pageout_victim(void)
+{
+    int i;
+
+    for (int n = 0; n < 2 * peps.ptSize; n++)
+    {
+        i = lastIndex;
+        lastIndex = (lastIndex + 1) % peps.ptSize;
+        if (GETVALBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && !GETTLBBIT(peps.pt[i].ctl) && !GETBUSYBIT(peps.pt[i].ctl))
+        {
+            if (GETREFBIT(peps.pt[i].ctl) == 0)
+            {
+                return i;
+            }
+            peps.pt[i].ctl = REFBITZERO(peps.pt[i].ctl);
+        }
+    }
+    return -1;
+}
+
+/**
+ * Body of the pageout daemon. It sleeps until the free frames go below the low watermark, then it evicts pages (writing them in the
+ * swapfile if they're dirty) until the free frames reach the high watermark. If no frame can be freed (they're all busy, in some TLB
+ * or allocated with kmalloc) it sleeps until the next wake up.
+*/
+static void pageout_thread(void *data1, unsigned long data2)
+{
+    int i, freed;
+
+    (void)data1;
+    (void)data2;
+
+    spinlock_acquire(&peps.pt_spinlock);
+    while (1)
+    {
+        while (peps.nfree >= peps.pageout_low)
+        {
+            wchan_sleep(peps.pageout_wchan, &peps.pt_spinlock);
+        }
+        add_pageout_stat(PAGEOUT_WAKEUPS, 1);
+
+        i = 0;
+        while (peps.nfree < peps.pageout_high && (i = pageout_victim()) != -1)
+        {
+            peps.pt[i].ctl = BUSYBITONE(peps.pt[i].ctl);
+            freed = evict_page(i); //pt_spinlock is released while the page is stored
+            KASSERT(peps.sharers[i] == NULL);
+            peps.pt[i].ctl = 0;
+            peps.pt[i].tlb = 0;
+            peps.pt[i].page = 0;
+            peps.pt[i].pid = 0;
+            freelist_push(i);
+            wchan_wakeall(peps.frame_wchan[i % FRAME_WCHANS], &peps.pt_spinlock);
+            wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //A fault may be waiting for a victim
+            add_pageout_stat(PAGEOUT_DAEMON_FRAMES, freed + 1);
+        }
+        if (i == -1)
+        {
+            wchan_sleep(peps.pageout_wchan, &peps.pt_spinlock); //Nothing to free now: we try again at the next wake up
+        }
+    }
+}
+
+void pageout_start(void)
+{
+    int result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+    if (result)
+    {
+        panic("error!! pageout daemon not started...");
+    }
+}
+#endif
+
+#if OPT_ZERO_POOL
+/**
+ * Body of the zeroing thread. While the pool has less than zero_target frames, it takes a free frame that isn't zeroed (from the head of
+ * the free list), it zeroes it without holding pt_spinlock and it puts it in the tail of the free list. The frame is valid and busy while
+ * it's zeroed, so nobody can take it. After each frame it yields the CPU, so that the zeroing is done when nothing else has to run.
+*/
+static void zero_thread(void *data1, unsigned long data2)
+{
+    int i;
+
+    (void)data1;
+    (void)data2;
+
+    spinlock_acquire(&peps.pt_spinlock);
+    while (1)
+    {
+        while (peps.nzeroed >= peps.zero_target || peps.nfree == peps.nzeroed)
+        {
+            wchan_sleep(peps.zero_wchan, &peps.pt_spinlock); //The pool is full, or all the free frames are already zeroed
+        }
+        i = peps.free_head;
+        KASSERT(i != -1 && !GETZEROEDBIT(peps.pt[i].ctl));
+        freelist_remove(i);
+        peps.pt[i].ctl = VALBITONE(peps.pt[i].ctl);
+        peps.pt[i].ctl = BUSYBITONE(peps.pt[i].ctl);
+        spinlock_release(&peps.pt_spinlock);
+
+        bzero((void *)PADDR_TO_KVADDR(peps.firstfreepaddr + i * PAGE_SIZE), PAGE_SIZE);
+        add_zero_pool_stat(ZERO_POOL_FILLS, 1);
+
+        spinlock_acquire(&peps.pt_spinlock);
+        peps.pt[i].ctl = 0;
+        freelist_push_zeroed(i);
+        wchan_wakeall(peps.frame_wchan[i % FRAME_WCHANS], &peps.pt_spinlock);
+        wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //A fault may be waiting for a frame
+        spinlock_release(&peps.pt_spinlock);
+
+        thread_yield();
+
+        spinlock_acquire(&peps.pt_spinlock);
+    }
+}
+
+void zero_pool_start(void)
+{
+    int result = thread_fork("zero", NULL, zero_thread, NULL, 0);
+    if (result)
+    {
+        panic("error!! zeroing thread not started...");
+    }
+}
+#endif
+
+#if OPT_PAGE_CACHE
+void page_cache_reap(void)
+{
+    struct vnode *unused[PCACHE_VNODES];
+    int k, n = 0;
+
+    spinlock_acquire(&peps.pt_spinlock);
+    for (k = 0; k < PCACHE_VNODES; k++)
+    {
+        if (peps.cache_vnodes[k] != NULL && peps.cache_vnode_pages[k] == 0)
+        {
+            unused[n++] = peps.cache_vnodes[k];
+            peps.cache_vnodes[k] = NULL;
+        }
+    }
+    spinlock_release(&peps.pt_spinlock);
+
+    for (k = 0; k < n; k++)
+    {
+        VOP_DECREF(unused[k]); //If no process runs the program, the file is closed
+    }
+}
+#endif
+
+#if OPT_PAGEOUT
+int pageout_set_watermarks(int low, int high)
+{
+    if (low <= 0 || high <= low || high > peps.ptSize / 2)
+    {
+        return EINVAL;
+    }
+    spinlock_acquire(&peps.pt_spinlock);
+    peps.pageout_low = low;
+    peps.pageout_high = high;
+    if (peps.nfree < peps.pageout_low)
+    {
+        wchan_wakeone(peps.pageout_wchan, &peps.pt_spinlock);
+    }
+    spinlock_release(&peps.pt_spinlock);
+    return 0;
+}
+#endif
+
+/**
+ * It returns the frame that maps (v, pid), -1 if the page isn't in RAM. If the frame is busy (i.e. the page is being stored in the
+ * swapfile) we wait for it and we search again, since in the meanwhile the page has been removed. It's called with pt_spinlock held.
+*/
+static int find_mapped_frame(vaddr_t v, pid_t pid)
+{
+    int i;
+
+    while ((i = lookup_frame(v, pid)) != -1 && GETBUSYBIT(peps.pt[i].ctl))
+    {
+        #if OPT_UTLB_TRACE
+        tlb_trace_off(); //The threads that run while we sleep aren't part of the refill
+        #endif
+        wait_frame(i);
+        #if OPT_UTLB_TRACE
+        tlb_trace_on();
+        #endif
+    }
+    return i;
+}
+
+paddr_t get_page(vaddr_t v, int *reload)  //it's the wrapper
+{  
+
+    pid_t pid = proc_getpid(curproc); // get curpid here
+    int res, result;
+    paddr_t pp;
+    res = pt_get_paddr(v, pid); //We search if the page is already in the page table
+
+    if (res != -1)  // page is in PT
+    {
+        pp = (paddr_t) res;
+        add_tlb_reload();
+        *reload = 1;
+        return pp;  //easy return page
+    }
+    *reload = 0;
+    #if OPT_UTLB_TRACE
+    tlb_trace_off(); //Only the reloads are traced
+    #endif
+
+    DEBUG(DB_VM,"PID=%d wants to load 0x%x\n",pid,v);
+
+    #if OPT_READAHEAD
+    int frames[RA_WINDOW_MAX], nra = 0, from_swap = 0;
+    paddr_t paddrs[RA_WINDOW_MAX + 1];
+    int window = elf_readahead_window(v, RA_WINDOW_MAX); //Pages of the ELF file that follow v in its segment
+    #endif
+    #if OPT_ZERO_POOL
+    struct timespec start, end;
+    int zfill = zero_fill_type(v); //If v isn't in the swapfile, 1 for a stack page and 2 for a page after the end of the file
+    gettime(&start); //Used to measure the latency of the zero-fill faults
+    #endif
+    #if OPT_TEXT_SHARE
+    struct vnode *file_vn;
+    off_t file_offset;
+    int file_page = file_page_key(v, &file_vn, &file_offset);
+    #endif
+
+    spinlock_acquire(&peps.pt_spinlock);
+    #if OPT_READAHEAD || OPT_ZERO_POOL || OPT_TEXT_SHARE
+    int in_swap = swap_contains(v, pid); //It can't change until the end of the fault: only this process loads its pages, and v isn't in RAM
+    #endif
+    #if OPT_TEXT_SHARE
+    if (file_page && !in_swap)
+    {
+        int shared = share_file_frame(v, pid, file_vn, file_offset);
+        if (shared != -1) //Another process running the same program has the page in RAM
+        {
+            spinlock_release(&peps.pt_spinlock);
+            add_tlb_reload(); //No page is loaded, so for the statistics (constraint 2) it's a reload of a frame already in RAM
+            *reload = 1;
+            #if OPT_PAGE_CACHE
+            add_page_cache_stat(PAGE_CACHE_HITS, 1); //Hits and misses are counted here, so each file fault is either a reload or a load
+            #endif
+            return peps.firstfreepaddr + shared*PAGE_SIZE;
+        }
+        #if OPT_PAGE_CACHE
+        add_page_cache_stat(PAGE_CACHE_MISSES, 1); //The page will be read from the ELF file
+        #endif
+    }
+    #endif
+    #if OPT_ZERO_POOL
+    int prezeroed = 0;
+    int pos = alloc_frame(v, pid, zfill && !in_swap ? &prezeroed : NULL); // not in PT --> find a free frame (zeroed if possible) or a victim
+    #else
+    int pos = alloc_frame(v, pid, NULL); // not in PT --> find a free frame or a victim
+    #endif
+    add_in_hash(v, pid, pos); //We add an entry in the hash table. Until the end of the load the frame is busy, so nobody can use it
+    pp = peps.firstfreepaddr + pos*PAGE_SIZE; //We compute the physical address (pos is an index)
+
+    KASSERT(peps.pt[pos].page!=KMALLOC_PAGE);
+    KASSERT(peps.sharers[pos]==NULL);
+    KASSERT(!GETDIRTYBIT(peps.pt[pos].ctl));
+    KASSERT(!GETCACHEDBIT(peps.pt[pos].ctl));
+    KASSERT(!GETRABIT(peps.pt[pos].ctl));
+    #if OPT_TEXT_SHARE
+    if (file_page && !in_swap && file_lookup(file_vn, file_offset, v) == -1) //Another process may have loaded the page while the lock was released
+    {
+        file_insert(pos, file_vn, file_offset); //The frame is busy, so the other processes wait for the end of the read and then share it
+    }
+    #endif
+    #if OPT_READAHEAD
+    if (in_swap) //v isn't read from the ELF file
+    {
+        #if OPT_SWAP_CLUSTER
+        window = swap_cluster_window(v, pid, SWAP_CLUSTER_MAX - 1); //Pages stored right after v in the swapfile (read-around)
+        from_swap = 1;
+        nra = reserve_readahead(v, pid, window < ra_window[pid] ? window : ra_window[pid], frames, 1);
+        #endif
+    }
+    else if (window > 0)
+    {
+        nra = reserve_readahead(v, pid, window < ra_window[pid] ? window : ra_window[pid], frames, 0);
+    }
+    #endif
+    spinlock_release(&peps.pt_spinlock);
+
+    #if OPT_ZERO_POOL
+    if (prezeroed)
+    {
+        add_pt_type_fault(zfill == 1 ? ZEROED : DISK); //The frame is already zeroed, so we skip load_page, but we update the same statistics
+        if (zfill == 2)
+        {
+            add_pt_type_fault(ELF);
+        }
+        result = 0;
+    }
+    else
+    #endif
+    #if OPT_READAHEAD
+    if (nra > 0)
+    {
+        paddrs[0] = pp;
+        for (int k = 0; k < nra; k++)
+        {
+            paddrs[k + 1] = peps.firstfreepaddr + frames[k] * PAGE_SIZE;
+        }
+        result = 0;
+        #if OPT_SWAP_CLUSTER
+        if (from_swap)
+        {
+            result = load_swap_pages(v, pid, paddrs, nra + 1); //A single read of the adjacent pages of the swapfile
+        }
+        #endif
+        if (!from_swap)
+        {
+            load_elf_pages(v, paddrs, nra + 1); //A single read for v and the following pages
+        }
+    }
+    else
+    {
+        result = load_page(v, pid, pp);
+    }
+    #else
+    result = load_page(v, pid, pp); //We load the page from the swapfile or from the ELF file. Faults on other pages can proceed in the meanwhile
+    #endif
+
+    spinlock_acquire(&peps.pt_spinlock);
+    switch(result){
+        case 1:
+        peps.pt[pos].ctl = DIRTYBITONE(peps.pt[pos].ctl); //The page was read from the swapfile, which doesn't keep a copy of it anymore
+        break;
+        case 2:
+        peps.pt[pos].ctl = CACHEDBITONE(peps.pt[pos].ctl); //The page was read from the swapfile, which still has a copy of it
+        break;
+        default:
+        break;
+    }
+    peps.pt[pos].ctl = TLBBITONE(peps.pt[pos].ctl); //The entry will be added in the TLB, so we set the TLB bit
+    peps.pt[pos].tlb = 1;
+    frame_ready(pos); //We ended the I/O
+    #if OPT_READAHEAD
+    for (int k = 0; k < nra; k++)
+    {
+        if (result == 1)
+        {
+            peps.pt[frames[k]].ctl = DIRTYBITONE(peps.pt[frames[k]].ctl); //As for v, the swapfile doesn't keep a copy of the pages read around
+        }
+        else if (result == 2)
+        {
+            peps.pt[frames[k]].ctl = CACHEDBITONE(peps.pt[frames[k]].ctl);
+        }
+        frame_ready(frames[k]); //The pages read ahead are not in the TLB
+    }
+    add_readahead_stat(READAHEAD_PAGES, nra);
+    #endif
+    spinlock_release(&peps.pt_spinlock);
+
+    #if OPT_ZERO_POOL
+    if (zfill && !in_swap)
+    {
+        gettime(&end);
+        timespec_sub(&end, &start, &end);
+        add_zero_pool_stat(ZERO_FILL_LATENCY, end.tv_sec * 1000000000 + end.tv_nsec);
+    }
+    #endif
+
+    return pp;
+}
+
+int pt_get_paddr(vaddr_t v, pid_t p)
+{   // returns the right physical address, if present (using the hash map)
+    spinlock_acquire(&peps.pt_spinlock);
+    int i = find_mapped_frame(v, p);//We search for the entry in the page table
+    if(i==-1){
+        spinlock_release(&peps.pt_spinlock);
+        return i; //Entry not found, so we return -1
+    }
+    KASSERT(peps.pt[i].page==v);
+    KASSERT(maps_frame(i, p)); //p is the owner of the frame or it shares it with the owner
+    KASSERT(!GETBUSYBIT(peps.pt[i].ctl));
+    //The frame may already be in a TLB: for another process if it's shared, or for p on another CPU where p ran before
+    KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
+    #if OPT_READAHEAD
+    if (GETRABIT(peps.pt[i].ctl))
+    {
+        readahead_used(i, p); //The first access to a page read ahead: the readahead avoided a page fault
+    }
+    #endif
+    peps.pt[i].ctl = TLBBITONE(peps.pt[i].ctl); // set isInTLB to 1
+    peps.pt[i].tlb++;
+    spinlock_release(&peps.pt_spinlock);
+    return i * PAGE_SIZE + peps.firstfreepaddr; // send the paddr found
+
+}
+
+void free_pages(pid_t p)
+{   // frees all pages from PT and the list using pid
+
+    spinlock_acquire(&peps.pt_spinlock);
+    for (int i = 0; i < peps.ptSize; i++)
+    {
+        while (GETBUSYBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && maps_frame(i, p))
+        {   //The page is being stored in the swapfile, and remove_process_from_swap must find its entry
+            wait_frame(i);
+        }
+        if (GETVALBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && maps_frame(i, p)) //We don't free kmalloc pages when a process ends to avoid errors with kmalloc function
+        {
+            KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
+            remove_from_hash(peps.pt[i].page, p); //We remove the entry from the page table
+            if (remove_mapping(i, p))
+            {
+                continue; //The frame is shared, so it remains in RAM for the other processes
+            }
+            KASSERT(!GETTLBBIT(peps.pt[i].ctl)); //The TLB has been flushed before freeing the pages
+            KASSERT(!GETBUSYBIT(peps.pt[i].ctl));
+            #if OPT_PAGE_CACHE
+            if (in_file_index(i))
+            {
+                peps.pt[i].pid = PCACHE_PID; //The page stays in the page cache until it's selected as a victim
+                continue;
+            }
+            #endif
+            #if OPT_READAHEAD
+            if (GETRABIT(peps.pt[i].ctl))
+            {
+                add_readahead_stat(READAHEAD_WASTED, 1); //The process ended without using the page
+            }
+            #endif
+            #if OPT_TEXT_SHARE
+            file_forget(i); //No process maps the frame anymore, so the vnode may be closed
+            #endif
+            peps.pt[i].ctl = 0;
+            peps.pt[i].tlb = 0;
+            peps.pt[i].page = 0;
+            peps.pt[i].pid = 0;
+            freelist_push(i); //The frame is free again
+        }
+    }
+
+    wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //We freed some entries in the page table, so we wake up the processes waiting for a victim.
+
+    #if OPT_READAHEAD
+    ra_window[p] = RA_WINDOW_INIT; //The pid will be reused by a new process
+    #endif
+
+    #if OPT_DEBUG
+    DEBUG(DB_VM,"We have %d add and %d remove\n",add,rem);
+
+    for(int i=0;i < htable.size; i++){ //We check that all the pages of the process were correctly freed
+        if(htable.table[i].vad!=0 && htable.table[i].pid==p){
+            kprintf("Error with a frame in the hash table: index %d, vaddr %d, pid %d\n",i,htable.table[i].vad,htable.table[i].pid);
+        }
+    }
+
+    #endif
+
+    spinlock_release(&peps.pt_spinlock);
+}
+
+/**
+ * It removes one of the TLB slots that map frame i. It's called with pt_spinlock held.
+ * The reference bit is set only if the slot was referenced: a slot replaced by tlb_nru wasn't used recently, so the frame
+ * shouldn't get a second chance for it.
+*/
+static void tlb_unpin(int i, int referenced)
+{
+    KASSERT(i >= 0 && i < peps.ptSize);
+    KASSERT(GETVALBIT(peps.pt[i].ctl));
+    KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
+    KASSERT(GETTLBBIT(peps.pt[i].ctl)); // it must be inside TLB
+    KASSERT(peps.pt[i].tlb > 0);
+    peps.pt[i].tlb--;
+    if (peps.pt[i].tlb == 0) // a shared frame may still be in the TLB for another process
+    {
+        peps.pt[i].ctl = TLBBITZERO(peps.pt[i].ctl); // remove TLB bit
+        wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //The frame can be selected as a victim again
+    }
+    if (referenced)
+    {
+        peps.pt[i].ctl = REFBITONE(peps.pt[i].ctl);  // set RB to 1
+    }
+}
+
+int update_tlb_bit(int i, int referenced)
+{     
+    DEBUG(DB_VM,"This function was called with index=%d\n",i);
+
+    spinlock_acquire(&peps.pt_spinlock);
+    tlb_unpin(i, referenced);
+    spinlock_release(&peps.pt_spinlock);
+
+    return 1;
+}
+
+int get_dirty_bit(int i)
 {
-    int val = (((int)v) % 24) + ((((int)p) % 8) << 8);
-    val = val ^1234567891;
-    val = val % htable.size;
-    return val;
+    int dirty;
+
+    KASSERT(i >= 0 && i < peps.ptSize);
+    spinlock_acquire(&peps.pt_spinlock);
+    KASSERT(GETVALBIT(peps.pt[i].ctl));
+    dirty = GETDIRTYBIT(peps.pt[i].ctl) ? 1 : 0;
+    spinlock_release(&peps.pt_spinlock);
+    return dirty;
 }
 
-#if OPT_DEBUG
-static int add=0;
-#endif
-
-void add_in_hash(vaddr_t vad, pid_t pid, int pos) // NEW - pos = position of the IPT
-{   // take from unusedptrlist one list-block and insert into the hash table
-    KASSERT(vad!=0);
-    KASSERT(pid!=0);
-    #if OPT_DEBUG
-    add++;
+/**
+ * It marks frame i as dirty. It's called with pt_spinlock held.
+*/
+static void mark_dirty(int i)
+{
+    KASSERT(i >= 0 && i < peps.ptSize);
+    KASSERT(GETVALBIT(peps.pt[i].ctl));
+    KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
+    KASSERT(peps.sharers[i]==NULL); //A shared frame is never written, it's copied before
+    #if OPT_SWAP_CACHE
+    if(GETCACHEDBIT(peps.pt[i].ctl)){ //The copy in the swapfile is going to be outdated, so we release it
+        KASSERT(!GETDIRTYBIT(peps.pt[i].ctl));
+        swap_release(peps.pt[i].page, peps.pt[i].pid);
+        peps.pt[i].ctl = CACHEDBITZERO(peps.pt[i].ctl);
+    }
     #endif
-    DEBUG(DB_VM,"Adding in hash 0x%x for process %d, pos %d\n",vad,pid,pos);
-    int val = get_hash_func(vad, pid); //We get the index to use to access the hash table
-    struct hashentry *tmp = unusedptrlist; // take the first element from the free list
-    KASSERT(tmp!=NULL);
-    unusedptrlist = tmp->next; //remove from head
-    tmp->vad = vad; // update values
-    tmp->pid = pid; 
-    tmp->iptentry = pos;
-    tmp->next = htable.table[val]; // insert in hashtable 
-    htable.table[val] = tmp;       // attach in head here
-    DEBUG(DB_VM,"Allocated tmp in val = %d, 0x%x. Next: 0x%x\n",val, (unsigned int)tmp, (unsigned int)tmp->next);
+    #if OPT_TEXT_SHARE
+    file_forget(i); //The frame won't contain the page of the ELF file anymore
+    #endif
+    peps.pt[i].ctl = DIRTYBITONE(peps.pt[i].ctl);
 }
 
-int get_index_from_hash(vaddr_t vad, pid_t pid)
-{  // 
-    int val = get_hash_func(vad, pid);   //take the correct entry
-    struct hashentry *tmp = htable.table[val]; //from the array hashtable, take the correct list
-    #if OPT_DEBUG
-    if(tmp!=NULL)
-        kprintf("Value of tmp: 0x%x, pid=%d\n",tmp->vad,tmp->pid);
+/**
+ * It tells if frame i must be copied before a write: it's shared after a fork or, with the page cache, the page cache keeps its page.
+ * It's called with pt_spinlock held.
+*/
+static int must_copy(int i)
+{
+    #if OPT_PAGE_CACHE
+    return peps.sharers[i] != NULL || in_file_index(i);
+    #else
+    return peps.sharers[i] != NULL;
     #endif
-    while (tmp != NULL)   
+}
+
+void set_dirty_bit(int i)
+{
+    spinlock_acquire(&peps.pt_spinlock);
+    #if OPT_PAGE_CACHE
+    if (must_copy(i))
     {
-        KASSERT((unsigned int)tmp>0x80000000 && (unsigned int)tmp<=0x90000000);
-        if (tmp->vad == vad && tmp->pid == pid)     //if found 
-        {
-            return tmp->iptentry; // return the correct value
-        }
-        tmp = tmp->next;
+        /*
+         * Another process mapped the page from the page cache after our is_shared. The frame stays clean, so tlb_insert doesn't give write
+         * privilege and the write goes through get_writable_page, that copies it.
+        */
+        spinlock_release(&peps.pt_spinlock);
+        return;
     }
-    return -1; //We didn't find any entry, so the accessed vad is not in the IPT currently
+    #endif
+    mark_dirty(i);
+    spinlock_release(&peps.pt_spinlock);
 }
 
-#if OPT_DEBUG
-static int rem=0;
-#endif
+int is_shared(int i)
+{
+    int shared;
 
-void remove_from_hash(vaddr_t vad, pid_t pid) // insert again in unusedptrlist and REMOVE from hash table
-{    // remove from the hash table and put it again in userptrlist
-    #if OPT_DEBUG   
-    rem++;
-    #endif
-    int val = get_hash_func(vad, pid); 
-    DEBUG(DB_VM,"Removing from hash 0x%x for process %d, pos %d\n",vad,pid,val);
-       // classic element deletion from a list, the ptr points to the next-next one without losing any references
-    struct hashentry *tmp = htable.table[val]; //We get the head of the list
-    struct hashentry *prev=NULL; //Previous entry 
-    if (tmp == NULL)
-    {
-        panic("Error during remove from hash"); //Error: we tried to remove an entry that was never inserted
-    }
+    KASSERT(i >= 0 && i < peps.ptSize);
+    spinlock_acquire(&peps.pt_spinlock);
+    shared = must_copy(i);
+    spinlock_release(&peps.pt_spinlock);
+    return shared;
+}
+
+paddr_t get_writable_page(vaddr_t v, int i)
+{
+    pid_t pid = proc_getpid(curproc);
+    int pos;
+
+    KASSERT(i >= 0 && i < peps.ptSize);
 
-    if (tmp->vad == vad && tmp->pid == pid) // if found in head remove instantly
+    spinlock_acquire(&peps.pt_spinlock);
+
+    /**
+     * The index comes from the TLB, and the caller didn't hold pt_spinlock while reading it: the slot may have been replaced and the
+     * frame evicted in the meanwhile. In this case the write will be retried.
+    */
+    if (!GETVALBIT(peps.pt[i].ctl) || GETBUSYBIT(peps.pt[i].ctl) || peps.pt[i].page!=v || !maps_frame(i, pid))
     {
-        tmp->vad=0;
-        tmp->pid=0;
-        htable.table[val] = tmp->next; /// take second in list
-        tmp->next = unusedptrlist;
-        unusedptrlist = tmp;
-        return;
+        spinlock_release(&peps.pt_spinlock);
+        return 0;
     }
 
-    prev=tmp; //We already checked the first element, so we can update prev and tmp
-    tmp = tmp->next; 
-
-    while (tmp != NULL)
+    if (must_copy(i))
     {
-        if (tmp->vad == vad && tmp->pid == pid) // if found
+        /**
+         * Getting a new frame may require a victim selection, i.e. we may release the lock. We pin the shared frame as if it was in one more
+         * TLB slot, so that it can't be selected as a victim in the meanwhile.
+        */
+        peps.pt[i].tlb++;
+        peps.pt[i].ctl = TLBBITONE(peps.pt[i].ctl);
+        pos = alloc_frame(v, pid, NULL);
+        tlb_unpin(i, 1);
+
+        if (must_copy(i)) //The other processes may have copied the page or ended while we were sleeping
         {
-            tmp->vad=0; //Reset the values
-            tmp->pid=0;
-            tmp->iptentry = -1;
-            prev->next = tmp->next; // remove from the list
-            tmp->next = unusedptrlist;
-            unusedptrlist = tmp; // update in head list of unused ptrs
-            return;
+            KASSERT(peps.pt[pos].page!=KMALLOC_PAGE);
+            memmove((void *)PADDR_TO_KVADDR(peps.firstfreepaddr + pos*PAGE_SIZE),(void *)PADDR_TO_KVADDR(peps.firstfreepaddr + i*PAGE_SIZE), PAGE_SIZE); //It's a copy within RAM, so we can use memmove. The reason to use PADDR_TO_KVADDR is explained in swapfile.c
+            #if OPT_SWAP_CACHE
+            if (GETCACHEDBIT(peps.pt[i].ctl))
+            {
+                swap_release(v, pid); //Our copy in the swapfile is going to be outdated, while the other processes keep theirs
+            }
+            #endif
+            remove_from_hash(v, pid);
+            #if OPT_PAGE_CACHE
+            if (!remove_mapping(i, pid))
+            {
+                peps.pt[i].pid = PCACHE_PID; //Only the page cache keeps the old frame
+            }
+            #else
+            remove_mapping(i, pid);
+            #endif
+            add_in_hash(v, pid, pos);
+            peps.pt[pos].ctl = DIRTYBITONE(peps.pt[pos].ctl);
+            peps.pt[pos].ctl = TLBBITONE(peps.pt[pos].ctl); //The caller maps the new frame in the TLB
+            peps.pt[pos].tlb = 1;
+            frame_ready(pos);
+            spinlock_release(&peps.pt_spinlock);
+            add_cow_stat(COW_COPY);
+            DEBUG(DB_VM,"Process %d copied 0x%x from frame %d to frame %d\n",pid,v,i,pos);
+            return peps.firstfreepaddr + pos*PAGE_SIZE;
         }
-        prev = tmp; //We update prev and tmp
-        tmp = tmp->next;
+
+        //We're the last process that maps the frame, so we give back the new one and we write directly the old one
+        peps.pt[pos].ctl = 0;
+        peps.pt[pos].page = 0;
+        peps.pt[pos].pid = 0;
+        freelist_push(pos);
+        wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock);
+        add_cow_stat(COW_LAST_MAPPING);
     }
 
-    panic("nothing to remove found!!");
+    mark_dirty(i);
+    spinlock_release(&peps.pt_spinlock);
+    return peps.firstfreepaddr + i*PAGE_SIZE;
 }
 
-paddr_t get_page(vaddr_t v)  //it's the wrapper
-{  
+#if OPT_SWAP_CACHE
+void reclaim_swap_cache(void)
+{
+    int i = reclaimIndex, n = 0;
 
-    pid_t pid = proc_getpid(curproc); // get curpid here
-    int res;
-    paddr_t pp;
-    res = pt_get_paddr(v, pid); //We search if the page is already in the page table
+    spinlock_acquire(&peps.pt_spinlock);
 
-    if (res != -1)  // page is in PT
+    /**
+     * We release the swapfile entries of the pages in the swap cache in round robin order, and we mark the pages as dirty
+     * since now the only copy is the one in RAM. Busy pages are skipped.
+    */
+    for (int k = 0; k < peps.ptSize && n < SWAP_CACHE_RECLAIM; k++)
     {
-        pp = (paddr_t) res;
-        add_tlb_reload();
-        return pp;  //easy return page
+        i = (reclaimIndex + k) % peps.ptSize;
+        if (GETVALBIT(peps.pt[i].ctl) && GETCACHEDBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && !GETBUSYBIT(peps.pt[i].ctl))
+        {
+            KASSERT(!GETDIRTYBIT(peps.pt[i].ctl));
+            if (!swap_release(peps.pt[i].page, peps.pt[i].pid))
+            {
+                panic("swap cache entry not found in the swapfile!");
+            }
+            for (struct sharer *s = peps.sharers[i]; s != NULL; s = s->next) //After a fork the sharers have their own entry too
+            {
+                if (!swap_release(peps.pt[i].page, s->pid))
+                {
+                    panic("swap cache entry not found in the swapfile!");
+                }
+            }
+            peps.pt[i].ctl = CACHEDBITZERO(peps.pt[i].ctl);
+            peps.pt[i].ctl = DIRTYBITONE(peps.pt[i].ctl);
+            n++;
+        }
     }
+    reclaimIndex = (i + 1) % peps.ptSize;
 
-    DEBUG(DB_VM,"PID=%d wants to load 0x%x\n",pid,v);
+    spinlock_release(&peps.pt_spinlock);
 
-    int pos = findspace(v,pid); // not in PT --> find a free space
-    if (pos == -1) //No free space, so we select the victim
+    add_swap_cache_reclaim(n);
+    DEBUG(DB_VM,"Swap cache: released %d entries\n",n);
+}
+#endif
+
+#if OPT_BUDDY
+/**
+ * Buddy allocator helpers. The pool of the kernel pages is made of chunks of 2^BUDDY_MAX_ORDER frames, aligned in the IPT, whose frames are
+ * always valid with page=KMALLOC_PAGE: in this way the victim selection, the pageout daemon and the scan of get_contiguous_pages never
+ * consider them. The free part of the pool is split in blocks of 2^k frames aligned to their size, so the buddy of the block that begins
+ * in b is the one that begins in b^(1<<k), and freeing a block merges it with its buddy as long as the buddy is free too. The free blocks
+ * of each order are in a doubly linked list that uses free_next and free_prev, since the frames of the pool are never in the free list.
+ * In this way allocations and frees cost O(BUDDY_MAX_ORDER), and only the growth of the pool scans the IPT.
+ * They must be called with pt_spinlock held.
+*/
+static void buddy_push(int b, int k)
+{
+    peps.buddy_order[b] = k;
+    peps.free_prev[b] = -1;
+    peps.free_next[b] = peps.buddy_free[k]; //Insertion in head
+    if (peps.buddy_free[k] != -1)
     {
-        pos = find_victim(v, pid);
-        KASSERT(pos<peps.ptSize);
-        pp = peps.firstfreepaddr + pos*PAGE_SIZE; //We compute the physical address (pos is an index)
+        peps.free_prev[peps.buddy_free[k]] = b;
     }
-    else{   //we found a space
-        KASSERT(pos<peps.ptSize);
-        add_in_hash(v, pid, pos); //We add an entry in the hash table
-        pp = peps.firstfreepaddr + pos*PAGE_SIZE;
-        peps.pt[pos].ctl = VALBITONE(peps.pt[pos].ctl); //Now the page is valid
-        peps.pt[pos].ctl = IOBITONE(peps.pt[pos].ctl); //We'll perform an I/O to load the page, so we set IOBIT
-        peps.pt[pos].page = v;
-        peps.pt[pos].pid = pid;
+    peps.buddy_free[k] = b;
+    if (k == BUDDY_MAX_ORDER)
+    {
+        peps.buddy_free_chunks++;
     }
+}
 
-    KASSERT(peps.pt[pos].page!=KMALLOC_PAGE);
-    load_page(v, pid, pp); //We load the page from the swapfile or from the ELF file
-    peps.pt[pos].ctl = IOBITZERO(peps.pt[pos].ctl); //We ended the I/O
-    peps.pt[pos].ctl = TLBBITONE(peps.pt[pos].ctl); //The entry will be added in the TLB, so we set the TLB bit
+static void buddy_remove(int b)
+{
+    int k = peps.buddy_order[b];
 
-    return pp;
+    KASSERT(k >= 0 && k <= BUDDY_MAX_ORDER);
+    if (peps.free_prev[b] != -1)
+    {
+        peps.free_next[peps.free_prev[b]] = peps.free_next[b];
+    }
+    else
+    {
+        KASSERT(peps.buddy_free[k] == b);
+        peps.buddy_free[k] = peps.free_next[b];
+    }
+    if (peps.free_next[b] != -1)
+    {
+        peps.free_prev[peps.free_next[b]] = peps.free_prev[b];
+    }
+    peps.free_next[b] = -1;
+    peps.free_prev[b] = -1;
+    peps.buddy_order[b] = -1;
+    if (k == BUDDY_MAX_ORDER)
+    {
+        peps.buddy_free_chunks--;
+    }
 }
 
-int pt_get_paddr(vaddr_t v, pid_t p)
-{   // returns the right physical address, if present (using the hash map)
-    int i = get_index_from_hash(v, p);//We search for the entry in the page table
-    if(i==-1){
-        return i; //Entry not found, so we return -1
+/**
+ * It gives back to the free list of the IPT the free chunk that begins in b, so that its frames can be used again for the user pages.
+*/
+static void buddy_release_chunk(int b)
+{
+    KASSERT(b % (1 << BUDDY_MAX_ORDER) == 0);
+    buddy_remove(b);
+    peps.buddy_chunk[b >> BUDDY_MAX_ORDER] = 0;
+    peps.buddy_chunks--;
+    peps.buddy_nfree -= 1 << BUDDY_MAX_ORDER;
+    for (int j = b; j < b + (1 << BUDDY_MAX_ORDER); j++)
+    {
+        KASSERT(peps.pt[j].page == KMALLOC_PAGE);
+        KASSERT(!GETBUSYBIT(peps.pt[j].ctl));
+        peps.pt[j].ctl = 0;
+        peps.pt[j].page = 0;
+        peps.pt[j].pid = 0;
+        freelist_push(j);
     }
-    KASSERT(peps.pt[i].page==v);
-    KASSERT(peps.pt[i].pid==p);
-    KASSERT(!GETIOBIT(peps.pt[i].ctl));
-    KASSERT(!GETTLBBIT(peps.pt[i].ctl));
-    KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
-    peps.pt[i].ctl = TLBBITONE(peps.pt[i].ctl); // set isInTLB to 1
-    return i * PAGE_SIZE + peps.firstfreepaddr; // send the paddr found
-
+    wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //We freed some frames
 }
 
-void free_pages(pid_t p)
-{   // frees all pages from PT and the list using pid
+static void buddy_free_block(int b, int k)
+{
+    int buddy;
 
-    for (int i = 0; i < peps.ptSize; i++)
+    while (k < BUDDY_MAX_ORDER)
     {
-        if (peps.pt[i].pid == p && GETVALBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE) //We don't free kmalloc pages when a process ends to avoid errors with kmalloc function
-        {   //of course cannot free is IO or SWAP
-            KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
-            KASSERT(!GETSWAPBIT(peps.pt[i].ctl));
-            KASSERT(!GETIOBIT(peps.pt[i].ctl));
-            remove_from_hash(peps.pt[i].page, peps.pt[i].pid); //We remove the entry from the page table
-            peps.pt[i].ctl = 0;
-            peps.pt[i].page = 0;
-            peps.pt[i].pid = 0;
+        buddy = b ^ (1 << k);
+        if (peps.buddy_order[buddy] != k)
+        {
+            break; //The buddy is allocated (or only a part of it is free)
         }
+        buddy_remove(buddy);
+        add_buddy_stat(BUDDY_MERGES, 1);
+        b &= ~(1 << k); //The merged block begins with the first of the two buddies
+        k++;
+    }
+    buddy_push(b, k);
+    if (k == BUDDY_MAX_ORDER && peps.buddy_free_chunks > BUDDY_SPARE_CHUNKS)
+    {
+        buddy_release_chunk(b); //The whole chunk is free and we already have enough spare ones
     }
+}
 
-    lock_acquire(peps.pt_lock);
-    cv_broadcast(peps.pt_cv,peps.pt_lock); //We freed some entries in the page table, so we wake up the processes waiting on the cv of the IPT.
-    lock_release(peps.pt_lock);
+/**
+ * It frees n frames of the pool starting from start. Since n isn't always a power of 2 (an allocation of n pages takes only the first n
+ * frames of its block), the interval is split in the biggest aligned blocks that it contains.
+*/
+static void buddy_free_range(int start, int n)
+{
+    int k;
 
-    #if OPT_DEBUG
-    DEBUG(DB_VM,"We have %d add and %d remove\n",add,rem);
+    peps.buddy_nfree += n;
+    while (n > 0)
+    {
+        for (k = BUDDY_MAX_ORDER; (start & ((1 << k) - 1)) != 0 || (1 << k) > n; k--);
+        buddy_free_block(start, k);
+        start += 1 << k;
+        n -= 1 << k;
+    }
+}
+
+/**
+ * It takes from the pool npages frames, with the smallest free block that contains them. The upper halves of the bigger blocks that
+ * we split go back in the lists of their order, and the frames of the block after the first npages are freed again.
+ *
+ * @return the index of the first frame, -1 if no free block is big enough
+*/
+static int buddy_alloc(int npages)
+{
+    int k, j, b;
+
+    for (k = 0; (1 << k) < npages; k++);
+    for (j = k; j <= BUDDY_MAX_ORDER && peps.buddy_free[j] == -1; j++);
+    if (j > BUDDY_MAX_ORDER)
+    {
+        return -1;
+    }
+    b = peps.buddy_free[j];
+    buddy_remove(b);
+    while (j > k)
+    {
+        j--;
+        buddy_push(b + (1 << j), j);
+    }
+    peps.buddy_nfree -= 1 << k;
+    if (npages < (1 << k))
+    {
+        buddy_free_range(b + npages, (1 << k) - npages);
+    }
+    return b;
+}
 
-    struct hashentry *tmp;
+/**
+ * It adds a chunk of the IPT to the pool. We choose the chunk that costs less: its free frames cost nothing, its clean pages must only be
+ * dropped and its dirty pages must be written in the swapfile, while a referenced page would likely be loaded again soon. The chunks with
+ * a frame that is busy, in a TLB or allocated by the old scan of get_contiguous_pages can't be taken. In this way a kmalloc evicts at most
+ * one chunk of user pages, and only when the pool is exhausted, instead of a new interval of victims for every allocation.
+ * pt_spinlock is released while the pages are stored, but the frames of the chunk are busy, so nobody can take them.
+ *
+ * @return 1 if the pool grew, 0 if no chunk could be taken
+*/
+static int buddy_grow(void)
+{
+    int c, j, b, cost, best = -1, best_cost = 0, nchunks = peps.ptSize >> BUDDY_MAX_ORDER;
 
-    for(int i=0;i < htable.size; i++){ //We check that all the pages of a process were correctly freed
-        tmp=htable.table[i];
-        while(tmp!=NULL){
-            if(htable.table[i]->vad!=KMALLOC_PAGE){
-                kprintf("Error with a frame in the hash table: index %d, vaddr %d, pid %d\n",i,htable.table[i]->vad,htable.table[i]->pid);
+    for (c = 0; c < nchunks && (best == -1 || best_cost > 0); c++)
+    {
+        if (peps.buddy_chunk[c])
+        {
+            continue;
+        }
+        cost = 0;
+        for (j = c << BUDDY_MAX_ORDER; j < (c + 1) << BUDDY_MAX_ORDER && cost != -1; j++)
+        {
+            if (GETBUSYBIT(peps.pt[j].ctl) || GETTLBBIT(peps.pt[j].ctl) || peps.pt[j].page == KMALLOC_PAGE)
+            {
+                cost = -1;
+            }
+            else if (GETVALBIT(peps.pt[j].ctl))
+            {
+                cost += 1 + (GETREFBIT(peps.pt[j].ctl) ? 1 : 0) + (GETDIRTYBIT(peps.pt[j].ctl) ? 2 : 0);
             }
-            tmp=tmp->next;
+        }
+        if (cost != -1 && (best == -1 || cost < best_cost))
+        {
+            best = c;
+            best_cost = cost;
         }
     }
+    if (best == -1)
+    {
+        return 0;
+    }
 
-    #endif
-
+    b = best << BUDDY_MAX_ORDER;
+    for (j = b; j < b + (1 << BUDDY_MAX_ORDER); j++)
+    {
+        if (!GETVALBIT(peps.pt[j].ctl))
+        {
+            KASSERT(peps.sharers[j] == NULL);
+            freelist_remove(j); //The frame was free, so we take it from the free list
+            peps.pt[j].ctl = VALBITONE(peps.pt[j].ctl);
+            peps.pt[j].page = KMALLOC_PAGE;
+            peps.pt[j].pid = 0;
+        }
+        peps.pt[j].ctl = BUSYBITONE(peps.pt[j].ctl);
+    }
+    for (j = b; j < b + (1 << BUDDY_MAX_ORDER); j++)
+    {
+        if (peps.pt[j].page != KMALLOC_PAGE)
+        {
+            evict_page(j);
+            add_buddy_stat(BUDDY_EVICTIONS, 1);
+        }
+        /*
+         * As in get_contiguous_pages we don't wake up anybody: the frame belongs to the pool now, and the processes that were waiting
+         * for the old page have already been woken up by evict_page.
+        */
+        peps.pt[j].ctl = VALBITONE(0);
+        peps.pt[j].tlb = 0;
+        peps.pt[j].page = KMALLOC_PAGE;
+        peps.pt[j].pid = 0;
+    }
+    peps.buddy_chunk[best] = 1;
+    peps.buddy_chunks++;
+    peps.buddy_nfree += 1 << BUDDY_MAX_ORDER;
+    buddy_push(b, BUDDY_MAX_ORDER); //Not buddy_free_block, that could give the chunk back if other chunks were freed while we stored the pages
+    add_buddy_stat(BUDDY_GROWS, 1);
+    DEBUG(DB_VM,"Buddy allocator: chunk %d added to the pool (cost %d)\n",best,best_cost);
+    return 1;
 }
 
-int update_tlb_bit(vaddr_t v, pid_t pid)
-{     
+/**
+ * It allocates npages contiguous frames from the pool, growing it if needed. If no chunk can be taken we try once to remove some frames
+ * from the TLBs (see steal_tlb_frames), then we give up and the caller falls back to the scan of the IPT.
+ *
+ * @return the index of the first frame, -1 if the caller must scan the IPT
+*/
+static int buddy_get_pages(int npages)
+{
+    int b, stolen = 0;
 
-    int i;
+    while ((b = buddy_alloc(npages)) == -1)
+    {
+        if (!buddy_grow())
+        {
+            if (stolen || !steal_tlb_frames())
+            {
+                add_buddy_stat(BUDDY_FALLBACKS, 1);
+                return -1;
+            }
+            stolen = 1;
+        }
+    }
+    add_buddy_stat(BUDDY_ALLOCS, 1);
+    for (int j = b; j < b + npages; j++)
+    {
+        KASSERT(peps.pt[j].page == KMALLOC_PAGE);
+        KASSERT(GETVALBIT(peps.pt[j].ctl));
+        KASSERT(peps.buddy_order[j] == -1);
+        peps.pt[j].pid = curproc->p_pid;
+    }
+    peps.contiguous[b] = npages; //As for the other kmalloc pages, it'll be useful while freeing
+    return b;
+}
 
-    DEBUG(DB_VM,"This function was called with vaddr=0x%x, pid=%d\n",v,pid);
+void buddy_print_stats(void)
+{
+    int i, k, b, run = 0, longest = 0, largest = 0, chunks, nfree, ipt_free, blocks[BUDDY_MAX_ORDER + 1];
 
+    spinlock_acquire(&peps.pt_spinlock); //We copy the values and we print them after releasing the lock
+    chunks = peps.buddy_chunks;
+    nfree = peps.buddy_nfree;
+    ipt_free = peps.nfree;
+    for (k = 0; k <= BUDDY_MAX_ORDER; k++)
+    {
+        blocks[k] = 0;
+        for (b = peps.buddy_free[k]; b != -1; b = peps.free_next[b])
+        {
+            blocks[k]++;
+        }
+        if (blocks[k] > 0)
+        {
+            largest = 1 << k;
+        }
+    }
     for (i = 0; i < peps.ptSize; i++)
     {
-        if (peps.pt[i].page == v && peps.pt[i].pid==pid && GETVALBIT(peps.pt[i].ctl)) //We found the page that we were searching for
+        run = GETVALBIT(peps.pt[i].ctl) ? 0 : run + 1;
+        if (run > longest)
         {
-            if(!(peps.pt[i].ctl & 4)){
-                kprintf("Error for process %d, vaddr 0x%x, ctl=0x%x\n",pid,v,peps.pt[i].ctl);
-            }
-            KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
-            KASSERT(GETTLBBIT(peps.pt[i].ctl)); // it must be inside TLB
-            peps.pt[i].ctl = TLBBITZERO(peps.pt[i].ctl); // remove TLB bit
-            peps.pt[i].ctl = REFBITONE(peps.pt[i].ctl);  // set RB to 1
-
-            return 1;                                    
+            longest = run;
         }
     }
+    spinlock_release(&peps.pt_spinlock);
 
-    return -1;
+    /*
+     * The fragmentation of the pool is the fraction of its free frames that are not in the largest free block: 0% means that all the
+     * free frames could be returned by a single allocation.
+    */
+    kprintf("Buddy allocator: Chunks in the pool = %d (%d frames)\tFree frames in the pool = %d\tLargest free block = %d\tFragmentation = %d%%\n",
+            chunks, chunks << BUDDY_MAX_ORDER, nfree, largest, nfree ? 100 - largest * 100 / nfree : 0);
+    kprintf("Free blocks per order:");
+    for (k = 0; k <= BUDDY_MAX_ORDER; k++)
+    {
+        kprintf(" %d (%d frames) = %d", k, 1 << k, blocks[k]);
+    }
+    kprintf("\nIPT: Free frames = %d\tLongest run of free frames = %d\n", ipt_free, longest);
 }
+#endif
 
 /**
  * This function checks if a given entry is valid, i.e. if it can be removed or not.
@@ -429,10 +2354,7 @@ static int valid_entry(uint8_t ctl, vaddr_t v){
     if(v==KMALLOC_PAGE){
         return 1;
     }
-    if(GETIOBIT(ctl)){
-        return 1;
-    }
-    if(GETSWAPBIT(ctl)){
+    if(GETBUSYBIT(ctl)){
         return 1;
     }
     return 0;
@@ -446,34 +2368,46 @@ paddr_t get_contiguous_pages(int npages){
     // used for alloc n contig pages from kernel
     DEBUG(DB_VM,"Process %d performs kmalloc for %d pages\n", curproc->p_pid,npages);
 
-    int i, j, first=-1, valid, prev=0, old_val, first_iteration=0;
-    vaddr_t old_v;
-    pid_t old_pid;
+    int i, j, first=-1, valid, prev=0, first_iteration=0;
 
     if (npages > peps.ptSize)
     {
         panic("Not enough memory for kmalloc"); //Impossible allocation
     }
 
+    spinlock_acquire(&peps.pt_spinlock);
+
+    #if OPT_BUDDY
+    if (npages <= 1 << BUDDY_MAX_ORDER) //The bigger allocations (e.g. the slots of the hash table when it grows) still use the scan
+    {
+        first = buddy_get_pages(npages);
+        if (first != -1)
+        {
+            spinlock_release(&peps.pt_spinlock);
+            return first * PAGE_SIZE + peps.firstfreepaddr;
+        }
+    }
+    #endif
+
     //FIRST STEP: search for npages contiguous non valid entries (to avoid swapping out) 
-    // it would be the greatest solution
-    for (i = 0; i < peps.ptSize; i++)
+    // it would be the greatest solution. If there are not enough free frames we can skip it directly.
+    for (i = 0; peps.nfree >= npages && i < peps.ptSize; i++)
     {
         valid = GETVALBIT(peps.pt[i].ctl);
         if(i!=0){
             prev = valid_entry(peps.pt[i-1].ctl,peps.pt[i-1].page); //We check the validity of the previous entry
         }
-        if(!valid && GETTLBBIT(peps.pt[i].ctl)==0 && peps.pt[i].page!=KMALLOC_PAGE && !GETIOBIT(peps.pt[i].ctl) && !GETSWAPBIT(peps.pt[i].ctl) && (i==0 || prev)){
+        if(!valid && GETTLBBIT(peps.pt[i].ctl)==0 && peps.pt[i].page!=KMALLOC_PAGE && !GETBUSYBIT(peps.pt[i].ctl) && (i==0 || prev)){
             first=i; //If the current entry is not valid while the previous one was valid (or if the first entry is not valid) i becomes the beginning of the interval
         } 
-        if(first>=0 && !valid && GETTLBBIT(peps.pt[i].ctl)==0 && !GETSWAPBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && !GETIOBIT(peps.pt[i].ctl) && i-first==npages-1){ //We found npages contiguous entries not valid
+        if(first>=0 && !valid && GETTLBBIT(peps.pt[i].ctl)==0 && peps.pt[i].page!=KMALLOC_PAGE && !GETBUSYBIT(peps.pt[i].ctl) && i-first==npages-1){ //We found npages contiguous entries not valid
             DEBUG(DB_VM,"Kmalloc for process %d entry%d\n",curproc->p_pid,first);
             for(j=first;j<=i;j++){
                 KASSERT(peps.pt[j].page!=KMALLOC_PAGE);
                 KASSERT(!GETTLBBIT(peps.pt[j].ctl));
                 KASSERT(!GETVALBIT(peps.pt[j].ctl));
-                KASSERT(!GETIOBIT(peps.pt[j].ctl));
-                KASSERT(!GETSWAPBIT(peps.pt[i].ctl));
+                KASSERT(!GETBUSYBIT(peps.pt[j].ctl));
+                freelist_remove(j); //The frame isn't free anymore
                 peps.pt[j].ctl = VALBITONE(peps.pt[j].ctl); //Set pages as valid
                 peps.pt[j].page = KMALLOC_PAGE; //To remember that this page can't be swapped out until when we perform a free
                 peps.pt[j].pid = curproc->p_pid;
@@ -481,6 +2415,7 @@ paddr_t get_contiguous_pages(int npages){
                 //Please notice that we don't add in hash pages allocated with kmalloc since to access them we don't access the IPT, so it would be useless
             }
             peps.contiguous[first] = npages; //We save in position first the number of contiguous pages allocated. It'll be useful while freeing
+            spinlock_release(&peps.pt_spinlock);
             return first * PAGE_SIZE + peps.firstfreepaddr;
         }
     }
@@ -497,7 +2432,7 @@ paddr_t get_contiguous_pages(int npages){
     while(1){  // infinite loop, i don't exit until I find n contig victims
         for (i = lastIndex; i < peps.ptSize; i ++)
         {
-            if (peps.pt[i].page!=KMALLOC_PAGE && GETTLBBIT(peps.pt[i].ctl) == 0 && !GETIOBIT(peps.pt[i].ctl) && !GETSWAPBIT(peps.pt[i].ctl)) //We check if the entry can be considered for removal (all these conditions are related to pages that must be left in their position)
+            if (peps.pt[i].page!=KMALLOC_PAGE && GETTLBBIT(peps.pt[i].ctl) == 0 && !GETBUSYBIT(peps.pt[i].ctl)) //We check if the entry can be considered for removal (all these conditions are related to pages that must be left in their position)
             {
                 if(GETREFBIT(peps.pt[i].ctl) && GETVALBIT(peps.pt[i].ctl)){ //If the page is valid and has reference=1 we set reference=0 (due to second chance algorithm) and we continue
                     peps.pt[i].ctl = REFBITZERO(peps.pt[i].ctl);
@@ -509,31 +2444,41 @@ paddr_t get_contiguous_pages(int npages){
                 }
                 if(first>=0 && (GETREFBIT(peps.pt[i].ctl) == 0 || GETVALBIT(peps.pt[i].ctl) == 0) && i-first==npages-1){ //We found npages contiguous entries that can be removed
                     DEBUG(DB_VM,"Found a space for a kmalloc for process %d entry%d\n",curproc->p_pid,first);
+                    /**
+                     * evict_page releases the lock while it stores a page, so first we mark all the frames of the interval as busy.
+                     * In this way nobody can take them (or map again their pages) while we're storing the other ones.
+                    */
                     for(j=first;j<=i;j++){
                         KASSERT(peps.pt[j].page!=KMALLOC_PAGE);
                         KASSERT(!GETTLBBIT(peps.pt[j].ctl));
                         KASSERT(!GETREFBIT(peps.pt[j].ctl) || !GETVALBIT(peps.pt[j].ctl));
-                        KASSERT(!GETIOBIT(peps.pt[j].ctl));
-                        KASSERT(!GETSWAPBIT(peps.pt[j].ctl));
-                        old_pid = peps.pt[j].pid; //Again due to parallelism we initialize correctly the new values for the entry before the I/O operation, and we save the old ones to perform the store
-                        old_v = peps.pt[j].page;
-                        peps.pt[j].pid = curproc->p_pid;
-                        peps.pt[j].page = KMALLOC_PAGE; //To remember that this page can't be swapped out until when we perform a free
-                        old_val=GETVALBIT(peps.pt[j].ctl);
-                        peps.pt[j].ctl = VALBITONE(peps.pt[j].ctl); //Set pages as valid
-                        if(old_val){ //If the page was valid, we must store it in the swapfile
-                            peps.pt[j].ctl = IOBITONE(peps.pt[j].ctl);
-                            remove_from_hash(old_v,old_pid);//We remove the entry from the hash table
-                            store_swap(old_v,old_pid,j * PAGE_SIZE + peps.firstfreepaddr);
-                            peps.pt[j].ctl = IOBITZERO(peps.pt[j].ctl);
-                            /*
-                             * Here we don't wake up any process. In fact, it's true that we're storing a page but
-                             * it's already reserved for the kmalloc operation, so it can't be selected as a victim.
-                            */
+                        KASSERT(!GETBUSYBIT(peps.pt[j].ctl));
+                        if(!GETVALBIT(peps.pt[j].ctl)){
+                            KASSERT(peps.sharers[j]==NULL);
+                            freelist_remove(j); //The frame was free, so we take it from the free list
+                            peps.pt[j].ctl = VALBITONE(peps.pt[j].ctl); //Set pages as valid
+                            peps.pt[j].page = KMALLOC_PAGE; //To remember that this page can't be swapped out until when we perform a free
+                            peps.pt[j].pid = curproc->p_pid;
                         }
+                        peps.pt[j].ctl = BUSYBITONE(peps.pt[j].ctl);
                     }
-                    peps.contiguous[first]=npages; //We save in position first the number of contiguous pages allocated. It'll be useful while freeing
                     lastIndex = (i + 1) % peps.ptSize; //We update lastIndex for the second chance.
+                    for(j=first;j<=i;j++){
+                        if(peps.pt[j].page!=KMALLOC_PAGE){ //The page was valid, so we must store it in the swapfile (only if it was written, otherwise we can just drop it)
+                            evict_page(j);
+                            peps.pt[j].page = KMALLOC_PAGE;
+                            peps.pt[j].pid = curproc->p_pid;
+                        }
+                    }
+                    for(j=first;j<=i;j++){
+                        /*
+                        * Here we don't wake up any process. In fact, the frames are reserved for the kmalloc operation, so they can't be selected
+                        * as victims, and the processes that were waiting for the old pages have already been woken up by evict_page.
+                        */
+                        peps.pt[j].ctl = BUSYBITZERO(peps.pt[j].ctl);
+                    }
+                    peps.contiguous[first]=npages; //We save in position first the number of contiguous pages allocated. It'll be useful while freeing
+                    spinlock_release(&peps.pt_spinlock);
                     return first*PAGE_SIZE + peps.firstfreepaddr;
                 }
             }
@@ -544,9 +2489,7 @@ paddr_t get_contiguous_pages(int npages){
             first_iteration++;
         }
         else{
-            lock_acquire(peps.pt_lock);
-            cv_wait(peps.pt_cv,peps.pt_lock); //If after 2 full iterations we didn't find a suitable interval we sleep until when something changes
-            lock_release(peps.pt_lock);
+            wchan_sleep(peps.victim_wchan, &peps.pt_spinlock); //If after 2 full iterations we didn't find a suitable interval we sleep until when something changes
             first_iteration=0; //To perform again 2 full iterations
         }
 
@@ -563,6 +2506,9 @@ void free_contiguous_pages(vaddr_t addr){
     paddr_t p = KVADDR_TO_PADDR(addr); //We retrieve the physical address of the starting page
 
     index = (p - peps.firstfreepaddr) / PAGE_SIZE; //We get the index to use in the IPT
+
+    spinlock_acquire(&peps.pt_spinlock);
+
     niter = peps.contiguous[index]; //We access contiguous to get the number of pages to free
 
     DEBUG(DB_VM,"Process %d performs kfree for %d pages\n", curproc?curproc->p_pid:0,niter);
@@ -572,89 +2518,145 @@ void free_contiguous_pages(vaddr_t addr){
     KASSERT(niter!=-1);
     #endif
 
+    #if OPT_BUDDY
+    if(peps.buddy_chunk[index >> BUDDY_MAX_ORDER]){
+        buddy_free_range(index, niter); //The frames go back to the pool of the kernel pages, merged with their free buddies
+    }
+    else
+    #endif
     for(i=index;i<index+niter;i++){
         KASSERT(peps.pt[i].page==KMALLOC_PAGE);
         peps.pt[i].ctl = VALBITZERO(peps.pt[i].ctl); //The pages aren't valid anymore
         peps.pt[i].page=0; //We clear the kmalloc flag
+        freelist_push(i);
     }
 
     peps.contiguous[index]=-1;
 
     /**
-     * Small trick. Locks can't be acquired if we're in an interrupt handler, which is the case for exorcise. To avoid potential suboptimizations/starvations, if we are in an interrupt handler
-     * we don't acquire the lock (the check on lock_do_i_hold has been placed inside an if) and we simply perform cv_broadcast, otherwise we proceed in the standard way.
+     * Unlike locks, spinlocks and wait channels can be used also in an interrupt handler, which is the case for exorcise. So we don't
+     * need to handle it in a different way.
     */
+    wchan_wakeall(peps.victim_wchan, &peps.pt_spinlock); //Since we freed some pages, we wake up the processes waiting for a victim.
 
-    if(curthread->t_in_interrupt == false){
-        lock_acquire(peps.pt_lock);
-        cv_broadcast(peps.pt_cv,peps.pt_lock); //Since we freed some pages, we wake up the processes waiting on the cv.
-        lock_release(peps.pt_lock);
-    }
-    else{
-        cv_broadcast(peps.pt_cv,peps.pt_lock);
-    }
+    spinlock_release(&peps.pt_spinlock);
 
     #if OPT_DEBUG
     DEBUG(DB_VM,"New kmalloc number after free=%d\n",nkmalloc);
     #endif
 }
 
-void copy_pt_entries(pid_t old, pid_t new){ // used for forking
+void reserve_pt_entries(pid_t old, struct sharer **pool){
 
-    int pos;
+    int n=0, npool=0, missing, busy=-1;
+    struct sharer *s;
 
-    for(int i=0;i<peps.ptSize;i++){  //idea is to copy all the pages related to oldpid again, but with newpid
-        if(peps.pt[i].pid==old && GETVALBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE){ //We copy all the valid pages of old, except for kmalloc pages
-            pos = findspace();
-            if(pos==-1){ //If there isn't any free space we simply copy the page inside the swapfile (to avoid victim selection, which would be potentially unfeasible if we don't have enough space)
-                KASSERT(!GETIOBIT(peps.pt[i].ctl));
-                KASSERT(GETSWAPBIT(peps.pt[i].ctl));
-                KASSERT(peps.pt[i].page!=KMALLOC_PAGE);
-                DEBUG(DB_VM,"Copied from pt address 0x%x for process %d\n",peps.pt[i].page,new);
-                store_swap(peps.pt[i].page,new,peps.firstfreepaddr+i*PAGE_SIZE); //We save in the swapfile the page, that'll belong to the new pid
-            }
-            else{ //We found a non valid page, that can be used to store the page
-                peps.pt[pos].ctl = VALBITONE(peps.pt[pos].ctl);
-                peps.pt[pos].page = peps.pt[i].page;
-                peps.pt[pos].pid = new;
-                add_in_hash(peps.pt[i].page,new,pos);
-                memmove((void *)PADDR_TO_KVADDR(peps.firstfreepaddr + pos*PAGE_SIZE),(void *)PADDR_TO_KVADDR(peps.firstfreepaddr + i*PAGE_SIZE), PAGE_SIZE); //It's a copy within RAM, so we can use memmove. The reason to use PADDR_TO_KVADDR is explained in swapfile.c
-                KASSERT(!GETIOBIT(peps.pt[pos].ctl));
-                KASSERT(!GETTLBBIT(peps.pt[pos].ctl));
-                KASSERT(!GETSWAPBIT(peps.pt[pos].ctl));
-                KASSERT(peps.pt[pos].page!=KMALLOC_PAGE);
+    spinlock_acquire(&peps.pt_spinlock);
+
+    for(int i=0;i<peps.ptSize;i++){ //We count the frames that copy_pt_entries will share
+        if(GETVALBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && maps_frame(i, old)){
+            if(GETBUSYBIT(peps.pt[i].ctl)){
+                busy=i;
             }
+            n++;
         }
     }
 
-    #if OPT_DEBUG
-    print_list(new);
-    #endif
+    if(busy!=-1){
+        /**
+         * A page of old is being stored in the swapfile. The copy must wait for it, otherwise the new process may miss the page
+         * (it's neither in the IPT nor in the swapfile of old yet when copy_swap_pages looks at it).
+        */
+        wait_frame(busy);
+        spinlock_release(&peps.pt_spinlock);
+        return;
+    }
+
+    for(s=*pool; s!=NULL; s=s->next){
+        npool++;
+    }
+
+    for(missing = n - npool; missing>0 && peps.spare_sharers!=NULL; missing--){ //First we reuse the sharers released by the other processes
+        s = peps.spare_sharers;
+        peps.spare_sharers = s->next;
+        s->next = *pool;
+        *pool = s;
+    }
+    while((htable.count + n) * 2 > htable.size){ //The new entries must not trigger a resize during copy_pt_entries
+        htable_grow();
+    }
+
+    spinlock_release(&peps.pt_spinlock);
 
+    for(; missing>0; missing--){ //kmalloc may sleep, so the caller will have to check again
+        s = sharer_alloc();
+        if(s == NULL){
+            panic("error allocating a sharer!!");
+        }
+        s->next = *pool;
+        *pool = s;
+    }
 }
 
-void prepare_copy_pt(pid_t pid){
+int pt_entries_ready(pid_t old, struct sharer *pool){
+
+    int n=0, npool=0;
+
+    KASSERT(spinlock_do_i_hold(&peps.pt_spinlock));
 
     for(int i=0;i<peps.ptSize;i++){
-        if(peps.pt[i].pid == pid && peps.pt[i].page!=KMALLOC_PAGE && GETVALBIT(peps.pt[i].ctl)){
-            KASSERT(!GETIOBIT(peps.pt[i].ctl));
-            peps.pt[i].ctl = SWAPBITONE(peps.pt[i].ctl); //To freeze the current situation we set the swap bit to 1. This is done to avoid inconsistencies between the situation at the beginning and at the end of the swapping process.
+        if(GETVALBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && maps_frame(i, old)){
+            if(GETBUSYBIT(peps.pt[i].ctl)){
+                return 0;
+            }
+            n++;
         }
     }
+    for(; pool!=NULL; pool=pool->next){
+        npool++;
+    }
+
+    return npool >= n && (htable.count + n) * 2 <= htable.size;
 }
 
-void end_copy_pt(pid_t pid){
+void release_pt_pool(struct sharer *pool){
+    struct sharer *next;
 
-    for(int i=0;i<peps.ptSize;i++){
-        if(peps.pt[i].pid == pid && peps.pt[i].page!=KMALLOC_PAGE && GETVALBIT(peps.pt[i].ctl)){
-            KASSERT(GETSWAPBIT(peps.pt[i].ctl));
-            peps.pt[i].ctl = SWAPBITZERO(peps.pt[i].ctl); //We set the swap bit to 1
+    for(; pool!=NULL; pool=next){ //We don't hold pt_spinlock, so we can free them
+        next = pool->next;
+        sharer_free(pool);
+    }
+}
+
+void copy_pt_entries(pid_t old, pid_t new, struct sharer **pool){ // used for forking
+
+    struct sharer *s;
+
+    KASSERT(spinlock_do_i_hold(&peps.pt_spinlock));
+
+    for(int i=0;i<peps.ptSize;i++){  //idea is to share all the pages mapped by oldpid with newpid, without copying them
+        if(GETVALBIT(peps.pt[i].ctl) && peps.pt[i].page!=KMALLOC_PAGE && maps_frame(i, old)){ //We share all the valid pages of old, except for kmalloc pages
+            KASSERT(!GETBUSYBIT(peps.pt[i].ctl));
+            KASSERT(*pool!=NULL); //pt_entries_ready checked that there's a sharer for each frame
+            KASSERT((htable.count + 1) * 2 <= htable.size);
+            /**
+             * The dirty and the cached bits are related to the frame, so they're valid for the new process too. In particular, if the page
+             * is in the swap cache copy_swap_pages already shared its swapfile entry with the new process (both are called without releasing the locks).
+             * The page will be copied only when one of the processes writes it (copy on write). Since as_copy removes the entries of old
+             * from the TLB, every process will insert the page in the TLB without write privilege.
+            */
+            s = *pool;
+            *pool = s->next;
+            add_sharer(i, new, s);
+            add_in_hash(peps.pt[i].page,new,i);
+            add_cow_stat(COW_SHARED_PAGE);
+            DEBUG(DB_VM,"Shared frame %d (0x%x) with process %d\n",i,peps.pt[i].page,new);
         }
     }
 
-    lock_acquire(peps.pt_lock);
-    cv_broadcast(peps.pt_cv,peps.pt_lock); //Since the pages that were previously involved in the swap can now be selected as victims, we wake up all the processes waiting on the cv
-    lock_release(peps.pt_lock);
+    #if OPT_DEBUG
+    print_list(new);
+    #endif
 
 }
 
@@ -50,6 +50,125 @@ load_elf_page(struct vnode *v,
 	return result;
 }
 
+#if OPT_READAHEAD
+/**
+ * It tells if the page vaddr is entirely read from the ELF file. In this case it also returns the program header of its segment
+ * and the first page of the segment.
+ * The segments that don't begin at the beginning of a page (initial_offset!=0) are excluded: their first page is only partially
+ * in the file, and load_page takes care of them one page at a time.
+*/
+static int elf_full_page(struct addrspace *as, vaddr_t vaddr, Elf_Phdr **ph, vaddr_t *vbase){
+	if(vaddr>=as->as_vbase1 && vaddr < as->as_vbase1 + as->as_npages1 * PAGE_SIZE && as->initial_offset1==0){
+		*ph=&as->ph1;
+		*vbase=as->as_vbase1;
+	}
+	else if(vaddr>=as->as_vbase2 && vaddr < as->as_vbase2 + as->as_npages2 * PAGE_SIZE && as->initial_offset2==0){
+		*ph=&as->ph2;
+		*vbase=as->as_vbase2;
+	}
+	else{
+		return 0; //Stack, or a segment excluded above
+	}
+
+	return (*ph)->p_filesz >= (vaddr - *vbase) + PAGE_SIZE && (*ph)->p_memsz >= (*ph)->p_filesz; //The last page of the file may be partially zero-filled
+}
+
+int elf_readahead_window(vaddr_t vaddr, int max){
+	struct addrspace *as = proc_getas();
+	Elf_Phdr *ph, *next_ph;
+	vaddr_t vbase, next_vbase;
+	int n;
+
+	if(!elf_full_page(as, vaddr, &ph, &vbase)){
+		return 0;
+	}
+	for(n=0; n<max && elf_full_page(as, vaddr + (n+1)*PAGE_SIZE, &next_ph, &next_vbase) && next_ph==ph; n++);
+
+	return n;
+}
+
+void load_elf_pages(vaddr_t vaddr, paddr_t *paddrs, int npages){
+	struct addrspace *as = proc_getas();
+	struct iovec iov[RA_WINDOW_MAX+1];
+	struct uio u;
+	Elf_Phdr *ph;
+	vaddr_t vbase;
+	int result;
+
+	KASSERT(npages>0 && npages<=RA_WINDOW_MAX+1);
+	if(!elf_full_page(as, vaddr, &ph, &vbase)){
+		panic("Readahead of 0x%x, which is not a page of the ELF file\n",vaddr);
+	}
+
+	add_pt_type_fault(DISK);//Update statistics. Only vaddr caused a page fault
+
+	DEBUG(DB_VM,"ELF: Loading %d pages from 0x%x\n",npages,vaddr);
+
+	for(int i=0; i<npages; i++){ //The frames aren't contiguous, so each page has its own iovec. In this way a single VOP_READ is enough
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = npages;
+	u.uio_resid = npages*PAGE_SIZE;
+	u.uio_offset = ph->p_offset + (vaddr - vbase);
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = UIO_READ;
+	u.uio_space = NULL;
+
+	result = VOP_READ(as->v, &u);
+	if (result || u.uio_resid != 0) {
+		panic("Error while reading ahead the ELF file");
+	}
+
+	add_pt_type_fault(ELF);//Update statistics
+}
+#endif
+
+#if OPT_ZERO_POOL
+int zero_fill_type(vaddr_t vaddr){
+	struct addrspace *as = proc_getas();
+
+	//The checks on the segments are the same of load_page, so that we never skip a page that load_page would read from the ELF file
+	if(vaddr>=as->as_vbase1 && vaddr <= as->as_vbase1 + as->as_npages1 * PAGE_SIZE ){
+		return 0; //Text pages are always read from the file
+	}
+	if(vaddr>=as->as_vbase2 && vaddr <= as->as_vbase2 + as->as_npages2 * PAGE_SIZE ){
+		if((vaddr - as->as_vbase2)!=0 && (int)(as->ph2.p_filesz+as->initial_offset2) - (int)(vaddr - as->as_vbase2)<0){
+			return 2; //The page is after the end of the file (bss)
+		}
+		return 0;
+	}
+	if(vaddr>as->as_vbase2 + as->as_npages2 * PAGE_SIZE && vaddr<USERSTACK){
+		return 1;
+	}
+	return 0; //Segmentation fault, that will be handled by load_page
+}
+#endif
+
+#if OPT_TEXT_SHARE
+int file_page_key(vaddr_t vaddr, struct vnode **v, off_t *offset){
+	struct addrspace *as = proc_getas();
+
+	if(vaddr>=as->as_vbase1 && vaddr <= as->as_vbase1 + as->as_npages1 * PAGE_SIZE ){
+		*v=as->v; //All the runs of the same program open the same vnode, so it identifies the file
+		*offset=as->ph1.p_offset+(vaddr - as->as_vbase1); //The same offset used by load_page
+		return 1;
+	}
+	#if OPT_PAGE_CACHE
+	if(vaddr>=as->as_vbase2 && vaddr <= as->as_vbase2 + as->as_npages2 * PAGE_SIZE ){
+		if((vaddr - as->as_vbase2)!=0 && (int)(as->ph2.p_filesz+as->initial_offset2) - (int)(vaddr - as->as_vbase2)<0){
+			return 0; //The page is after the end of the file (bss), so it's just zero-filled
+		}
+		*v=as->v;
+		*offset=as->ph2.p_offset+(vaddr - as->as_vbase2);
+		return 1;
+	}
+	#endif
+	return 0;
+}
+#endif
+
 int load_page(vaddr_t vaddr, pid_t pid, paddr_t paddr){
 
     int swap_found, result;
@@ -60,7 +179,7 @@ int load_page(vaddr_t vaddr, pid_t pid, paddr_t paddr){
     swap_found = load_swap(vaddr, pid, paddr); //we check if the page was already read from the elf, i.e. it currently is stored in the swapfile.
 
     if(swap_found){
-        return 0; //load_swap takes care of loading too, so we just return.
+        return swap_found; //load_swap takes care of loading too, so we just return. If the swapfile entry has been released (1), the caller must consider the page dirty
     }
 
 	as = proc_getas();
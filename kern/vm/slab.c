@@ -0,0 +1,258 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <slab.h>
+
+static struct slab_cache *allcaches = NULL; //List of all the caches, used only by slab_printstats
+static struct spinlock allcaches_lock = SPINLOCK_INITIALIZER;
+
+#define SLAB_ALIGN 8 //Alignment of the objects, the same of kmalloc
+
+/**
+ * It returns the pointer to the next free object, stored after the object itself.
+*/
+static void **slab_link(struct slab_cache *c, void *obj)
+{
+    return (void **)((char *)obj + c->slot - sizeof(void *));
+}
+
+/**
+ * It returns the slab that contains the object. A slab is a whole page and its header is at the beginning, so we just clear the offset.
+*/
+static struct slab *obj_slab(void *obj)
+{
+    return (struct slab *)((vaddr_t)obj & PAGE_FRAME);
+}
+
+/**
+ * Helpers for the list of the slabs with free objects. They're called with the lock of the cache held.
+*/
+static void partial_push(struct slab_cache *c, struct slab *s)
+{
+    s->prev = NULL;
+    s->next = c->partial; //Insertion in head
+    if (c->partial != NULL)
+    {
+        c->partial->prev = s;
+    }
+    c->partial = s;
+}
+
+static void partial_remove(struct slab_cache *c, struct slab *s)
+{
+    if (s->prev != NULL)
+    {
+        s->prev->next = s->next;
+    }
+    else
+    {
+        KASSERT(c->partial == s);
+        c->partial = s->next;
+    }
+    if (s->next != NULL)
+    {
+        s->next->prev = s->prev;
+    }
+    s->next = NULL;
+    s->prev = NULL;
+}
+
+struct slab_cache *slab_create(const char *name, size_t size, void (*ctor)(void *), void (*dtor)(void *))
+{
+    struct slab_cache *c;
+
+    c = kmalloc(sizeof(struct slab_cache));
+    if (c == NULL)
+    {
+        panic("Error during the allocation of the cache %s", name);
+    }
+    c->name = name;
+    c->size = size;
+    c->slot = ROUNDUP(ROUNDUP(size, sizeof(void *)) + sizeof(void *), SLAB_ALIGN);
+    c->perslab = (PAGE_SIZE - ROUNDUP(sizeof(struct slab), SLAB_ALIGN)) / c->slot;
+    if (c->perslab == 0)
+    {
+        panic("The objects of the cache %s are too big for a slab", name);
+    }
+    c->ctor = ctor;
+    c->dtor = dtor;
+    c->partial = NULL;
+    c->nslabs = 0;
+    c->nempty = 0;
+    c->inuse = 0;
+    c->peak = 0;
+    c->allocs = 0;
+    c->frees = 0;
+    spinlock_init(&c->lock);
+
+    spinlock_acquire(&allcaches_lock);
+    c->next = allcaches;
+    allcaches = c;
+    spinlock_release(&allcaches_lock);
+
+    return c;
+}
+
+/**
+ * It allocates a new slab for the cache and it constructs all its objects. It's called without holding the lock of the cache, since
+ * alloc_kpages and the constructors may sleep (e.g. cv_create calls kmalloc).
+ *
+ * @return the new slab, not yet in the list of the cache, or NULL if no page could be allocated
+*/
+static struct slab *slab_grow(struct slab_cache *c)
+{
+    struct slab *s;
+    char *obj;
+    unsigned i;
+
+    s = (struct slab *)alloc_kpages(1);
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    s->cache = c;
+    s->next = NULL;
+    s->prev = NULL;
+    s->inuse = 0;
+    s->free = NULL;
+    obj = (char *)s + ROUNDUP(sizeof(struct slab), SLAB_ALIGN);
+    for (i = 0; i < c->perslab; i++, obj += c->slot) //We link the objects in reverse order, so the first ones are allocated first
+    {
+        if (c->ctor != NULL)
+        {
+            c->ctor(obj);
+        }
+    }
+    for (i = 0; i < c->perslab; i++)
+    {
+        obj -= c->slot;
+        *slab_link(c, obj) = s->free;
+        s->free = obj;
+    }
+    return s;
+}
+
+/**
+ * It destroys all the objects of an empty slab and it gives back its page. It's called without holding the lock of the cache.
+*/
+static void slab_release(struct slab_cache *c, struct slab *s)
+{
+    void *obj;
+
+    KASSERT(s->inuse == 0);
+    if (c->dtor != NULL)
+    {
+        for (obj = s->free; obj != NULL; obj = *slab_link(c, obj))
+        {
+            c->dtor(obj);
+        }
+    }
+    free_kpages((vaddr_t)s);
+}
+
+void *slab_alloc(struct slab_cache *c)
+{
+    struct slab *s;
+    void *obj;
+
+    spinlock_acquire(&c->lock);
+    while (c->partial == NULL)
+    {
+        spinlock_release(&c->lock);
+        s = slab_grow(c);
+        if (s == NULL)
+        {
+            return NULL;
+        }
+        spinlock_acquire(&c->lock);
+        partial_push(c, s); //Another thread may have added a slab in the meanwhile: the new one will just stay empty for now
+        c->nslabs++;
+        c->nempty++;
+    }
+    s = c->partial;
+    obj = s->free;
+    KASSERT(obj != NULL);
+    s->free = *slab_link(c, obj);
+    if (s->inuse == 0)
+    {
+        c->nempty--;
+    }
+    s->inuse++;
+    if (s->free == NULL)
+    {
+        partial_remove(c, s); //The slab is full
+    }
+    c->inuse++;
+    if (c->inuse > c->peak)
+    {
+        c->peak = c->inuse;
+    }
+    c->allocs++;
+    spinlock_release(&c->lock);
+
+    return obj;
+}
+
+void slab_free(struct slab_cache *c, void *obj)
+{
+    struct slab *s = obj_slab(obj);
+
+    KASSERT(s->cache == c);
+    spinlock_acquire(&c->lock);
+    KASSERT(s->inuse > 0);
+    if (s->free == NULL)
+    {
+        partial_push(c, s); //The slab was full, so it wasn't in the list
+    }
+    *slab_link(c, obj) = s->free;
+    s->free = obj;
+    s->inuse--;
+    c->inuse--;
+    c->frees++;
+    if (s->inuse == 0)
+    {
+        if (c->nempty >= SLAB_SPARE)
+        {
+            partial_remove(c, s); //We have enough empty slabs, so we give this one back
+            c->nslabs--;
+            spinlock_release(&c->lock);
+            slab_release(c, s);
+            return;
+        }
+        c->nempty++;
+    }
+    spinlock_release(&c->lock);
+}
+
+void slab_printstats(void)
+{
+    struct slab_cache *c;
+    unsigned nslabs, inuse, peak, size, perslab;
+    uint32_t allocs, frees;
+
+    kprintf("Object caches:\n");
+    kprintf("%-12s %6s %8s %6s %8s %8s %10s %10s %6s\n", "name", "size", "perslab", "slabs", "inuse", "peak", "allocs", "frees", "used%");
+
+    /*
+     * The caches are never destroyed and new ones are only added in head, so we can walk the list without holding allcaches_lock.
+     * The values of each cache are copied under its lock and printed after releasing it.
+    */
+    spinlock_acquire(&allcaches_lock);
+    c = allcaches;
+    spinlock_release(&allcaches_lock);
+    for (; c != NULL; c = c->next)
+    {
+        spinlock_acquire(&c->lock);
+        nslabs = c->nslabs;
+        inuse = c->inuse;
+        peak = c->peak;
+        allocs = c->allocs;
+        frees = c->frees;
+        spinlock_release(&c->lock);
+        size = c->size;
+        perslab = c->perslab;
+        kprintf("%-12s %6u %8u %6u %8u %8u %10u %10u %5u%%\n", c->name, size, perslab, nslabs, inuse, peak, allocs, frees,
+                nslabs ? inuse * 100 / (nslabs * perslab) : 0);
+    }
+}
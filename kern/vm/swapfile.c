@@ -1,4 +1,6 @@
 #include "swapfile.h"
+#include "pt.h"
+#include "slab.h"
 
 #define MAX_SIZE 9*1024*1024 //Size of the swapfile: 9 MB
 
@@ -8,105 +10,571 @@ static int occ = 0;
 
 struct swapfile *swap;
 
+#if OPT_SW_LIST
+static struct swap_map *pid_map(pid_t);
+#endif
+
 /**
- * Debugging function. Given a pid, it prints text, data and stack lists for that proces.
+ * Debugging function. Given a pid, it prints the swap map of that process, one bucket per line.
  * 
  * @param pid: pid of the process.
 */
 #if OPT_DEBUG
 void print_list(pid_t pid){
 
+    struct swap_map *map=pid_map(pid);
     struct swap_cell *i;
 
-    kprintf("SWAP LIST FOR PROCESS %d:\n",pid);
-    kprintf("Text list:\n");
-    for(i=swap->text[pid];i!=NULL;i=i->next){
-        kprintf("addr: 0x%x, offset: 0x%x, next: 0x%x\n",i->vaddr,i->offset,(unsigned int)i->next);
-    }
-    kprintf("Data list:\n");
-    for(i=swap->data[pid];i!=NULL;i=i->next){
-        kprintf("addr: 0x%x, offset: 0x%x, next: 0x%x\n",i->vaddr,i->offset,(unsigned int)i->next);
-    }
-    kprintf("Stack list:\n");
-    for(i=swap->stack[pid];i!=NULL;i=i->next){
-        kprintf("addr: 0x%x, offset: 0x%x, next: 0x%x\n",i->vaddr,i->offset,(unsigned int)i->next);
+    kprintf("SWAP MAP FOR PROCESS %d (%u pages, %u buckets):\n",pid,map->count,map->nbuckets);
+    for(unsigned b=0;b<map->nbuckets;b++){
+        if(map->buckets[b]==NULL){
+            continue;
+        }
+        kprintf("%u:",b);
+        for(i=map->buckets[b];i!=NULL;i=i->next){
+            kprintf(" 0x%x->0x%x",i->vaddr,i->offset);
+        }
+        kprintf("\n");
     }
     kprintf("\n");
 
 }
 #endif
 
-int load_swap(vaddr_t vaddr, pid_t pid, paddr_t paddr){
-    int result;
+#if OPT_SW_LIST
+#if OPT_SLAB
+static struct slab_cache *cell_cache; //Cache of the swap cells (see slab.h)
+
+/**
+ * Constructor and destructor of the swap cells. The cv and the lock of a cell are created only once, when its slab is allocated,
+ * and they're kept while the cell goes back and forth between the cache and the swapfile.
+*/
+static void cell_ctor(void *obj){
+    struct swap_cell *cell = obj;
+
+    cell->cell_cv = cv_create("cell_cv");
+    cell->cell_lock = lock_create("cell_lock");
+    if(!cell->cell_cv || !cell->cell_lock){
+        panic("Error during swap elements allocation");
+    }
+}
+
+static void cell_dtor(void *obj){
+    struct swap_cell *cell = obj;
+
+    cv_destroy(cell->cell_cv);
+    lock_destroy(cell->cell_lock);
+}
+#endif
+
+/**
+ * It creates a new cell for the page of the swapfile at the given offset. Only the pages in use have a cell: cells are created by
+ * stores and forks, before taking swap_lock since they may need kmalloc. If possible we reuse a spare cell.
+ * It's called without holding swap_lock.
+*/
+static struct swap_cell *cell_create(paddr_t offset){
+    struct swap_cell *cell;
+
+    spinlock_acquire(&swap->swap_lock);
+    cell=swap->spare;
+    if(cell!=NULL){
+        swap->spare=cell->next;
+    }
+    spinlock_release(&swap->swap_lock);
+
+    if(cell==NULL){
+        #if OPT_SLAB
+        cell=slab_alloc(cell_cache); //Already constructed
+        if(!cell){
+            panic("Error during swap elements allocation");
+        }
+        #else
+        cell=kmalloc(sizeof(struct swap_cell));
+        if(!cell){
+            panic("Error during swap elements allocation");
+        }
+        cell->cell_cv = cv_create("cell_cv");
+        cell->cell_lock = lock_create("cell_lock");
+        if(!cell->cell_cv || !cell->cell_lock){
+            panic("Error during swap elements allocation");
+        }
+        #endif
+    }
+    cell->vaddr=0;
+    cell->offset=offset; //Offset within the swap file
+    cell->store=0;
+    cell->next=NULL;
+    cell->prev=NULL;
+    cell->shared_next=NULL;
+    return cell;
+}
+
+static void cell_destroy(struct swap_cell *cell){
+    #if OPT_SLAB
+    slab_free(cell_cache, cell); //The cv and the lock are kept for the next cell_create
+    #else
+    cv_destroy(cell->cell_cv);
+    lock_destroy(cell->cell_lock);
+    kfree(cell);
+    #endif
+}
+
+/**
+ * Free page helpers. The free pages of the swapfile are the bits set in swap->freemap, so we can look at the neighbours of a page
+ * (to keep the pages of a process close) and skip 32 pages in use at a time. They're called with swap_lock held.
+*/
+static int slot_isfree(int slot){
+    return (swap->freemap[slot/32] >> (slot%32)) & 1;
+}
+
+static void slot_take(int slot){
+    KASSERT(slot_isfree(slot));
+    swap->freemap[slot/32] &= ~(1U << (slot%32));
+    swap->nfree--;
+}
+
+static void slot_give(int slot){
+    KASSERT(!slot_isfree(slot));
+    swap->freemap[slot/32] |= 1U << (slot%32);
+    swap->nfree++;
+    #if OPT_ZSWAP
+    zswap_drop(slot); //If the page was still in the compressed pool, its copy is useless
+    #endif
+}
+
+/**
+ * It searches n adjacent free pages in the swapfile, looking at most at limit pages starting from the page from. A group never wraps
+ * around the end of the swapfile.
+ *
+ * @return the first page of the group, -1 if there aren't n adjacent free pages
+*/
+static int find_free_run(int from, int n, int limit){
+    int slot, run=0, k=0, skip;
+
+    while(k<limit){
+        slot=(from+k)%swap->size;
+        if(slot==0){
+            run=0;
+        }
+        if(slot%32==0 && swap->freemap[slot/32]==0){ //32 pages in use: none of them can start or continue a group
+            skip = swap->size-slot < 32 ? swap->size-slot : 32;
+            run=0;
+            k+=skip;
+            continue;
+        }
+        if(slot_isfree(slot)){
+            run++;
+            if(run==n){
+                return slot-n+1;
+            }
+        }
+        else{
+            run=0;
+        }
+        k++;
+    }
+    return -1;
+}
+
+/**
+ * It allocates n adjacent pages of the swapfile for the process that owns map, trying to keep its pages close:
+ * 1) right after the last page given to the process (its cursor), so that the pages stored one after the other are adjacent;
+ * 2) within SWAP_NEAR pages after the cursor;
+ * 3) at the beginning of a new extent of SWAP_EXTENT free pages, searched from swap->rotor. The rotor moves after the extent,
+ *    so the next process that needs an extent takes another one and the two processes don't interleave their pages;
+ * 4) anywhere in the swapfile.
+ * It's called with swap_lock held.
+ *
+ * @return the first page, -1 if there aren't n adjacent free pages
+*/
+static int slot_alloc(struct swap_map *map, int n){
+    int first=-1, extent=n>SWAP_EXTENT ? n : SWAP_EXTENT;
+
+    if(swap->nfree<n){
+        return -1;
+    }
+    if(map->cursor>=0){
+        first=find_free_run(map->cursor,n,n);
+        if(first==map->cursor){
+            add_swap_slot_stat(SWAP_SLOT_SEQUENTIAL,n);
+        }
+        else{
+            first=find_free_run(map->cursor,n,SWAP_NEAR+n-1);
+            if(first!=-1){
+                add_swap_slot_stat(SWAP_SLOT_NEAR,n);
+            }
+        }
+    }
+    if(first==-1){
+        first=find_free_run(swap->rotor,extent,swap->size+extent-1);
+        if(first!=-1){
+            swap->rotor=(first+extent)%swap->size;
+            add_swap_slot_stat(SWAP_SLOT_EXTENTS,1);
+        }
+    }
+    if(first==-1){
+        first=find_free_run(map->cursor>=0 ? map->cursor : swap->rotor,n,swap->size+n-1);
+        if(first==-1){
+            return -1;
+        }
+        add_swap_slot_stat(SWAP_SLOT_SCATTERED,n);
+    }
+    for(int k=0; k<n; k++){
+        slot_take(first+k);
+    }
+    map->cursor=(first+n)%swap->size;
+    return first;
+}
+
+/**
+ * It updates the seek distance before an I/O of npages pages of the swapfile starting at offset. The distance is measured in pages
+ * from the page after the previous I/O, where the head of the disk is, and it's an estimate when more I/Os are in progress.
+*/
+static void swap_seek(paddr_t offset, int npages){
+    int slot=offset/PAGE_SIZE, dist;
+
+    spinlock_acquire(&swap->swap_lock);
+    dist = slot>swap->head ? slot-swap->head : swap->head-slot;
+    swap->head=slot+npages;
+    spinlock_release(&swap->swap_lock);
+
+    add_swap_slot_stat(SWAP_SLOT_IOS,1);
+    add_swap_slot_stat(SWAP_SLOT_SEEK,dist);
+}
+
+/**
+ * It releases a cell that has already been removed from the swap map of its process. The page of the swapfile becomes free only if
+ * no other process shares it. The cell becomes a spare one, since we can't free it while holding swap_lock. It's called with swap_lock held.
+*/
+static void swap_put(struct swap_cell *cell){
+    int slot = cell->offset / PAGE_SIZE;
+
+    KASSERT(swap->refs[slot] > 0);
+    KASSERT(!cell->store);
+    cell->vaddr=0;
+    swap->refs[slot]--;
+    if(swap->refs[slot] == 0){
+        slot_give(slot); //The page of the swapfile is free
+    }
+    cell->next=swap->spare;
+    swap->spare=cell;
+}
+
+#if OPT_ZSWAP
+/**
+ * It writes the least recently used page of the compressed pool to its page of the swapfile, to make room in the pool. The page is
+ * pinned with a reference during the write, so it can't become free even if its processes load it or end in the meanwhile, and it
+ * leaves the pool only after the write: until then, a load still finds it there.
+ *
+ * @return 1 if a page was written, 0 if there are no pages to write back
+*/
+static int zswap_writeback(void){
+    int slot, result;
     struct iovec iov;
     struct uio ku;
 
-    KASSERT(pid==curproc->p_pid);
+    lock_acquire(swap->wb_lock);
 
-    #if OPT_SW_LIST
-    struct addrspace *as=proc_getas();
-    struct swap_cell *list=NULL, *prev=NULL;
-    int seg=-1; //Used both to debug and to perform removal from head
+    spinlock_acquire(&swap->swap_lock);
+    slot=zswap_victim();
+    if(slot!=-1){
+        KASSERT(swap->refs[slot]>0);
+        swap->refs[slot]++;
+    }
+    spinlock_release(&swap->swap_lock);
+
+    if(slot==-1){
+        lock_release(swap->wb_lock);
+        return 0;
+    }
+
+    result=zswap_load(slot,swap->wb_buf);
+    KASSERT(result==1);
+
+    DEBUG(DB_VM,"ZSWAP WRITEBACK in 0x%x\n",slot*PAGE_SIZE);
+
+    swap_seek(slot*PAGE_SIZE,1);
+
+    uio_kinit(&iov,&ku,swap->wb_buf,PAGE_SIZE,slot*PAGE_SIZE,UIO_WRITE);
+
+    result = VOP_WRITE(swap->v,&ku);
+    if(result){
+        panic("VOP_WRITE in swapfile failed, with result=%d",result);
+    }
+
+    lock_release(swap->wb_lock);
+
+    spinlock_acquire(&swap->swap_lock);
+    zswap_drop(slot); //From now on the page is read from the swapfile
+    swap->refs[slot]--;
+    if(swap->refs[slot] == 0){
+        slot_give(slot);
+    }
+    spinlock_release(&swap->swap_lock);
+
+    add_swap_writes();//Update statistics
+    add_zswap_stat(ZSWAP_WRITEBACKS,1);
+
+    return 1;
+}
+
+/**
+ * It tries to keep the page at paddr, that will be stored in the page slot of the swapfile, in the compressed pool. While the pool
+ * has no room for it, the least recently used pages are written back.
+ *
+ * @return 1 if the page is in the pool, 0 if it must be written to the swapfile
+*/
+static int pool_store(int slot, paddr_t paddr){
+    int result;
+
+    while((result=zswap_store(slot,paddr))==0 && zswap_writeback());
+
+    return result==1;
+}
+#endif
 
-    //First step: identify the correct segment, so that list points to the correct entry
+/**
+ * It returns the swap map of a process. The page may belong to a process different from curproc (e.g. the victim of a store, or
+ * a page reclaimed from the swap cache), and the pageout daemon doesn't even have an address space, so we always go through the
+ * process table. It takes no lock, so it's used also with pt_spinlock or swap_lock held. The map can't be destroyed while we use it:
+ * a process removes its frames (free_pages, which waits for the ones being stored) and its swap pages before its address space.
+*/
+static struct swap_map *pid_map(pid_t pid){
+    struct addrspace *as=proc_search_pid(pid)->p_addrspace;
+
+    KASSERT(as!=NULL);
+    return as->as_swap;
+}
+
+/**
+ * Swap map helpers. The bucket of a page depends only on its virtual page number, so the pages of a segment are spread on
+ * consecutive buckets. They're called with swap_lock held.
+*/
+static struct swap_cell **map_bucket(struct swap_map *map, vaddr_t vaddr){
+    return &map->buckets[(vaddr/PAGE_SIZE) & (map->nbuckets-1)];
+}
 
-    if(vaddr>=as->as_vbase1 && vaddr <= as->as_vbase1 + as->as_npages1 * PAGE_SIZE ){
-        list = swap->text[pid];
-        seg=0;
+static struct swap_cell *map_lookup(struct swap_map *map, vaddr_t vaddr){
+    struct swap_cell *cell;
+
+    for(cell=*map_bucket(map,vaddr); cell!=NULL; cell=cell->next){
+        if(cell->vaddr==vaddr){
+            return cell;
+        }
     }
+    return NULL;
+}
+
+static void map_insert(struct swap_map *map, struct swap_cell *cell){ //cell->vaddr must already be set
+    struct swap_cell **head=map_bucket(map,cell->vaddr);
 
-    if(vaddr>=as->as_vbase2 && vaddr <= as->as_vbase2 + as->as_npages2 * PAGE_SIZE ){
-        list = swap->data[pid];
-        seg=1;
+    cell->prev=NULL;
+    cell->next=*head;
+    if(*head!=NULL){
+        (*head)->prev=cell;
     }
+    *head=cell;
+    map->count++;
+}
 
-    if(vaddr <= USERSTACK && vaddr>as->as_vbase2 + as->as_npages2 * PAGE_SIZE){
-        list = swap->stack[pid];
-        seg=2;
+static void map_remove(struct swap_map *map, struct swap_cell *cell){
+    if(cell->prev!=NULL){
+        cell->prev->next=cell->next;
+    }
+    else{
+        KASSERT(*map_bucket(map,cell->vaddr)==cell);
+        *map_bucket(map,cell->vaddr)=cell->next;
+    }
+    if(cell->next!=NULL){
+        cell->next->prev=cell->prev;
     }
+    cell->next=NULL;
+    cell->prev=NULL;
+    KASSERT(map->count>0);
+    map->count--;
+}
 
-    if(seg==-1){
-        panic("Wrong vaddr for load: 0x%x, process=%d\n",vaddr,curproc->p_pid);
+/**
+ * It detaches all the cells of a map, and it returns them in a single list linked by next. It's called with swap_lock held.
+*/
+static struct swap_cell *map_detach(struct swap_map *map){
+    struct swap_cell *list=NULL, *cell, *next;
+
+    for(unsigned b=0; b<map->nbuckets; b++){
+        for(cell=map->buckets[b]; cell!=NULL; cell=next){
+            next=cell->next;
+            cell->prev=NULL;
+            cell->next=list;
+            list=cell;
+        }
+        map->buckets[b]=NULL;
     }
+    map->count=0;
+    return list;
+}
 
-    //Second step: search for the entry in the list
-    
-    while(list!=NULL){
-        if(list->vaddr==vaddr){ //Entry found
-
-            /**
-             * Please notice that, due to the parallelism, it's necessary to enforce a specific order in the operations.
-             * First, we must remove the entry from the process list (otherwise we may think that this old entry is still valid).
-             * Then, we can perform the I/O operation. However, the entry can't be used by anyone else (we're still working on it), so we can't place it in the free list.
-             * Lastly, after the I/O operation we can place the entry inside the free list.
-            */
-
-            if(prev!=NULL){ //List is not the first entry
-                KASSERT(prev->next==list);
-                DEBUG(DB_VM,"We removed 0x%x from process %d, so now 0x%x points to 0x%x\n",vaddr,pid,prev!=NULL?prev->vaddr:(unsigned int)NULL,prev->next->vaddr);
-                prev->next=list->next; //We remove list from the process list
-            }
-            else{ //We remove from head
-                if(seg==0){
-                    swap->text[pid]=list->next;
-                }
-                if(seg==1){
-                    swap->data[pid]=list->next;
-                }
-                if(seg==2){
-                    swap->stack[pid]=list->next;
-                }
+/**
+ * It makes sure that the map can take n more cells without exceeding SWAP_MAP_LOAD cells per bucket on average, doubling its buckets
+ * if needed. The new buckets are allocated without holding swap_lock, so someone else may grow the map in the meanwhile: in that case
+ * we just throw ours away. If there's no memory the map keeps working with longer buckets.
+*/
+static void map_fit(struct swap_map *map, unsigned n){
+    struct swap_cell **buckets, **old, *cell, *next, **head;
+    unsigned nbuckets, oldn;
+
+    spinlock_acquire(&swap->swap_lock);
+    oldn=map->nbuckets;
+    for(nbuckets=oldn; map->count+n > nbuckets*SWAP_MAP_LOAD; nbuckets*=2);
+    spinlock_release(&swap->swap_lock);
+
+    if(nbuckets==oldn){
+        return;
+    }
+
+    buckets=kmalloc(nbuckets*sizeof(struct swap_cell *));
+    if(!buckets){
+        return;
+    }
+    for(unsigned b=0; b<nbuckets; b++){
+        buckets[b]=NULL;
+    }
+
+    spinlock_acquire(&swap->swap_lock);
+    if(map->nbuckets>=nbuckets){
+        spinlock_release(&swap->swap_lock);
+        kfree(buckets);
+        return;
+    }
+    old=map->buckets;
+    for(unsigned b=0; b<map->nbuckets; b++){ //We move the cells to the new buckets. The order within a bucket doesn't matter
+        for(cell=old[b]; cell!=NULL; cell=next){
+            next=cell->next;
+            head=&buckets[(cell->vaddr/PAGE_SIZE) & (nbuckets-1)];
+            cell->prev=NULL;
+            cell->next=*head;
+            if(*head!=NULL){
+                (*head)->prev=cell;
             }
+            *head=cell;
+        }
+    }
+    map->buckets=buckets;
+    map->nbuckets=nbuckets;
+    spinlock_release(&swap->swap_lock);
+
+    kfree(old);
+}
 
-            lock_acquire(list->cell_lock);
-            while(list->store){ //The entry is currently being stored, so we wait until when store has been completed
-                cv_wait(list->cell_cv,list->cell_lock); //We wait on the cv of the entry
+struct swap_map *swap_map_create(void){
+    struct swap_map *map;
+
+    map=kmalloc(sizeof(struct swap_map));
+    if(!map){
+        return NULL;
+    }
+    map->buckets=kmalloc(SWAP_MAP_MIN*sizeof(struct swap_cell *));
+    if(!map->buckets){
+        kfree(map);
+        return NULL;
+    }
+    for(int b=0; b<SWAP_MAP_MIN; b++){
+        map->buckets[b]=NULL;
+    }
+    map->nbuckets=SWAP_MAP_MIN;
+    map->count=0;
+    map->cursor=-1; //The first page will start a new extent
+    return map;
+}
+#endif
+
+int load_swap(vaddr_t vaddr, pid_t pid, paddr_t paddr){
+    int result;
+    struct iovec iov;
+    struct uio ku;
+
+    KASSERT(pid==curproc->p_pid);
+
+    #if OPT_SW_LIST
+    struct swap_map *map=pid_map(pid);
+    struct swap_cell *list;
+
+    //Search for the entry in the swap map. Only this process removes its entries, so list can be used after releasing swap_lock
+
+    spinlock_acquire(&swap->swap_lock);
+
+    list=map_lookup(map,vaddr);
+    if(list!=NULL){ //Entry found
+
+        #if OPT_SWAP_CACHE
+        /**
+         * Swap cache: we leave the entry in the swap map, so that if the page is evicted again before being written
+         * we don't need to store it. The entry will be released by swap_release on the first write on the page, or by
+         * reclaim_swap_cache if the swapfile becomes full.
+        */
+        spinlock_release(&swap->swap_lock);
+
+        lock_acquire(list->cell_lock);
+        while(list->store){
+            cv_wait(list->cell_cv,list->cell_lock);
+        }
+        lock_release(list->cell_lock);
+
+        DEBUG(DB_VM,"LOAD SWAP (CACHED) in 0x%x (virtual: 0x%x) for process %d\n",list->offset, vaddr, pid);
+
+        add_pt_type_fault(DISK);//Update statistics
+
+        #if OPT_ZSWAP
+        if(zswap_load(list->offset/PAGE_SIZE,(void*)PADDR_TO_KVADDR(paddr))){ //The page is in the compressed pool, so we don't read the swapfile
+            add_zswap_stat(ZSWAP_HITS,1);
+        }
+        else
+        #endif
+        {
+            swap_seek(list->offset,1);
+
+            uio_kinit(&iov,&ku,(void*)PADDR_TO_KVADDR(paddr),PAGE_SIZE,list->offset,UIO_READ);
+
+            result = VOP_READ(swap->v,&ku);
+            if(result){
+                panic("VOP_READ in swapfile failed, with result=%d",result);
             }
-            lock_release(list->cell_lock);
-            
-            DEBUG(DB_VM,"LOAD SWAP in 0x%x (virtual: 0x%x) for process %d\n",list->offset, vaddr, pid);
+        }
 
-            add_pt_type_fault(DISK);//Update statistics
+        add_pt_type_fault(SWAPFILE);//Update statistics
+
+        return 2;//We found the entry in the swapfile and we kept it
+        #endif
+
+        /**
+         * Please notice that, due to the parallelism, it's necessary to enforce a specific order in the operations.
+         * First, we must remove the entry from the swap map (otherwise we may think that this old entry is still valid).
+         * Then, we can perform the I/O operation. However, the entry can't be used by anyone else (we're still working on it), so its page of the swapfile can't become free yet.
+         * Lastly, after the I/O operation we can release the entry, and its page becomes free.
+        */
+
+        map_remove(map,list); //We remove list from the swap map of the process
+        DEBUG(DB_VM,"We removed 0x%x from process %d\n",vaddr,pid);
+
+        spinlock_release(&swap->swap_lock);
+
+        lock_acquire(list->cell_lock);
+        while(list->store){ //The entry is currently being stored, so we wait until when store has been completed
+            cv_wait(list->cell_cv,list->cell_lock); //We wait on the cv of the entry
+        }
+        lock_release(list->cell_lock);
+        
+        DEBUG(DB_VM,"LOAD SWAP in 0x%x (virtual: 0x%x) for process %d\n",list->offset, vaddr, pid);
+
+        add_pt_type_fault(DISK);//Update statistics
+
+        #if OPT_ZSWAP
+        if(zswap_load(list->offset/PAGE_SIZE,(void*)PADDR_TO_KVADDR(paddr))){ //The page is in the compressed pool, so we don't read the swapfile
+            add_zswap_stat(ZSWAP_HITS,1);
+        }
+        else
+        #endif
+        {
+            swap_seek(list->offset,1);
 
             uio_kinit(&iov,&ku,(void*)PADDR_TO_KVADDR(paddr),PAGE_SIZE,list->offset,UIO_READ);//Again we use paddr as it was a kernel physical address to avoid a recursion of faults
 
@@ -114,26 +582,24 @@ int load_swap(vaddr_t vaddr, pid_t pid, paddr_t paddr){
             if(result){
                 panic("VOP_READ in swapfile failed, with result=%d",result);
             }
-            DEBUG(DB_VM,"ENDED LOAD SWAP in 0x%x (virtual: 0x%x) for process %d\n",list->offset, list->vaddr, pid);
-
-            list->next=swap->free; //We place the entry in the free list
-            swap->free=list;
+        }
+        DEBUG(DB_VM,"ENDED LOAD SWAP in 0x%x (virtual: 0x%x) for process %d\n",list->offset, list->vaddr, pid);
 
-            add_pt_type_fault(SWAPFILE);//Update statistics
+        spinlock_acquire(&swap->swap_lock);
+        swap_put(list); //The page of the swapfile becomes free (if no other process shares it) and we reset the virtual address
+        spinlock_release(&swap->swap_lock);
 
-            list->vaddr=0; //We reset the virtual address
+        add_pt_type_fault(SWAPFILE);//Update statistics
 
-            #if OPT_DEBUG
-            print_list(pid); //We print the updated list
-            #endif
+        #if OPT_DEBUG
+        print_list(pid); //We print the updated list
+        #endif
 
-            return 1;//We found the entry in the swapfile, so we return 1
-        }
-        prev=list; //We update prev and list
-        list=list->next;
-        KASSERT(prev->next==list);
+        return 1;//We found the entry in the swapfile, so we return 1
     }
 
+    spinlock_release(&swap->swap_lock);
+
     #else
     int i;
     for(i=0;i<swap->size; i++){
@@ -157,143 +623,412 @@ int load_swap(vaddr_t vaddr, pid_t pid, paddr_t paddr){
 
             DEBUG(DB_VM,"Process %d read. Now occ=%d\n",curproc->p_pid,occ);
 
-            return 1;//We found the entry in the swapfile, so we return 1
+            return 1;//We found the entry in the swapfile, so we return 1
+        }
+    }
+    #endif
+
+    return 0;//We didn't find any entry, so we return 0
+}
+
+#if OPT_SW_LIST
+int swap_release(vaddr_t vaddr, pid_t pid){
+    struct swap_map *map=pid_map(pid); //The page may belong to a process different from curproc (e.g. when we reclaim the swap cache)
+    struct swap_cell *elem;
+
+    //It's called also with pt_spinlock held, so it never sleeps
+    spinlock_acquire(&swap->swap_lock);
+    elem=map_lookup(map,vaddr);
+    if(elem!=NULL){
+        KASSERT(!elem->store); //A page in the swap cache is clean, so nobody is storing it
+        map_remove(map,elem);
+        swap_put(elem); //After a fork other processes may still use the page of the swapfile
+    }
+    spinlock_release(&swap->swap_lock);
+
+    return elem!=NULL;
+}
+#endif
+
+int swap_contains(vaddr_t vaddr, pid_t pid){
+    int found=0;
+
+    spinlock_acquire(&swap->swap_lock);
+    #if OPT_SW_LIST
+    found = map_lookup(pid_map(pid),vaddr)!=NULL;
+    #else
+    for(int i=0; i<swap->size && !found; i++){
+        found = swap->elements[i].pid==pid && swap->elements[i].vaddr==vaddr;
+    }
+    #endif
+    spinlock_release(&swap->swap_lock);
+
+    return found;
+}
+
+#if !OPT_SW_LIST
+/**
+ * It stores the page in a free entry of the swapfile for the given pid.
+*/
+static void store_element(vaddr_t vaddr, pid_t pid, paddr_t paddr){
+    int result;
+    struct iovec iov;
+    struct uio ku;
+    int i;
+
+    for(i=0;i<swap->size; i++){
+        if(swap->elements[i].pid==-1){//We search for a free entry
+
+            DEBUG(DB_VM,"SWAP: Loading from RAM %lu bytes from 0x%lx (offset in swapfile : 0x%lx)\n",(unsigned long) PAGE_SIZE, (unsigned long) paddr, (unsigned long) i*PAGE_SIZE);
+
+            swap->elements[i].pid=pid;
+            swap->elements[i].vaddr=vaddr;//We assign the empty entry found to the page that must be stored
+            
+            uio_kinit(&iov,&ku,(void*)PADDR_TO_KVADDR(paddr),PAGE_SIZE,i*PAGE_SIZE,UIO_WRITE);
+
+            result = VOP_WRITE(swap->v,&ku);//We write on the swapfile
+            if(result){
+                panic("VOP_WRITE in swapfile failed, with result=%d",result);
+            }
+
+            add_swap_writes();//Update statistics
+
+            occ++;
+
+            DEBUG(DB_VM,"Process %d wrote. Now occ=%d\n",curproc->p_pid,occ);
+            
+            return;
+        }
+    }
+
+    panic("The swapfile is full!");//If we didn't find any free entry the swapfile was full, and we panic
+}
+#endif
+
+int store_swap(vaddr_t vaddr, pid_t pid, paddr_t paddr, struct sharer *sharers){
+
+    #if OPT_SW_LIST
+
+    int result;
+    struct iovec iov;
+    struct uio ku;
+
+    struct swap_map *map=pid_map(pid);
+    struct swap_cell *free_frame, *cell, *shared=NULL;
+    struct sharer *s;
+    int slot, in_pool=0;
+
+    /**
+     * Again, due to parallelism we must take care of the order of the operations.
+     * At the beginning, we take a free page of the swapfile. However, we can't insert it in the swap map of the process after the I/O.
+     * In fact, if, while the store operation is going on, the process searches for this entry in the swap, it won't find it.
+     * Due to this, it'll load it from the ELF, but of course this is wrong and it will lead to problems.
+     * However, during the store operation we can't access the page, because it won't contain valid data. To solve this problem
+     * we introduce the store field, that will show if there's a store operation ongoing for that frame. 
+    */
+
+    /**
+     * If the frame was shared after a fork, all the sharers get a cell for the same page of the swapfile. We create the cells before
+     * taking swap_lock, since cell_create may need kmalloc. For the same reason, here we also grow the swap maps that will get a cell.
+    */
+    free_frame=cell_create(0);
+    map_fit(map,1);
+    for(s=sharers; s!=NULL; s=s->next){
+        cell=cell_create(0);
+        cell->shared_next=shared;
+        shared=cell;
+        map_fit(pid_map(s->pid),1);
+    }
+
+    spinlock_acquire(&swap->swap_lock);
+
+    #if OPT_SWAP_CACHE
+    if(swap->nfree==0){
+        spinlock_release(&swap->swap_lock); //reclaim_swap_cache needs pt_spinlock, that must be acquired before swap_lock
+        reclaim_swap_cache(); //The swapfile is full, but some entries may be just copies of clean pages that are in RAM
+        spinlock_acquire(&swap->swap_lock);
+    }
+    #endif
+
+    slot=slot_alloc(map,1); //Get a free page of the swapfile close to the other pages of the process
+    if(slot==-1){
+        panic("The swapfile is full!");//If we didn't find any free entry the swapfile was full, and we panic
+    }
+
+    free_frame->offset=slot*PAGE_SIZE;
+    free_frame->vaddr=vaddr; //We must set the correct address here and not after store
+    free_frame->store=1; //Set the store flag to 1
+    map_insert(map,free_frame); //The entry is visible to the process from now on
+    swap->refs[free_frame->offset/PAGE_SIZE]=1;
+
+    /**
+     * Also the cells of the sharers must be visible (with the store flag set) before the I/O, since they may try to load the page
+     * while we're writing it.
+    */
+    s=sharers;
+    for(cell=shared; cell!=NULL; cell=cell->shared_next){
+        KASSERT(s!=NULL);
+        cell->offset=free_frame->offset;
+        cell->vaddr=vaddr;
+        cell->store=1;
+        map_insert(pid_map(s->pid),cell);
+        swap->refs[free_frame->offset/PAGE_SIZE]++;
+        s=s->next;
+    }
+
+    spinlock_release(&swap->swap_lock);
+
+    #if OPT_DEBUG
+    print_list(pid);
+    #endif
+
+    DEBUG(DB_VM,"STORE SWAP in 0x%x (virtual: 0x%x) for process %d\n",free_frame->offset, free_frame->vaddr, pid);
+
+    #if OPT_ZSWAP
+    in_pool=pool_store(free_frame->offset/PAGE_SIZE,paddr); //The page is written to the swapfile only when it leaves the pool
+    #endif
+
+    if(!in_pool){
+        swap_seek(free_frame->offset,1);
+
+        uio_kinit(&iov,&ku,(void*)PADDR_TO_KVADDR(paddr),PAGE_SIZE,free_frame->offset,UIO_WRITE);
+
+        result = VOP_WRITE(swap->v,&ku);//We write on the swapfile
+        if(result){
+            panic("VOP_WRITE in swapfile failed, with result=%d",result);
         }
+
+        add_swap_writes();//Update statistics
     }
-    #endif
 
-    return 0;//We didn't find any entry, so we return 0
-}
+    lock_acquire(free_frame->cell_lock);
+    free_frame->store=0; //Clear the store flag
+    cv_broadcast(free_frame->cell_cv, free_frame->cell_lock); //Wake up the processes that were waiting for the store to be completed
+    lock_release(free_frame->cell_lock);
 
-int store_swap(vaddr_t vaddr, pid_t pid, paddr_t paddr){
+    for(cell=shared; cell!=NULL; cell=shared){ //The same for the sharers
+        shared=cell->shared_next;
+        cell->shared_next=NULL;
+        lock_acquire(cell->cell_lock);
+        cell->store=0;
+        cv_broadcast(cell->cell_cv, cell->cell_lock);
+        lock_release(cell->cell_lock);
+    }
 
-    int result;
-    struct iovec iov;
-    struct uio ku;
+    DEBUG(DB_VM,"ENDED STORE SWAP in 0x%x (virtual: 0x%x) for process %d\n",free_frame->offset, free_frame->vaddr, pid);
 
-    #if OPT_SW_LIST
+    DEBUG(DB_VM,"We added 0x%x to process %d\n",vaddr,pid);
 
-    struct addrspace *as=proc_getas();
-    struct swap_cell *free_frame;
-    int flag=0; //Used to understand if we tried to store an invalid address
+    #if OPT_DEBUG
+    print_list(pid);
+    #endif
 
-    /**
-     * Again, due to parallelism we must take care of the order of the operations.
-     * At the beginning, we take a free frame from the free list. However, we can't insert it in the process list after the I/O.
-     * In fact, if, while the store operation is going on, the process searches for this entry in the swap, it won't find it.
-     * Due to this, it'll load it from the ELF, but of course this is wrong and it will lead to problems.
-     * However, during the store operation we can't access the page, because it won't contain valid data. To solve this problem
-     * we introduce the store field, that will show if there's a store operation ongoing for that frame. 
-    */
+    return 1;
 
-    free_frame=swap->free; //Get a free frame from the free list
+    #else
+    struct sharer *s;
 
-    if(free_frame==NULL){
-        panic("The swapfile is full!");//If we didn't find any free entry the swapfile was full, and we panic
+    //Without the lists each process has its own copy of the page
+    store_element(vaddr,pid,paddr);
+    for(s=sharers; s!=NULL; s=s->next){
+        store_element(vaddr,s->pid,paddr);
     }
 
-    KASSERT(free_frame->store==0);
+    return 1;
 
-    swap->free = free_frame->next; //Update the free list
+    #endif
+}
 
-    //Identify the segment of the virtual address and perform an insertion on head
+#if OPT_SWAP_CLUSTER
+void store_swap_cluster(vaddr_t vaddr, pid_t pid, paddr_t *paddrs, int n){
+    struct swap_map *map=pid_map(pid);
+    struct swap_cell *cells[SWAP_CLUSTER_MAX];
+    struct iovec iov[SWAP_CLUSTER_MAX];
+    struct uio ku;
+    int first, result, last;
+    int pooled[SWAP_CLUSTER_MAX];
 
-    if(vaddr>=as->as_vbase1 && vaddr <= as->as_vbase1 + as->as_npages1 * PAGE_SIZE ){
-        free_frame->next=swap->text[pid];
-        swap->text[pid]=free_frame;
-        flag=1;
-    }
+    KASSERT(n>1 && n<=SWAP_CLUSTER_MAX);
 
-    if(vaddr>=as->as_vbase2 && vaddr <= as->as_vbase2 + as->as_npages2 * PAGE_SIZE ){
-        free_frame->next=swap->data[pid];
-        swap->data[pid]=free_frame;
-        flag=1;
+    map_fit(map,n);
+    for(int k=0; k<n; k++){ //cell_create may need kmalloc, so the cells are created before taking swap_lock
+        cells[k]=cell_create(0);
     }
 
-    if(vaddr <= USERSTACK && vaddr>as->as_vbase2 + as->as_npages2 * PAGE_SIZE){
-        free_frame->next=swap->stack[pid];
-        swap->stack[pid]=free_frame;
-        flag=1;
+    spinlock_acquire(&swap->swap_lock);
+    first=slot_alloc(map,n); //n adjacent pages, after the other pages of the process if possible
+    if(first==-1){
+        spinlock_release(&swap->swap_lock);
+        for(int k=0; k<n; k++){ //There are no n adjacent free pages (or the swapfile is full), so we write one page at a time
+            cell_destroy(cells[k]);
+            store_swap(vaddr+k*PAGE_SIZE,pid,paddrs[k],NULL);
+        }
+        return;
     }
 
-    if(flag==0){
-        panic("Wrong vaddr for store: 0x%x\n",vaddr);
+    /**
+     * As in store_swap, the cells are inserted in the swap map of the process (with the store flag set) before the I/O, so that a process
+     * that loads one of the pages waits for the end of the write instead of reading the ELF file.
+    */
+    for(int k=0; k<n; k++){
+        cells[k]->offset=(first+k)*PAGE_SIZE;
+        cells[k]->vaddr=vaddr+k*PAGE_SIZE;
+        cells[k]->store=1;
+        map_insert(map,cells[k]);
+        swap->refs[first+k]=1;
+
+        iov[k].iov_kbase=(void *)PADDR_TO_KVADDR(paddrs[k]); //The frames aren't contiguous, so each page has its own iovec
+        iov[k].iov_len=PAGE_SIZE;
+        pooled[k]=0;
     }
+    spinlock_release(&swap->swap_lock);
 
-    free_frame->vaddr=vaddr; //We must set the correct address here and not after store
+    DEBUG(DB_VM,"STORE SWAP CLUSTER of %d pages in 0x%x (virtual: 0x%x) for process %d\n",n,cells[0]->offset,vaddr,pid);
 
-    #if OPT_DEBUG
-    print_list(pid);
+    #if OPT_ZSWAP
+    for(int k=0; k<n; k++){
+        pooled[k]=pool_store(first+k,paddrs[k]);
+    }
     #endif
 
-    DEBUG(DB_VM,"STORE SWAP in 0x%x (virtual: 0x%x) for process %d\n",free_frame->offset, free_frame->vaddr, pid);
-
-    free_frame->store=1; //Set the store flag to 1
+    /**
+     * A single write for each run of adjacent pages that aren't in the compressed pool: without zswap (or if no page fits in the pool)
+     * it's a single write for the whole group.
+    */
+    for(int k=0; k<n; k=last){
+        last=k+1;
+        if(pooled[k]){
+            continue;
+        }
+        while(last<n && !pooled[last]){
+            last++;
+        }
 
-    uio_kinit(&iov,&ku,(void*)PADDR_TO_KVADDR(paddr),PAGE_SIZE,free_frame->offset,UIO_WRITE);
-    
-    result = VOP_WRITE(swap->v,&ku);//We write on the swapfile
-    if(result){
-        panic("VOP_WRITE in swapfile failed, with result=%d",result);
-    }
+        swap_seek(cells[k]->offset,last-k);
 
-    free_frame->store=0; //Clear the store flag
+        ku.uio_iov=iov+k;
+        ku.uio_iovcnt=last-k;
+        ku.uio_offset=cells[k]->offset;
+        ku.uio_resid=(last-k)*PAGE_SIZE;
+        ku.uio_segflg=UIO_SYSSPACE;
+        ku.uio_rw=UIO_WRITE;
+        ku.uio_space=NULL;
 
-    lock_acquire(free_frame->cell_lock);
-    cv_broadcast(free_frame->cell_cv, free_frame->cell_lock); //Wake up the processes that were waiting for the store to be completed
-    lock_release(free_frame->cell_lock);
+        result = VOP_WRITE(swap->v,&ku);
+        if(result){
+            panic("VOP_WRITE in swapfile failed, with result=%d",result);
+        }
 
-    DEBUG(DB_VM,"ENDED STORE SWAP in 0x%x (virtual: 0x%x) for process %d\n",free_frame->offset, free_frame->vaddr, pid);
+        add_swap_writes();//Update statistics. It counts the I/O operations, so a run is a single write
+        add_swap_cluster_stat(SWAP_CLUSTER_WRITES,1);
+        add_swap_cluster_stat(SWAP_CLUSTER_PAGES,last-k);
+    }
 
-    DEBUG(DB_VM,"We added 0x%x to process %d, that points to 0x%x\n",vaddr,pid,free_frame->next?free_frame->next->vaddr:0x0);
+    for(int k=0; k<n; k++){
+        lock_acquire(cells[k]->cell_lock);
+        cells[k]->store=0;
+        cv_broadcast(cells[k]->cell_cv, cells[k]->cell_lock);
+        lock_release(cells[k]->cell_lock);
+    }
+}
 
-    add_swap_writes();//Update statistics
+int swap_cluster_window(vaddr_t vaddr, pid_t pid, int max){
+    struct swap_map *map=pid_map(pid);
+    struct swap_cell *first, *cell;
+    int n=0;
 
-    #if OPT_DEBUG
-    print_list(pid);
+    spinlock_acquire(&swap->swap_lock);
+    first=map_lookup(map,vaddr);
+    #if OPT_ZSWAP
+    if(first!=NULL && zswap_contains(first->offset/PAGE_SIZE)){ //The page isn't read from the swapfile, so there's nothing to read around
+        first=NULL;
+    }
     #endif
+    if(first!=NULL && !first->store){
+        for(n=0; n<max; n++){
+            cell=map_lookup(map,vaddr+(n+1)*PAGE_SIZE);
+            if(cell==NULL || cell->store || cell->offset!=first->offset+(n+1)*PAGE_SIZE){
+                break;
+            }
+            #if OPT_ZSWAP
+            if(zswap_contains(cell->offset/PAGE_SIZE)){ //The window stops at the first page kept in the compressed pool
+                break;
+            }
+            #endif
+        }
+    }
+    spinlock_release(&swap->swap_lock);
 
-    return 1;
+    return n;
+}
 
-    #else
-    int i;
-    for(i=0;i<swap->size; i++){
-        if(swap->elements[i].pid==-1){//We search for a free entry
+int load_swap_pages(vaddr_t vaddr, pid_t pid, paddr_t *paddrs, int npages){
+    struct swap_map *map=pid_map(pid);
+    struct swap_cell *cells[SWAP_CLUSTER_MAX];
+    struct iovec iov[SWAP_CLUSTER_MAX];
+    struct uio ku;
+    int result;
 
-            DEBUG(DB_VM,"SWAP: Loading from RAM %lu bytes from 0x%lx (offset in swapfile : 0x%lx)\n",(unsigned long) PAGE_SIZE, (unsigned long) paddr, (unsigned long) i*PAGE_SIZE);
+    KASSERT(pid==curproc->p_pid);
+    KASSERT(npages>1 && npages<=SWAP_CLUSTER_MAX);
 
-            swap->elements[i].pid=pid;
-            swap->elements[i].vaddr=vaddr;//We assign the empty entry found to the page that must be stored
-            
-            uio_kinit(&iov,&ku,(void*)PADDR_TO_KVADDR(paddr),PAGE_SIZE,i*PAGE_SIZE,UIO_WRITE);
+    /**
+     * The pages were checked by swap_cluster_window, and they can't change in the meanwhile: they aren't in RAM, so nobody can store them,
+     * and only this process loads its pages. As in load_swap, without the swap cache the cells are removed from the swap map before the I/O
+     * and released after it.
+    */
+    spinlock_acquire(&swap->swap_lock);
+    for(int k=0; k<npages; k++){
+        cells[k]=map_lookup(map,vaddr+k*PAGE_SIZE);
+        KASSERT(cells[k]!=NULL && !cells[k]->store);
+        KASSERT(cells[k]->offset==cells[0]->offset+k*PAGE_SIZE);
+        #if !OPT_SWAP_CACHE
+        map_remove(map,cells[k]);
+        #endif
+        iov[k].iov_kbase=(void *)PADDR_TO_KVADDR(paddrs[k]);
+        iov[k].iov_len=PAGE_SIZE;
+    }
+    spinlock_release(&swap->swap_lock);
 
-            result = VOP_WRITE(swap->v,&ku);//We write on the swapfile
-            if(result){
-                panic("VOP_WRITE in swapfile failed, with result=%d",result);
-            }
+    DEBUG(DB_VM,"LOAD SWAP CLUSTER of %d pages in 0x%x (virtual: 0x%x) for process %d\n",npages,cells[0]->offset,vaddr,pid);
 
-            add_swap_writes();//Update statistics
+    add_pt_type_fault(DISK);//Update statistics. Only vaddr caused a page fault
+    swap_seek(cells[0]->offset,npages);
 
-            occ++;
+    ku.uio_iov=iov;
+    ku.uio_iovcnt=npages;
+    ku.uio_offset=cells[0]->offset;
+    ku.uio_resid=npages*PAGE_SIZE;
+    ku.uio_segflg=UIO_SYSSPACE;
+    ku.uio_rw=UIO_READ;
+    ku.uio_space=NULL;
 
-            DEBUG(DB_VM,"Process %d wrote. Now occ=%d\n",curproc->p_pid,occ);
-            
-            return 1;
-        }
+    result = VOP_READ(swap->v,&ku);
+    if(result){
+        panic("VOP_READ in swapfile failed, with result=%d",result);
     }
 
-    panic("The swapfile is full!");//If we didn't find any free entry the swapfile was full, and we panic
+    add_pt_type_fault(SWAPFILE);//Update statistics
+    add_swap_cluster_stat(SWAP_READAROUND_PAGES,npages-1);
+
+    #if OPT_SWAP_CACHE
+    return 2;//All the pages are still in the swapfile
+    #else
+    spinlock_acquire(&swap->swap_lock);
+    for(int k=0; k<npages; k++){
+        swap_put(cells[k]);
+    }
+    spinlock_release(&swap->swap_lock);
 
+    return 1;
     #endif
 }
+#endif
 
 int swap_init(void){
     int result;
     int i;
     char fname[9];
-    #if OPT_SW_LIST
-    struct swap_cell *tmp;
-    #endif
 
     strcpy(fname,"lhd0raw:");//As a swapfile, we use lhd0raw:
 
@@ -313,27 +1048,40 @@ int swap_init(void){
 	}
 
     swap->size = MAX_SIZE/PAGE_SIZE;//Number of pages in our swapfile
-
-    swap->kbuf = kmalloc(PAGE_SIZE); //Instead of allocating and freeing each time kbuf to perform swap copy, we just allocate it once
-    if(!swap->kbuf){
-        panic("Error during kbuf allocation");
-    }
+    spinlock_init(&swap->swap_lock);
 
     #if OPT_SW_LIST
-    swap->text = kmalloc(MAX_PROC*sizeof(struct swap_cell *)); //One entry for each process, so that each process can have its list
-    if(!swap->text){
-        panic("Error during text elements allocation");
+    swap->refs = kmalloc(swap->size*sizeof(int)); //Pages of the swapfile are shared after a fork, so we count their references
+    if(!swap->refs){
+        panic("Error during swap refs allocation");
     }
 
-    swap->data = kmalloc(MAX_PROC*sizeof(struct swap_cell *));
-    if(!swap->data){
-        panic("Error during data elements allocation");
+    swap->spare = NULL;
+
+    #if OPT_SLAB
+    cell_cache = slab_create("swap_cell", sizeof(struct swap_cell), cell_ctor, cell_dtor);
+    #endif
+
+    swap->freemap = kmalloc(DIVROUNDUP(swap->size,32)*sizeof(uint32_t)); //One bit for each page of the swapfile
+    if(!swap->freemap){
+        panic("Error during swap bitmap allocation");
+    }
+    for(i=0; i<DIVROUNDUP(swap->size,32); i++){
+        swap->freemap[i]=0; //The bits after the last page stay clear, so they're never free
     }
 
-    swap->stack = kmalloc(MAX_PROC*sizeof(struct swap_cell *));
-    if(!swap->stack){
-        panic("Error during stack elements allocation");
+    swap->nfree = 0;
+    swap->rotor = 0;
+    swap->head = 0;
+
+    #if OPT_ZSWAP
+    zswap_init(swap->size); //Before slot_give, that drops the pages from the pool
+    swap->wb_buf = kmalloc(PAGE_SIZE);
+    swap->wb_lock = lock_create("zswap_wb");
+    if(!swap->wb_buf || !swap->wb_lock){
+        panic("Error during zswap writeback buffer allocation");
     }
+    #endif
 
     #else
     swap->elements = kmalloc(swap->size*sizeof(struct swap_cell));
@@ -343,28 +1091,10 @@ int swap_init(void){
     }
     #endif
 
-    #if OPT_SW_LIST
-    for(i=0;i<MAX_PROC;i++){ //Initialize all the lists for each process
-        swap->text[i]=NULL;
-        swap->data[i]=NULL;
-        swap->stack[i]=NULL;
-    }
-    #endif
-
-    swap->free=NULL;
-
-    for(i=(int)(swap->size-1); i>=0; i--){//Create all the elements in the free list. We iterate in reverse order because we perform head insertion, and in this way the first free elements will have small offsets.
+    for(i=0; i<swap->size; i++){//All the pages of the swapfile are free. With the lists their cells are created only when they're used
         #if OPT_SW_LIST
-        tmp=kmalloc(sizeof(struct swap_cell));
-        if(!tmp){
-            panic("Error during swap elements allocation");
-        }
-        tmp->offset=i*PAGE_SIZE; //Offset within the swap file
-        tmp->store=0;
-        tmp->cell_cv = cv_create("cell_cv");
-        tmp->cell_lock = lock_create("cell_lock");
-        tmp->next=swap->free; //Insertion in the free list
-        swap->free=tmp;
+        swap->refs[i]=0;
+        slot_give(i);
         #else
         swap->elements[i].pid=-1;//We mark all the pages of the swapfile as free
         #endif
@@ -378,74 +1108,59 @@ int swap_init(void){
 static int r=0;
 #endif
 
-void remove_process_from_swap(pid_t pid){
-    #if OPT_SW_LIST
-    struct swap_cell *elem, *next;
-
-    //We iterate on text, data and stack lists to remove all the elements belonging to the ended process
+#if OPT_SW_LIST
+/**
+ * It releases all the cells of a list that has already been detached from its process.
+*/
+static void put_list(struct swap_cell *elem){
+    struct swap_cell *next;
 
-    if(swap->text[pid]!=NULL){
-        #if OPT_DEBUG
-        if(r==0){
-            DEBUG(DB_VM,"FIRST REMOVE PROCESS FROM SWAP\n");
-            r++;
+    for(; elem!=NULL; elem=next){
+        lock_acquire(elem->cell_lock);
+        while(elem->store){ //If there's a store operation ongoing, we wait for it to finish before releasing the page
+            cv_wait(elem->cell_cv,elem->cell_lock);
         }
-        #endif
-        for(elem=swap->text[pid];elem!=NULL;elem=next){
-            lock_acquire(elem->cell_lock);
-            while(elem->store){ //If there's a store operation ongoing, we wait for it to finish before inserting the page in the free list
-                cv_wait(elem->cell_cv,elem->cell_lock);
-            }
-            lock_release(elem->cell_lock);
+        lock_release(elem->cell_lock);
 
-            next=elem->next; //We save next to correctly initialize elem in the following iteration
-            elem->next=swap->free;
-            swap->free=elem;
-        }
-        swap->text[pid]=NULL;
+        next=elem->next; //We save next to correctly initialize elem in the following iteration
+        spinlock_acquire(&swap->swap_lock);
+        swap_put(elem); //The page of the swapfile becomes free if no other process shares it
+        spinlock_release(&swap->swap_lock);
     }
+}
 
-    if(swap->data[pid]!=NULL){
-        #if OPT_DEBUG
-        if(r==0){
-            DEBUG(DB_VM,"FIRST REMOVE PROCESS FROM SWAP\n");
-            r++;
-        }
-        #endif
-        for(elem=swap->data[pid];elem!=NULL;elem=next){
-            lock_acquire(elem->cell_lock);
-            while(elem->store){
-                cv_wait(elem->cell_cv,elem->cell_lock);
-            }
-            lock_release(elem->cell_lock);
+void swap_map_destroy(struct swap_map *map){
+    struct swap_cell *list;
 
-            next=elem->next;
-            elem->next=swap->free;
-            swap->free=elem;
-        }
-        swap->data[pid]=NULL;
-    }
+    spinlock_acquire(&swap->swap_lock);
+    list=map_detach(map);
+    spinlock_release(&swap->swap_lock);
 
-    if(swap->stack[pid]!=NULL){
-        #if OPT_DEBUG
-        if(r==0){
-            DEBUG(DB_VM,"FIRST REMOVE PROCESS FROM SWAP\n");
-            r++;
-        }
-        #endif
-        for(elem=swap->stack[pid];elem!=NULL;elem=next){
-            lock_acquire(elem->cell_lock);
-            while(elem->store){
-                cv_wait(elem->cell_cv,elem->cell_lock);
-            }
-            lock_release(elem->cell_lock);
+    put_list(list);
+    kfree(map->buckets);
+    kfree(map);
+}
+#endif
 
-            next=elem->next;
-            elem->next=swap->free;
-            swap->free=elem;
-        }
-        swap->stack[pid]=NULL;
+void remove_process_from_swap(pid_t pid){
+    #if OPT_SW_LIST
+    struct swap_map *map=pid_map(pid);
+    struct swap_cell *list;
+
+    //We detach all the cells of the swap map of the ended process, then we release them without holding swap_lock
+
+    spinlock_acquire(&swap->swap_lock);
+    list=map_detach(map);
+    spinlock_release(&swap->swap_lock);
+
+    #if OPT_DEBUG
+    if(r==0 && list!=NULL){
+        DEBUG(DB_VM,"FIRST REMOVE PROCESS FROM SWAP\n");
+        r++;
     }
+    #endif
+
+    put_list(list);
 
     #if OPT_DEBUG
     print_list(pid);
@@ -469,168 +1184,150 @@ void remove_process_from_swap(pid_t pid){
 static int n=0;
 #endif
 
-void copy_swap_pages(pid_t new_pid, pid_t old_pid){
-    DEBUG(DB_VM,"Process %d performs a kmalloc to fork %d\n",curproc->p_pid,new_pid);
-    struct uio u;
-    struct iovec iov;
-    int result;
-
+void reserve_swap_pages(pid_t new_pid, pid_t old_pid, struct swap_cell **pool){
     #if OPT_SW_LIST
-
-    struct swap_cell *ptr, *free=NULL;
-
-    //We access the three lists of the old process to copy all the entries into the lists of the new one
-    
-    if(swap->text[old_pid]!=NULL){
-
-        #if OPT_DEBUG
-        if(n==0){
-            DEBUG(DB_VM,"FIRST SWAP COPY FOR FORK\n");
-            n++;
-        }
-        #endif
-
-        for(ptr = swap->text[old_pid]; ptr!=NULL; ptr=ptr->next){
-
-            free = swap->free;
-
-            if(free==NULL){
-                panic("The swapfile is full!");//We don't have enough pages to perform the fork
-            }
-
-            swap->free = free->next;
-            free->next = swap->text[new_pid];
-            swap->text[new_pid] = free;
-
-
-            KASSERT(!free->store);
-
-            lock_acquire(ptr->cell_lock);
-            while(ptr->store){ //We wait for the store operation to end
-                cv_wait(ptr->cell_cv,ptr->cell_lock);
-            }
-            lock_release(ptr->cell_lock);
-
-            DEBUG(DB_VM,"Copying from 0x%x to 0x%x\n",ptr->offset,free->offset);
-
-            uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,ptr->offset,UIO_READ); //We read the page of the old process into kbuf (no race conditions on kbuf since we allow only one fork at a time)
-            result = VOP_READ(swap->v,&u);
-            if(result){
-                panic("VOP_READ in swapfile failed, with result=%d",result);
-            }
-
-            uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,free->offset,UIO_WRITE); //We write kbuf into the page of the new process
-            result = VOP_WRITE(swap->v,&u);
-            if(result){
-                panic("VOP_READ in swapfile failed, with result=%d",result);
+    struct swap_map *map=pid_map(old_pid);
+    struct swap_cell *ptr, *cell;
+    int n, npool=0;
+
+    spinlock_acquire(&swap->swap_lock);
+    for(unsigned b=0; b<map->nbuckets; b++){
+        for(ptr = map->buckets[b]; ptr!=NULL; ptr=ptr->next){
+            if(ptr->store){
+                /**
+                 * We wait for the store operation to end, otherwise the new process may load the page before it's written.
+                 * Cells are never freed, so ptr remains valid after releasing swap_lock, but the map may change: the caller will check again.
+                */
+                spinlock_release(&swap->swap_lock);
+                lock_acquire(ptr->cell_lock);
+                while(ptr->store){
+                    cv_wait(ptr->cell_cv,ptr->cell_lock);
+                }
+                lock_release(ptr->cell_lock);
+                return;
             }
-
-            DEBUG(DB_VM,"Copied text from 0x%x to 0x%x for process %d\n",ptr->vaddr,free->vaddr,new_pid);
-
-            free->vaddr = ptr->vaddr; //Set the correct vaddr (i.e. the same of the old page)
         }
     }
-    
-    if(swap->data[old_pid]!=NULL){
-
-        #if OPT_DEBUG
-        if(n==0){
-            DEBUG(DB_VM,"FIRST SWAP COPY FOR FORK\n");
-            n++;
-        }
-        #endif
-
-        for(ptr = swap->data[old_pid]; ptr!=NULL; ptr=ptr->next){
-
-            free = swap->free;
+    n=map->count;
+    spinlock_release(&swap->swap_lock);
 
-            if(free==NULL){
-                panic("The swapfile is full!");//We don't have enough pages to perform the fork
-            }
+    map_fit(pid_map(new_pid),n); //copy_swap_pages inserts the cells holding swap_lock, so the map of the new process can't grow there
 
-            swap->free = free->next;
-            free->next = swap->data[new_pid];
-            swap->data[new_pid] = free;
+    for(cell=*pool; cell!=NULL; cell=cell->next){
+        npool++;
+    }
 
-            KASSERT(!free->store);
+    for(; npool<n; npool++){ //kmalloc may sleep, so the caller will have to check again
+        cell = cell_create(0);
+        cell->next = *pool;
+        *pool = cell;
+    }
 
-            lock_acquire(ptr->cell_lock);
-            while(ptr->store){
-                cv_wait(ptr->cell_cv,ptr->cell_lock);
-            }
-            lock_release(ptr->cell_lock);
+    #else
+    (void)new_pid;
+    (void)old_pid;
+    (void)pool;
+    #endif
+}
 
-            DEBUG(DB_VM,"Copying from 0x%x to 0x%x\n",ptr->offset,free->offset);
+int swap_pages_ready(pid_t old_pid, struct swap_cell *pool){
+    #if OPT_SW_LIST
+    struct swap_map *map=pid_map(old_pid);
+    struct swap_cell *ptr;
+    unsigned npool=0;
 
-            uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,ptr->offset,UIO_READ);
-            result = VOP_READ(swap->v,&u);
-            if(result){
-                panic("VOP_READ in swapfile failed, with result=%d",result);
-            }
+    KASSERT(spinlock_do_i_hold(&swap->swap_lock));
 
-            uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,free->offset,UIO_WRITE);
-            result = VOP_WRITE(swap->v,&u);
-            if(result){
-                panic("VOP_READ in swapfile failed, with result=%d",result);
+    for(unsigned b=0; b<map->nbuckets; b++){
+        for(ptr = map->buckets[b]; ptr!=NULL; ptr=ptr->next){
+            if(ptr->store){
+                return 0;
             }
-
-            DEBUG(DB_VM,"Copied data from 0x%x to 0x%x for process %d\n",ptr->vaddr,free->vaddr,new_pid);
-
-            free->vaddr = ptr->vaddr;
         }
     }
+    for(; pool!=NULL; pool=pool->next){
+        npool++;
+    }
 
-    if(swap->stack[old_pid]!=NULL){
+    return npool >= map->count;
 
-        #if OPT_DEBUG
-        if(n==0){
-            DEBUG(DB_VM,"FIRST SWAP COPY FOR FORK\n");
-            n++;
-        }
-        #endif
+    #else
+    (void)old_pid;
+    (void)pool;
+    return 1;
+    #endif
+}
 
-        for(ptr = swap->stack[old_pid]; ptr!=NULL; ptr=ptr->next){
+void swap_lock_acquire(void){
+    spinlock_acquire(&swap->swap_lock);
+}
 
-            free = swap->free;
+void swap_lock_release(void){
+    spinlock_release(&swap->swap_lock);
+}
 
-            if(free==NULL){
-                panic("The swapfile is full!");//We don't have enough pages to perform the fork
-            }
+void release_swap_pool(struct swap_cell *pool){
+    #if OPT_SW_LIST
+    struct swap_cell *next;
 
-            swap->free = free->next;
-            free->next = swap->stack[new_pid];
-            swap->stack[new_pid] = free;
+    for(; pool!=NULL; pool=next){ //We don't hold swap_lock, so we can free them
+        next=pool->next;
+        cell_destroy(pool);
+    }
+    #else
+    (void)pool;
+    #endif
+}
 
-            KASSERT(!free->store);
+void copy_swap_pages(pid_t new_pid, pid_t old_pid, struct swap_cell **pool){
+    DEBUG(DB_VM,"Process %d performs a kmalloc to fork %d\n",curproc->p_pid,new_pid);
 
-            lock_acquire(ptr->cell_lock);
-            while(ptr->store){
-                cv_wait(ptr->cell_cv,ptr->cell_lock);
-            }
-            lock_release(ptr->cell_lock);
+    #if OPT_SW_LIST
 
-            DEBUG(DB_VM,"Copying from 0x%x to 0x%x\n",ptr->offset,free->offset);
+    struct swap_map *old_map=pid_map(old_pid), *new_map=pid_map(new_pid);
+    struct swap_cell *ptr, *cell;
 
-            uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,ptr->offset,UIO_READ);
-            result = VOP_READ(swap->v,&u);
-            if(result){
-                panic("VOP_READ in swapfile failed, with result=%d",result);
-            }
+    /**
+     * We access the swap map of the old process to share all the entries with the new one. No page is read or written: the new process
+     * gets a cell that points to the same page of the swapfile, and the page is copied in RAM only when one of the processes loads it.
+     * The cells come from the pool filled by reserve_swap_pages and we hold swap_lock, so we never sleep and the maps can't change while we walk them.
+    */
+    for(unsigned b=0; b<old_map->nbuckets; b++){
+        for(ptr = old_map->buckets[b]; ptr!=NULL; ptr=ptr->next){
 
-            uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,free->offset,UIO_WRITE);
-            result = VOP_WRITE(swap->v,&u);
-            if(result){
-                panic("VOP_READ in swapfile failed, with result=%d",result);
+            #if OPT_DEBUG
+            if(n==0){
+                DEBUG(DB_VM,"FIRST SWAP COPY FOR FORK\n");
+                n++;
             }
+            #endif
 
-            DEBUG(DB_VM,"Copied stack from 0x%x to 0x%x for process %d\n",ptr->vaddr,free->vaddr,new_pid);
+            KASSERT(!ptr->store); //swap_pages_ready checked that there are no stores in progress
+            KASSERT(*pool!=NULL);
+            cell = *pool;
+            *pool = cell->next;
+            cell->offset = ptr->offset; //Same page of the swapfile
+            cell->vaddr = ptr->vaddr; //Set the correct vaddr (i.e. the same of the old page)
+            swap->refs[ptr->offset/PAGE_SIZE]++;
+            map_insert(new_map, cell);
 
-            free->vaddr = ptr->vaddr;
+            DEBUG(DB_VM,"Shared 0x%x (offset 0x%x) with process %d\n",ptr->vaddr,ptr->offset,new_pid);
         }
     }
 
     #else
+    struct uio u;
+    struct iovec iov;
+    int result;
     int i,j;
+    void *kbuf;
+
+    (void)pool;
+
+    kbuf = kmalloc(PAGE_SIZE); //Each fork has its own buffer, so that more forks can copy pages at the same time
+    if(!kbuf){
+        panic("Error during kbuf allocation");
+    }
 
     for(i=0;i<swap->size;i++){
         if(swap->elements[i].pid==old_pid){
@@ -640,13 +1337,13 @@ void copy_swap_pages(pid_t new_pid, pid_t old_pid){
                     swap->elements[j].pid=new_pid;
                     swap->elements[j].vaddr=swap->elements[i].vaddr;//We assign the empty entry found to the page that must be stored
                     
-                    uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,i*PAGE_SIZE,UIO_READ);
+                    uio_kinit(&iov,&u,kbuf,PAGE_SIZE,i*PAGE_SIZE,UIO_READ);
                     result = VOP_READ(swap->v,&u);//We perform the read
                     if(result){
                         panic("VOP_READ in swapfile failed, with result=%d",result);
                     }
 
-                    uio_kinit(&iov,&u,swap->kbuf,PAGE_SIZE,j*PAGE_SIZE,UIO_WRITE);
+                    uio_kinit(&iov,&u,kbuf,PAGE_SIZE,j*PAGE_SIZE,UIO_WRITE);
                     result = VOP_WRITE(swap->v,&u);
                     if(result){
                         panic("VOP_READ in swapfile failed, with result=%d",result);
@@ -664,15 +1361,47 @@ void copy_swap_pages(pid_t new_pid, pid_t old_pid){
         }
     }
 
+    kfree(kbuf);
+
     #endif
 
 }
 
 void reorder_swapfile(void){
-    struct swap_cell *tmp=swap->free;
+    #if OPT_SW_LIST
+    spinlock_acquire(&swap->swap_lock);
+    if(swap->nfree==swap->size){ //Other processes may still run in background: in that case we leave the rotor where it is
+        swap->rotor=0; //The next extent will start at offset 0
+    }
+    spinlock_release(&swap->swap_lock);
+    #endif
+}
+
+#if OPT_SW_LIST
+void swap_print_stats(void){
+    int slot, run=0, extents=0, largest=0, nfree;
 
-    for(int i=0; i<swap->size; i++){//We start with i=0 so that the first free frame has offset=0
-        tmp->offset=i*PAGE_SIZE;
-        tmp=tmp->next;
+    spinlock_acquire(&swap->swap_lock);
+    for(slot=0; slot<=swap->size; slot++){
+        if(slot<swap->size && slot_isfree(slot)){
+            run++;
+            continue;
+        }
+        if(run>0){ //A free extent ended at slot
+            extents++;
+            if(run>largest){
+                largest=run;
+            }
+        }
+        run=0;
     }
-}
\ No newline at end of file
+    nfree=swap->nfree;
+    spinlock_release(&swap->swap_lock);
+
+    kprintf("Swapfile: %d free pages of %d\tFree extents = %d\tLargest free extent = %d pages\tFragmentation = %d%%\n",
+            nfree, swap->size, extents, largest, nfree ? 100-largest*100/nfree : 0);
+    #if OPT_ZSWAP
+    zswap_print_stats();
+    #endif
+}
+#endif
\ No newline at end of file
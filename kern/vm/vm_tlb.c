@@ -3,9 +3,15 @@
 #include "mips/tlb.h"
 #include "pt.h"
 #include "spl.h"
+#include "cpu.h"
+#include "current.h"
 #include "addrspace.h"
+#include "clock.h"
 #include "opt-dumbvm.h"
 #include "opt-test.h"
+#include "opt-tlb_random.h"
+#include "opt-tlb_nru.h"
+#include "opt-tlb_hot.h"
 /*
  * vm.h includes the definition of vm_fault, which is used to handle the
  * TLB misses
@@ -13,7 +19,24 @@
 #include "vm.h"
 #include "vmstats.h"
 
+static struct tlb shadow[MAXCPUS]; // software shadow of the TLB of each CPU, indexed by c_number
 
+/**
+ * This function returns the shadow of the TLB of the current CPU. The interrupts must be disabled, otherwise the thread may be moved
+ * to another CPU while it's using the shadow.
+*/
+static struct tlb *cur_shadow(void){
+    KASSERT(curthread->t_iplhigh_count > 0);
+    return &shadow[curcpu->c_number];
+}
+
+#if OPT_TLB_RANDOM + OPT_TLB_NRU + OPT_TLB_HOT > 1
+#error "Only one TLB replacement policy (tlb_random, tlb_nru, tlb_hot) can be selected"
+#endif
+
+#if OPT_UTLB_REFILL && (OPT_TLB_RANDOM || OPT_TLB_NRU || OPT_TLB_HOT)
+#error "utlb_refill chooses the slot of each entry by itself, so it can't be used with tlb_random, tlb_nru or tlb_hot"
+#endif
 
 /*not needed anymore, we leave it here in case we want it to be a wrapper for the mips instruction TLB_INVALIDATE*/
 int tlb_remove(void){
@@ -29,13 +52,14 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
     #endif
 
     DEBUG(DB_VM,"\nfault address: 0x%x\n",faultaddress);
-    int spl = splhigh(); // so that the control does not pass to another waiting process.
+    /*Interrupts stay enabled: the IPT and the swapfile are protected by their own spinlocks, and the TLB and its shadow are only accessed
+    with the interrupts disabled for a few instructions, so faults on different pages can proceed while another one waits for the disk*/
     paddr_t paddr;
+    int index, reload;
+    struct timespec start, end;
   
     faultaddress &= PAGE_FRAME; // I extract the address of the frame that caused the fault (it was not in the TLB)
 
-    /*I update the statistics*/
-    add_tlb_fault();
     /*I extract the virtual address of the corresponding page*/
     switch (faulttype)
     {
@@ -49,37 +73,301 @@ int vm_fault(int faulttype, vaddr_t faultaddress){
         Therefore, if the process tries to modify a RO segment, the process has to be ended by means of the 
         appropriate system call (no need to panic)*/
     case VM_FAULT_READONLY:
-        kprintf("You tried to write a readonly segment... The process is ending...");
-        sys__exit(0);
-        break;
+        if(segment_is_readonly(faultaddress)){
+            kprintf("You tried to write a readonly segment... The process is ending...");
+            sys__exit(0);
+        }
+        /*Otherwise it's the first write on a clean or shared page, that was inserted in the TLB without write privilege. The page is already
+        in the TLB, so it's not a TLB fault: we just mark it as dirty (copying it if it's shared) and make the entry writable*/
+        add_dirty_stat(DIRTY_FAULT);
+        tlb_set_dirty(faultaddress);
+        return 0;
     
     default:
         break;
     }
     /*If I am here is either a VM_FAULT_READ or a VM_FAULT_WRITE*/
+    #if OPT_TLB_NRU
+    if(tlb_sampled_access(faultaddress)){
+        /*The page is still in the TLB: its entry had only been disabled by tlb_victim to sample its access bit. It's not a TLB fault*/
+        return 0;
+    }
+    #endif
     /*was the address space set up correctly?*/
     KASSERT(as_is_ok() == 1);
+    /*I update the statistics*/
+    add_tlb_fault();
    /*If the address space was set up correctly, I ask the Page table for the virtual address address of the frame that is not present in the TLB*/
-    paddr = get_page(faultaddress);
+    gettime(&start); // used to measure the latency of the TLB reloads and of the page faults
+    paddr = get_page(faultaddress, &reload);
+    index = (paddr - peps.firstfreepaddr) / PAGE_SIZE;
+    if(faulttype == VM_FAULT_WRITE && !segment_is_readonly(faultaddress) && !is_shared(index)){
+        /*The page is going to be written, so we mark it as dirty now to avoid a second trap*/
+        set_dirty_bit(index);
+    }
     /*Now that I have the address, I can insert it into the TLB */
     tlb_insert(faultaddress, paddr);
-    splx(spl);
+    gettime(&end);
+    timespec_sub(&end, &start, &end);
+    if(reload){
+        add_tsb_stat(RELOAD_LATENCY, end.tv_sec * 1000000000 + end.tv_nsec);
+    }
+    else{
+        add_pageout_stat(FAULT_LATENCY, end.tv_sec * 1000000000 + end.tv_nsec); //Page faults wait for the disk or for a victim, so the free frames of the pageout daemon make them faster
+    }
+    if(faulttype == VM_FAULT_WRITE && !segment_is_readonly(faultaddress) && is_shared(index)){
+        /*The page is shared with other processes, so it was inserted without write privilege. We copy it now to avoid a second trap*/
+        tlb_set_dirty(faultaddress);
+    }
     return 0;
 }
 #endif 
 
+#if OPT_TLB_NRU
 /**
- * This function chooses the entry to sacrifice in the TLB and returns its index.
+ * This function disables the given slot without removing it from the TLB (and from the shadow), so that the next access to its page
+ * causes a TLB fault that tells us that the page has been used (see tlb_sampled_access). The MIPS TLB has no access bit, so this is
+ * how we sample it.
 */
-int tlb_victim(void){
-    /*I chose the entry to invalidate by means of a RR strategy*/
+static void tlb_sample_slot(int entry){
+    uint32_t hi, lo;
+    tlb_read(&hi, &lo, entry);
+    tlb_write(hi, lo & ~TLBLO_VALID, entry);
+}
+
+/**
+ * This function is called by vm_fault before handling a TLB fault. If the page is in the TLB but its entry was disabled by
+ * tlb_sample_slot, it enables it again and marks it as referenced.
+ * 
+ * @return 1 if the page was in the TLB, 0 if the fault must be handled
+*/
+int tlb_sampled_access(vaddr_t faultvaddr){
+    int entry, spl, found = 0;
+    uint32_t hi, lo;
+    struct addrspace *as = proc_getas();
+    struct tlb *sh;
+
+    if(as == NULL){
+        return 0; // vm_fault will handle it
+    }
+    spl = splhigh();
+    sh = cur_shadow();
+    hi = faultvaddr | (as->asid[curcpu->c_number] << TLBHI_PID_SHIFT);
+    entry = tlb_probe(hi, 0);
+    if(entry >= 0 && sh->ipt_index[entry] != -1){
+        tlb_read(&hi, &lo, entry);
+        if(!(lo & TLBLO_VALID)){
+            tlb_write(hi, lo | TLBLO_VALID, entry);
+            sh->ref[entry] = 1;
+            add_tlb_policy_stat(TLB_POLICY_SAMPLED);
+            found = 1;
+        }
+    }
+    splx(spl);
+    return found;
+}
+#endif
+
+/**
+ * This function chooses the entry to sacrifice in the TLB and returns its index. It's called only when all the slots are valid.
+ * The policy is selected with the kernel options:
+ * - tlb_random: the slot is chosen by the hardware (tlb_random), so it returns -1 and the caller must write the entry with tlb_random.
+ * - tlb_nru: not recently used. A clock hand visits the slots: a slot referenced since the last visit is disabled with tlb_sample_slot
+ *   and spared, while a slot that hasn't been referenced since it was disabled is the victim.
+ * - tlb_hot: round robin, but the slots that map text or stack pages (the pages that are used during the whole execution) are spared,
+ *   unless all the slots map them.
+ * - otherwise, round robin.
+*/
+int tlb_victim(struct tlb *sh){
     int victim;
-    static unsigned int next_victim = 0;
-    victim = next_victim;
-    next_victim = (next_victim + 1) % NUM_TLB;
+    #if OPT_TLB_RANDOM
+    (void)sh;
+    victim = -1;
+    #elif OPT_TLB_NRU
+    for(int n = 0; n <= NUM_TLB; n++){ // after a full round all the slots are disabled, so the loop ends
+        victim = sh->hand;
+        sh->hand = (sh->hand + 1) % NUM_TLB;
+        if(!sh->ref[victim]){
+            break;
+        }
+        sh->ref[victim] = 0;
+        tlb_sample_slot(victim);
+        add_tlb_policy_stat(TLB_POLICY_SPARED);
+    }
+    #elif OPT_TLB_HOT
+    for(int n = 0; n < NUM_TLB; n++){
+        victim = sh->hand;
+        sh->hand = (sh->hand + 1) % NUM_TLB;
+        if(!sh->hot[victim]){
+            break;
+        }
+        add_tlb_policy_stat(TLB_POLICY_SPARED); // if all the slots are hot, the last one visited is the victim (round robin)
+    }
+    #else
+    /*I chose the entry to invalidate by means of a RR strategy*/
+    victim = sh->hand;
+    sh->hand = (sh->hand + 1) % NUM_TLB;
+    #endif
     return victim;   
 }
 
+/**
+ * This function tells if a page is used during the whole execution of the process (text or stack), so that tlb_hot keeps it in the TLB.
+*/
+static int tlb_page_is_hot(vaddr_t vaddr){
+    struct addrspace *as = proc_getas();
+    if(segment_is_readonly(vaddr)){
+        return 1;
+    }
+    return vaddr >= as->as_vbase2 + as->as_npages2 * PAGE_SIZE && vaddr < USERSTACK; // the stack is above the data segment
+}
+
+/**
+ * This function informs the IPT that the given slot doesn't map its frame anymore, and it marks the slot as invalid in the shadow.
+ * The slot itself must be overwritten by the caller. The IPT sets the reference bit of the frame only if the slot was referenced:
+ * with tlb_nru we know it, while with the other policies we consider every slot referenced.
+ * With utlb_refill the frames are kept in the TLB by the refill table, not by the slots, so the IPT isn't informed.
+*/
+static void tlb_release_slot(struct tlb *sh, int entry){
+    KASSERT(sh->ipt_index[entry] != -1);
+    #if !OPT_UTLB_REFILL
+    update_tlb_bit(sh->ipt_index[entry], sh->ref[entry]);
+    #endif
+    sh->ipt_index[entry] = -1;
+}
+
+/**
+ * This function records a replaced page among the last victims of the CPU. If the page is needed again soon, the next TLB fault
+ * will be counted as a miss of the replacement policy.
+*/
+static void tlb_record_victim(struct tlb *sh, vaddr_t vaddr, pid_t pid){
+    sh->victim_vaddr[sh->next_recent] = vaddr;
+    sh->victim_pid[sh->next_recent] = pid;
+    sh->next_recent = (sh->next_recent + 1) % TLB_RECENT_VICTIMS;
+    add_tlb_policy_stat(TLB_POLICY_VICTIMS);
+}
+
+/**
+ * This function releases a slot chosen by tlb_victim, recording its page among the last victims of the CPU. With utlb_refill the page
+ * stays in the refill table, so it isn't a victim: only tlb_make_resident replaces pages.
+*/
+static void tlb_replace_slot(struct tlb *sh, int entry){
+    #if !OPT_UTLB_REFILL
+    tlb_record_victim(sh, sh->vaddr[entry], sh->pid[entry]);
+    #endif
+    tlb_release_slot(sh, entry);
+}
+
+
+/**
+ * This function writes a new entry in the given slot (or in a slot chosen by the hardware, if it's -1) and records it in the shadow.
+*/
+static void tlb_fill_slot(struct tlb *sh, int entry, uint32_t hi, uint32_t lo, int index, int hot){
+    if(entry < 0){
+        tlb_random(hi, lo);
+        entry = tlb_probe(hi, 0); // the shadow must know which slot the hardware replaced
+        KASSERT(entry >= 0);
+        tlb_replace_slot(sh, entry);
+    }
+    else{
+        tlb_write(hi, lo, entry);
+    }
+    sh->ipt_index[entry] = index;
+    sh->pid[entry] = curproc->p_pid;
+    sh->vaddr[entry] = hi & TLBHI_VPAGE;
+    sh->ref[entry] = 1; // the page is going to be accessed
+    sh->hot[entry] = hot;
+}
+
+/**
+ * This function is called on each TLB fault: if the page is one of the last victims of the CPU, the replacement policy chose an entry
+ * that was still needed.
+*/
+static void tlb_check_refault(struct tlb *sh, vaddr_t vaddr, pid_t pid){
+    for(int i = 0; i<TLB_RECENT_VICTIMS; i++){
+        if(sh->victim_vaddr[i] == vaddr && sh->victim_pid[i] == pid){
+            add_tlb_policy_stat(TLB_POLICY_REFAULTS);
+            sh->victim_vaddr[i] = 0;
+            return;
+        }
+    }
+}
+
+/**
+ * This function invalidates a valid slot: it informs the IPT that the slot doesn't map its frame anymore, it overwrites the slot and
+ * it pushes it in the stack of the free slots.
+*/
+static void tlb_drop_slot(struct tlb *sh, int entry){
+    tlb_release_slot(sh, entry);
+    tlb_write(TLBHI_INVALID(entry), TLBLO_INVALID(), entry); // I override the entry
+    sh->free_slots[sh->nfree++] = entry;
+}
+
+/**
+ * This function returns a slot where a new entry can be written. It's a free slot if there's one, otherwise the victim chosen
+ * by tlb_victim (that is released). The UTLB handler chooses the slots in the same way.
+ * It returns 1 if a replacement was needed, 0 otherwise.
+*/
+static int tlb_take_slot(struct tlb *sh, int *entry){
+    /*step 1: look for a free entry in the shadow*/
+    if(sh->nfree > 0){
+        *entry = sh->free_slots[--sh->nfree];
+        KASSERT(sh->ipt_index[*entry] == -1);
+        return 0;
+    }
+    /*step 2: I have not found an invalid entry. so... look for a victim*/
+    *entry = tlb_victim(sh);
+    if(*entry >= 0){
+        /*notify the pt that the page mapped by the victim is not in tlb anymore. The shadow tells us directly its IPT entry.
+        With tlb_random the slot is known only after the write, so tlb_fill_slot does it*/
+        tlb_replace_slot(sh, *entry);
+    }
+    return 1;
+}
+
+#if OPT_UTLB_REFILL
+/**
+ * This function removes the page resident in the given set of the refill table, and its slot if it's in the TLB, informing the IPT
+ * that its frame is not in the TLB anymore.
+*/
+static void tlb_drop_resident(struct tlb *sh, int set){
+    int entry;
+
+    KASSERT(sh->refill_hi[set] != 0);
+    entry = tlb_probe(sh->refill_hi[set], 0);
+    if(entry >= 0){
+        tlb_drop_slot(sh, entry);
+    }
+    update_tlb_bit(sh->refill_ipt[set], 1); // the UTLB handler doesn't tell us if the page was referenced, so we consider it referenced
+    sh->refill_hi[set] = 0;
+}
+
+/**
+ * This function makes the page hi resident on this CPU: it writes it in the refill table, replacing the page of its set, and in a slot
+ * of the TLB. The IPT already considers the frame index in the TLB.
+ * It returns 1 if a replacement was needed, 0 otherwise.
+*/
+static int tlb_make_resident(struct tlb *sh, uint32_t hi, uint32_t lo, int index, int hot){
+    int entry, set = UTLB_SET(hi), replaced = 0;
+
+    if(sh->refill_hi[set] != 0){
+        if(sh->refill_hi[set] != hi){
+            tlb_record_victim(sh, sh->refill_hi[set] & TLBHI_VPAGE, sh->refill_pid[set]);
+            replaced = 1;
+        }
+        tlb_drop_resident(sh, set); // if it's the same page (e.g. it maps the frame before a copy), it holds the frame of the old entry
+    }
+    KASSERT(tlb_probe(hi, 0) < 0); // each slot maps a resident page
+    replaced |= tlb_take_slot(sh, &entry);
+    tlb_fill_slot(sh, entry, hi, lo, index, hot);
+    sh->refill_hi[set] = hi;
+    sh->refill_lo[set] = lo;
+    sh->refill_ipt[set] = index;
+    sh->refill_pid[set] = curproc->p_pid;
+    return replaced;
+}
+#endif
+
 /**
  * This function determines if the frame is readonly
 */
@@ -105,52 +393,132 @@ int segment_is_readonly(vaddr_t vaddr){
 int tlb_insert(vaddr_t faultvaddr, paddr_t faultpaddr){
     /*faultpaddr is the address of the beginning of the physical frame, so I have to remember that I do not have to 
     pass the whole address but I have to mask the least significant 12 bits*/
-    int entry, valid, is_RO; 
-    uint32_t hi, lo, prevHi, prevLo;
+    int is_RO, index, spl, hot; 
+    #if !OPT_UTLB_REFILL
+    int entry;
+    #endif
+    uint32_t hi, lo;
+    struct addrspace *as = proc_getas();
+    struct tlb *sh;
     is_RO = segment_is_readonly(faultvaddr); // boolean that tells me if the address is read_only and therefore the dirty bit has to be set
-    
-    /*step 1: look for a free entry and update the corresponding statistic (FREE)*/
-    for(entry = 0; entry <NUM_TLB; entry++){
-        valid = tlb_entry_is_valid(entry);
-        if(!valid){
-            /*I can write the fault address here!*/
-                hi = faultvaddr;
-                lo = faultpaddr | TLBLO_VALID;
-                /*is the segment a text segment?*/
-               if(!is_RO){
-                    /*I have to set a dirty bit (that is basically a write privilege)*/
-                    lo = lo | TLBLO_DIRTY; 
-                }
-                tlb_write(hi, lo, entry);
-            /*update the statistic "tlb fault free"*/
-            add_tlb_type_fault(FAULT_W_FREE); //do I have to add the general faults as well or do I do it earlier?
-            /*return*/
-            return 0;
-        }
-
-    }
-    /*step 2: I have not found an invalid entry. so... look for a victim, overwrite and update the correspnding statistic (REPLACE)*/
-    entry = tlb_victim();
-    hi = faultvaddr;
     lo = faultpaddr | TLBLO_VALID; //the entry has to be set as valid
-    /*is the segment a text segment?*/
-    if(!is_RO){
-        /*I have to set a dirty bit that is basically a write privilege*/
+    index = (faultpaddr - peps.firstfreepaddr) / PAGE_SIZE;
+    /*is the segment a text segment? If not, has the page already been written? Is it private to the process?*/
+    if(!is_RO && get_dirty_bit(index) && !is_shared(index)){
+        /*I have to set a dirty bit (that is basically a write privilege). If the page is clean we don't set it, so that the
+        first write will cause a VM_FAULT_READONLY and we'll know that the page must be saved in the swapfile when it's evicted.
+        The same holds for a page shared after a fork, that must be copied before the first write*/
         lo = lo | TLBLO_DIRTY; 
     }
-    /*before overwriting the entry, I have to save the current content somewhere so that I can notify the page table of the replacement. The page
-    table, indeed, keeps trace of its entries that are cached (in the TLB)*/
-    tlb_read(&prevHi, &prevLo, entry);
-    /*notify the pt that the entry with that virtual address is not in tlb anymore*/
-    update_tlb_bit(prevHi, curproc->p_pid);
-    /*Now I can overwrite the content*/
-    tlb_write(hi, lo, entry);
-    /*update tlb faults replace*/
-    add_tlb_type_fault(FAULT_W_REPLACE);
+    hot = tlb_page_is_hot(faultvaddr);
+
+    /*Look for a free entry or a victim, overwrite and update the corresponding statistic (FREE or REPLACE).
+    The TLB and its shadow must be changed together, so we disable the interrupts only here. This also keeps us on the same CPU*/
+    spl = splhigh();
+    sh = cur_shadow();
+    hi = faultvaddr | (as->asid[curcpu->c_number] << TLBHI_PID_SHIFT); // the entry is tagged with the ASID of the process on this CPU
+    tlb_check_refault(sh, faultvaddr, curproc->p_pid);
+    #if OPT_UTLB_REFILL
+    /*If the page is still resident (e.g. we were moved here after the fault), tlb_make_resident replaces its entry*/
+    if(tlb_make_resident(sh, hi, lo, index, hot)){
+        add_tlb_type_fault(FAULT_W_REPLACE);
+    }
+    else{
+        add_tlb_type_fault(FAULT_W_FREE);
+    }
+    #else
+    entry = tlb_probe(hi, 0);
+    if(entry >= 0){
+        /*The page is already in the TLB of this CPU (e.g. a disabled entry of tlb_nru, or we were moved here after the fault). Two entries
+        with the same page must never be in the TLB, so we overwrite it*/
+        tlb_release_slot(sh, entry);
+        add_tlb_type_fault(FAULT_W_FREE);
+    }
+    else if(tlb_take_slot(sh, &entry)){
+        add_tlb_type_fault(FAULT_W_REPLACE);
+    }
+    else{
+        add_tlb_type_fault(FAULT_W_FREE);
+    }
+    tlb_fill_slot(sh, entry, hi, lo, index, hot);
+    #endif
+    as->tlb_cpus |= (uint32_t)1 << curcpu->c_number; // the entries of the process must be invalidated on this CPU too when it ends or forks
+    splx(spl);
     return 0;
 
 }
 
+/**
+ * This function handles the first write on a clean or shared page. The page is marked as dirty in the IPT and its entry in the TLB
+ * becomes writable. If the page is shared with other processes, the IPT gives us a private copy and the entry is redirected to it.
+*/
+void tlb_set_dirty(vaddr_t faultvaddr){
+    int entry, index, spl;
+    uint32_t hi, lo;
+    paddr_t paddr;
+    struct addrspace *as = proc_getas();
+    struct tlb *sh;
+
+    spl = splhigh();
+    sh = cur_shadow();
+    hi = faultvaddr | (as->asid[curcpu->c_number] << TLBHI_PID_SHIFT);
+    entry = tlb_probe(hi, 0);
+    if(entry < 0){
+        /*The entry was removed before we disabled the interrupts (e.g. due to an ASID rollover). The write will be retried
+        and it'll cause a VM_FAULT_WRITE, that marks the page as dirty*/
+        splx(spl);
+        return;
+    }
+    index = sh->ipt_index[entry];
+    KASSERT(index != -1);
+    splx(spl);
+    paddr = get_writable_page(faultvaddr, index);
+    if(paddr == 0){
+        /*The slot was replaced and the frame evicted before get_writable_page locked the IPT. The write will be retried*/
+        return;
+    }
+    lo = paddr | TLBLO_VALID | TLBLO_DIRTY;
+    if(paddr != index * PAGE_SIZE + peps.firstfreepaddr){
+        /*The page was copied in a new frame. If the process ran on other CPUs, their TLBs may still have an entry that maps the old frame,
+        and we'd read the old page when we run there again: we invalidate the page on all the CPUs before going back to user mode*/
+        tlb_invalidate_page(faultvaddr);
+    }
+    /*The interrupts were enabled, and if the page was shared getting a new frame may have required a victim selection, i.e. we may have slept:
+    our entry may have been replaced in the meanwhile (even the ASID may have changed, and we may be on another CPU), so we search it again*/
+    spl = splhigh();
+    sh = cur_shadow();
+    hi = faultvaddr | (as->asid[curcpu->c_number] << TLBHI_PID_SHIFT);
+    entry = tlb_probe(hi, 0);
+    if(paddr == index * PAGE_SIZE + peps.firstfreepaddr){
+        if(entry >= 0){
+            tlb_write(hi, lo, entry); // the frame is private, so we just make the entry writable
+            sh->ref[entry] = 1;
+        }
+        #if OPT_UTLB_REFILL
+        if(sh->refill_hi[UTLB_SET(hi)] == hi){
+            sh->refill_lo[UTLB_SET(hi)] = lo; // otherwise the UTLB handler would write the page back without write privilege
+        }
+        #endif
+        /*Otherwise the page is already dirty, so the retried write will insert it with write privilege*/
+        splx(spl);
+        return;
+    }
+    /*The page was copied in a new frame, that the IPT already considers in the TLB*/
+    #if OPT_UTLB_REFILL
+    tlb_make_resident(sh, hi, lo, (paddr - peps.firstfreepaddr) / PAGE_SIZE, tlb_page_is_hot(faultvaddr)); // it drops the entry of the old frame
+    #else
+    if(entry >= 0){
+        tlb_release_slot(sh, entry); // the entry maps the old frame
+    }
+    else{
+        tlb_take_slot(sh, &entry); // this is not a TLB fault, so we don't update the statistics
+    }
+    tlb_fill_slot(sh, entry, hi, lo, (paddr - peps.firstfreepaddr) / PAGE_SIZE, tlb_page_is_hot(faultvaddr));
+    #endif
+    as->tlb_cpus |= (uint32_t)1 << curcpu->c_number;
+    splx(spl);
+}
+
 /**
  * This function tells me if the entry in the TLB at index i is valid or not.
 */
@@ -182,30 +550,320 @@ int tlb_invalidate_entry(paddr_t paddr){
 }
 
 /**
- * this function has to invalidate the TLB when there is a switch from a process to another. Indeed, 
- * the TLB is common for all processes and does not have a "pid" field.
+ * This function is called by as_activate. It makes the TLB match only the entries tagged with the ASID of the given
+ * address space, assigning it a new ASID if the one it has belongs to an old generation.
 */
-void tlb_invalidate_all(void){
-    uint32_t hi, lo;
+void tlb_activate(struct addrspace *as){
     pid_t pid = curproc->p_pid; // I extract the pid of the currently running process
-    if(previous_pid != pid) // the process (not the thread) changed. This is necessary because as_activate is called also when the thread changes.
+    int survived = 0;
+    struct tlb *sh = cur_shadow(); // as_activate disabled the interrupts
+    unsigned cpu = curcpu->c_number; // each CPU assigns its own ASIDs, since it has its own TLB
+
+    if(as->asid_generation[cpu] != sh->asid_generation) // the address space is new here or its ASID was assigned before the last rollover of this CPU
     {
-    DEBUG(DB_VM,"NEW PROCESS RUNNING: %d INSTEAD OF %d\n",pid,previous_pid);
+        if(sh->asid_next == NUM_ASID){ // all the ASIDs of this generation have been used
+            DEBUG(DB_VM,"ASID ROLLOVER\n");
 
-    /*I update the correct statistics*/
-    add_tlb_invalidation();
+            /*I update the correct statistics*/
+            add_tlb_invalidation();
+            add_asid_rollover();
+
+            tlb_flush(); // no entry with an ASID of the previous generation must survive
+            sh->asid_generation++;
+            sh->asid_next = 1;
+        }
+        as->asid[cpu] = sh->asid_next++;
+        as->asid_generation[cpu] = sh->asid_generation;
+    }
+
+    if(sh->previous_pid != pid) // the process (not the thread) changed. This is necessary because as_activate is called also when the thread changes.
+    {
+        DEBUG(DB_VM,"NEW PROCESS RUNNING ON CPU %u: %d INSTEAD OF %d (ASID %d)\n",cpu,pid,sh->previous_pid,as->asid[cpu]);
+
+        /*The entries of the new process still in the TLB are reloads that we avoided by not invalidating the TLB*/
+        #if OPT_UTLB_REFILL
+        for(int i = 0; i<UTLB_SETS; i++){
+            if(sh->refill_hi[i] != 0 && sh->refill_pid[i] == pid){
+                survived++; // the pages in the TLB are resident too, and the others will be put back by the UTLB handler
+            }
+        }
+        #else
+        for(int i = 0; i<NUM_TLB; i++){
+            if(sh->ipt_index[i] != -1 && sh->pid[i] == pid){
+                survived++;
+            }
+        }
+        #endif
+        add_avoided_reloads(survived);
+
+        sh->previous_pid = pid; // I update previous_pid so that the next time that the function is called on this CPU I can determine if the process has changed.
+    }
+
+    tlb_setasid(as->asid[cpu] << TLBHI_PID_SHIFT);
+}
 
+/**
+ * This function invalidates all the entries of the TLB, informing the IPT that they are not cached anymore.
+*/
+void tlb_flush(void){
+    struct tlb *sh = cur_shadow();
+    #if OPT_UTLB_REFILL
+    /*The valid slots map resident pages, so dropping the refill table empties the TLB too*/
+    for(int i = 0; i<UTLB_SETS; i++){
+        if(sh->refill_hi[i] != 0){
+            tlb_drop_resident(sh, i);
+        }
+    }
+    #else
     /*I iterate on all the entries*/
     for(int i = 0; i<NUM_TLB; i++){
-            if(tlb_entry_is_valid(i)){ // If the entry is valid
-                tlb_read(&hi,&lo,i); // retrieve the content
-                update_tlb_bit(hi,previous_pid); // I inform the Page Table that the entry identified by the pair (vaddr, pid) will not be "cached" anymore
-            }
-            tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i); // I override the entry
+        if(sh->ipt_index[i] != -1){ // If the entry is valid
+            tlb_drop_slot(sh, i); // I inform the Page Table that the entry will not be "cached" anymore and I override it
+        }
+    }
+    #endif
+    KASSERT(sh->nfree == NUM_TLB);
+}
+
+/**
+ * This function tells if the shootdown ts must invalidate an entry that maps the frame index for the page vaddr of the process pid.
+*/
+static int tlb_shootdown_match(const struct tlbshootdown *ts, int index, pid_t pid, vaddr_t vaddr){
+    unsigned j;
+    int match = 0;
+
+    switch (ts->ts_type)
+    {
+    case TS_PID:
+        match = pid == ts->ts_pid;
+        break;
+    case TS_PAGE:
+        if(pid == ts->ts_pid){
+            for(j = 0; j<ts->ts_count && !match; j++){
+                match = vaddr == ts->ts_arg[j];
             }
-    previous_pid = pid; // I update the global variable previous_pid so that the next time that the function is called I can determine if the process has changed.
+        }
+        break;
+    case TS_FRAMES:
+        for(j = 0; j<ts->ts_count && !match; j++){
+            match = (uint32_t)index == ts->ts_arg[j];
+        }
+        break;
+
+    default:
+        panic("Unknown TLB shootdown type %d\n", ts->ts_type);
+    }
+    return match;
+}
+
+/**
+ * This function performs the given shootdown on the TLB of the current CPU, and it returns the number of entries that it invalidated.
+ * It must be called with the interrupts disabled.
+*/
+static unsigned tlb_shootdown_local(const struct tlbshootdown *ts){
+    struct tlb *sh = cur_shadow();
+    unsigned n = 0;
+    int i;
+
+    #if OPT_UTLB_REFILL
+    for(i = 0; i<UTLB_SETS; i++){
+        /*The resident pages include the ones in the TLB, and the others must go too, otherwise the UTLB handler could put them back*/
+        if(sh->refill_hi[i] != 0 && tlb_shootdown_match(ts, sh->refill_ipt[i], sh->refill_pid[i], sh->refill_hi[i] & TLBHI_VPAGE)){
+            tlb_drop_resident(sh, i);
+            n++;
+        }
     }
+    #else
+    for(i = 0; i<NUM_TLB; i++){
+        if(sh->ipt_index[i] != -1 && tlb_shootdown_match(ts, sh->ipt_index[i], sh->pid[i], sh->vaddr[i])){
+            tlb_drop_slot(sh, i);
+            n++;
+        }
+    }
+    #endif
+    return n;
+}
+
+/**
+ * This function performs the shootdown ts on the TLB of the current CPU and sends it, with a single IPI, to the other CPUs in mask.
+ * Then it waits until all of them have performed it.
+ * It must be called without holding any spinlock and with the interrupts enabled: the other CPUs need pt_spinlock to perform the
+ * shootdown, and while we wait they may be waiting for a shootdown that they sent to us.
+*/
+static void tlb_shootdown_all(struct tlbshootdown *ts, uint32_t mask){
+    struct tlbshootdown_wait wait;
+    unsigned sent, skipped;
+    int spl, done;
+
+    KASSERT(curcpu->c_spinlocks == 0);
+    spinlock_init(&wait.lock);
+    wait.pending = 0;
+    ts->ts_wait = &wait;
+
+    spl = splhigh(); // we can't be moved to another CPU between the local invalidation and the choice of the other CPUs
+    tlb_shootdown_local(ts);
+    sent = ipi_tlbshootdown_mask(mask, ts, &skipped);
+    splx(spl);
+
+    add_shootdown_stat(SHOOTDOWN_SKIPPED_CPUS, skipped);
+    if(sent > 0){
+        add_shootdown_stat(SHOOTDOWNS, 1);
+        add_shootdown_stat(SHOOTDOWN_IPIS, sent);
+        KASSERT(curthread->t_iplhigh_count == 0); // the interrupts must be enabled, to receive the shootdowns sent to us while we wait
+        /*The CPUs may have already decremented pending, so it's 0 only when all of them are done*/
+        spinlock_acquire(&wait.lock);
+        wait.pending += sent;
+        done = wait.pending == 0;
+        spinlock_release(&wait.lock);
+        while(!done){
+            spinlock_acquire(&wait.lock);
+            done = wait.pending == 0;
+            spinlock_release(&wait.lock);
+        }
+    }
+    spinlock_cleanup(&wait.lock);
+}
+
+/**
+ * This function performs on the TLB of the current CPU a shootdown sent by another CPU, and then it tells the sender that it's done.
+*/
+void tlb_shootdown(const struct tlbshootdown *ts){
+    unsigned n;
+    int spl;
+
+    spl = splhigh();
+    n = tlb_shootdown_local(ts);
+    splx(spl);
+    add_shootdown_stat(SHOOTDOWN_REMOTE_ENTRIES, n);
+
+    spinlock_acquire(&ts->ts_wait->lock);
+    ts->ts_wait->pending--; // after this the sender may return, so we can't use ts->ts_wait anymore
+    spinlock_release(&ts->ts_wait->lock);
+}
+
+/**
+ * This function invalidates the entries of the TLB that map pages of the given process.
+*/
+void tlb_invalidate_pid(pid_t pid){
+    struct tlbshootdown ts;
+    struct addrspace *as = proc_getas();
+
+    KASSERT(pid == curproc->p_pid);
+    ts.ts_type = TS_PID;
+    ts.ts_pid = pid;
+    ts.ts_count = 0;
+    /*Only the CPUs where the process inserted some entry receive the IPI. Without an address space we don't know them, so we send it to all*/
+    tlb_shootdown_all(&ts, as != NULL ? as->tlb_cpus : ~(uint32_t)0);
+    if(as != NULL){
+        as->tlb_cpus = 0; // no TLB contains entries of the process anymore
+    }
+}
+
+/**
+ * This function invalidates, on all the CPUs, the entries of the current process that map the given page.
+*/
+void tlb_invalidate_page(vaddr_t vaddr){
+    struct tlbshootdown ts;
+    struct addrspace *as = proc_getas();
+
+    ts.ts_type = TS_PAGE;
+    ts.ts_pid = curproc->p_pid;
+    ts.ts_count = 1;
+    ts.ts_arg[0] = vaddr & PAGE_FRAME;
+    tlb_shootdown_all(&ts, as->tlb_cpus);
+}
+
+/**
+ * This function removes the given frames from the TLBs of all the CPUs, with a single shootdown.
+*/
+void tlb_steal_frames(uint32_t *frames, unsigned n){
+    struct tlbshootdown ts;
+
+    KASSERT(n > 0 && n <= TS_BATCH);
+    ts.ts_type = TS_FRAMES;
+    ts.ts_pid = 0;
+    ts.ts_count = n;
+    for(unsigned j = 0; j<n; j++){
+        ts.ts_arg[j] = frames[j];
+    }
+    tlb_shootdown_all(&ts, ~(uint32_t)0); // a frame may be shared by more processes, so we don't know which TLBs contain it
+    add_shootdown_stat(SHOOTDOWN_STOLEN_FRAMES, n);
+}
+
+/**
+ * This function initializes the shadows of the TLBs. At boot all the slots are invalid.
+ * It's called before the other CPUs are started, and each of them empties its TLB when it starts (tlb_reset in start.S), so
+ * here we only need to empty the TLB of the boot CPU.
+*/
+void tlb_init(void){
+    #if OPT_UTLB_REFILL
+    /*The UTLB handler accesses the shadow with the offsets of mips/utlb.h*/
+    COMPILE_ASSERT(UTLB_SLOTS == NUM_TLB);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, ipt_index) == UTLB_SH_IPT);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, pid) == UTLB_SH_PID);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, vaddr) == UTLB_SH_VADDR);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, free_slots) == UTLB_FREE);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, nfree) == UTLB_NFREE);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, hand) == UTLB_HAND);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, refill_hi) == UTLB_RF_HI);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, refill_lo) == UTLB_RF_LO);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, refill_ipt) == UTLB_RF_IPT);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, refill_pid) == UTLB_RF_PID);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, fast_refills) == UTLB_REFILLS);
+    COMPILE_ASSERT(__builtin_offsetof(struct tlb, utlb_save) == UTLB_SAVE);
+    #endif
+    for(int c = 0; c<MAXCPUS; c++){
+        for(int i = 0; i<NUM_TLB; i++){
+            shadow[c].ipt_index[i] = -1;
+            shadow[c].pid[i] = 0;
+            shadow[c].vaddr[i] = 0;
+            #if OPT_UTLB_REFILL
+            shadow[c].ref[i] = 1; // the UTLB handler doesn't update ref, so it must always be 1 (only tlb_nru clears it)
+            #else
+            shadow[c].ref[i] = 0;
+            #endif
+            shadow[c].hot[i] = 0;
+            shadow[c].free_slots[i] = NUM_TLB - 1 - i; // we pop from the end, so slot 0 will be the first one used
+        }
+        shadow[c].nfree = NUM_TLB;
+        shadow[c].asid_next = 1;
+        shadow[c].asid_generation = 1; // a new address space has generation 0, so it will get an ASID the first time it's activated on this CPU
+        shadow[c].previous_pid = 0;
+        shadow[c].hand = 0;
+        for(int i = 0; i<TLB_RECENT_VICTIMS; i++){
+            shadow[c].victim_vaddr[i] = 0;
+            shadow[c].victim_pid[i] = 0;
+        }
+        shadow[c].next_recent = 0;
+        #if OPT_UTLB_REFILL
+        for(int i = 0; i<UTLB_SETS; i++){
+            shadow[c].refill_hi[i] = 0;
+        }
+        shadow[c].fast_refills = 0;
+        tlb_shadows[c] = &shadow[c]; // from now on the UTLB handler of the CPU uses the refill table
+        #endif
+    }
+    for(int i = 0; i<NUM_TLB; i++){
+        tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    }
+    #if OPT_UTLB_TRACE
+    tlb_trace_init();
+    #endif
 }
+
+/**
+ * This function returns the number of TLB misses handled by the UTLB handler on all the CPUs.
+*/
+uint32_t tlb_fast_refills(void){
+    uint32_t n = 0;
+    #if OPT_UTLB_REFILL
+    for(int c = 0; c<MAXCPUS; c++){
+        n += shadow[c].fast_refills;
+    }
+    #endif
+    return n;
+}
+
 /**
  * Useful for debugging reasons eheh :^)
 */
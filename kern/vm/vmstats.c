@@ -1,4 +1,22 @@
 #include "vmstats.h"
+#include "vm.h"
+#include "vm_tlb.h"
+#include "opt-tlb_random.h"
+#include "opt-tlb_nru.h"
+#include "opt-tlb_hot.h"
+#include "opt-utlb_refill.h"
+
+#if OPT_UTLB_REFILL
+#define TLB_POLICY_NAME "direct mapped with refill table"
+#elif OPT_TLB_RANDOM
+#define TLB_POLICY_NAME "random"
+#elif OPT_TLB_NRU
+#define TLB_POLICY_NAME "NRU"
+#elif OPT_TLB_HOT
+#define TLB_POLICY_NAME "hot text and stack"
+#else
+#define TLB_POLICY_NAME "round robin"
+#endif
 
 /*
  * This function is used to initialize stats
@@ -16,6 +34,80 @@ void init_stat(void){
     stat.pt_disk_faults=0;
     stat.pt_elf_faults=0;
     stat.pt_swapfile_faults=0;
+
+    stat.swap_writes=0;
+
+    stat.free_list_hits=0;
+    stat.victim_selections=0;
+    stat.victim_scan_steps=0;
+
+    stat.hash_lookups=0;
+    stat.hash_probes=0;
+    stat.hash_max_probes=0;
+    stat.hash_resizes=0;
+
+    stat.asid_rollovers=0;
+    stat.avoided_reloads=0;
+
+    stat.dirty_faults=0;
+    stat.clean_evictions=0;
+
+    stat.swap_cache_avoided_writes=0;
+    stat.swap_cache_reclaims=0;
+
+    stat.cow_shared_pages=0;
+    stat.cow_copies=0;
+    stat.cow_last_mappings=0;
+
+    stat.shootdowns=0;
+    stat.shootdown_ipis=0;
+    stat.shootdown_skipped_cpus=0;
+    stat.shootdown_remote_entries=0;
+    stat.shootdown_stolen_frames=0;
+
+    stat.tlb_policy_victims=0;
+    stat.tlb_policy_refaults=0;
+    stat.tlb_policy_spared=0;
+    stat.tlb_policy_sampled=0;
+
+    stat.tsb_hits=0;
+    stat.tsb_misses=0;
+    stat.readahead_pages=0;
+    stat.readahead_hits=0;
+    stat.readahead_wasted=0;
+    stat.swap_cluster_writes=0;
+    stat.swap_cluster_pages=0;
+    stat.swap_readaround_pages=0;
+    stat.pageout_wakeups=0;
+    stat.pageout_daemon_frames=0;
+    stat.pageout_direct=0;
+    stat.fault_ns=0;
+    stat.zero_pool_hits=0;
+    stat.zero_pool_misses=0;
+    stat.zero_pool_fills=0;
+    stat.zero_fill_ns=0;
+    stat.text_share_hits=0;
+    stat.text_share_loads=0;
+    stat.page_cache_hits=0;
+    stat.page_cache_misses=0;
+    stat.page_cache_reclaims=0;
+    stat.buddy_allocs=0;
+    stat.buddy_merges=0;
+    stat.buddy_grows=0;
+    stat.buddy_evictions=0;
+    stat.buddy_fallbacks=0;
+    stat.swap_slot_sequential=0;
+    stat.swap_slot_near=0;
+    stat.swap_slot_extents=0;
+    stat.swap_slot_scattered=0;
+    stat.swap_ios=0;
+    stat.swap_seek_pages=0;
+    stat.zswap_stores=0;
+    stat.zswap_rejects=0;
+    stat.zswap_hits=0;
+    stat.zswap_writebacks=0;
+    stat.zswap_bytes=0;
+    stat.reload_ns=0;
     /*Other additional fields can be added if needed*/
 }
 
@@ -122,100 +214,1119 @@ uint32_t swap_write_stat(void){
     return s;
 }
 
-/*-----------------------------UTILITY FUNCTIONS-----------------------------------------------------*/
+/**
+ * This function returns the correct statistic about the allocation of frames according to a type parameter
+ * passed as an argument. Type can be either:
+ * - FREE_LIST_HIT (0)
+ * - VICTIM_SELECTION (1)
+ * - VICTIM_SCAN_STEP (2)
+ * as defined in the header file.
+*/
+uint32_t frame_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case FREE_LIST_HIT:
+        s = stat.free_list_hits;
+        break;
+    case VICTIM_SELECTION:
+        s = stat.victim_selections;
+        break;
+    case VICTIM_SCAN_STEP:
+        s = stat.victim_scan_steps;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
 
 /**
- * This function increments the value of "tlb_faults"
+ * This function returns the correct statistic about the hash table according to a type parameter
+ * passed as an argument. Type can be either:
+ * - HASH_LOOKUPS (0)
+ * - HASH_PROBES (1)
+ * - HASH_MAX_PROBES (2)
+ * - HASH_RESIZES (3)
+ * as defined in the header file.
 */
-void add_tlb_fault(void){
-    //spinlock_acquire(&stat.lock);
-    stat.tlb_faults++;
-    //spinlock_release(&stat.lock);
+uint32_t hash_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case HASH_LOOKUPS:
+        s = stat.hash_lookups;
+        break;
+    case HASH_PROBES:
+        s = stat.hash_probes;
+        break;
+    case HASH_MAX_PROBES:
+        s = stat.hash_max_probes;
+        break;
+    case HASH_RESIZES:
+        s = stat.hash_resizes;
+        break;
+
+    default:
+        break;
+    }
+    return s;
 }
 
 /**
- * This function increments the correct field of the structure according to a "type" parameter passed as an argument.
- * type can be either: 
- * - FAULT_W_FREE (0)
- * - FAULT_W_REPLACE (1)
- * as defined in the header file
+ * This function returns the correct statistic about the ASIDs according to a type parameter
+ * passed as an argument. Type can be either:
+ * - ASID_ROLLOVERS (0)
+ * - AVOIDED_RELOADS (1)
+ * as defined in the header file.
 */
-void add_tlb_type_fault(int type){
-    //spinlock_acquire(&stat.lock);
+uint32_t asid_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case ASID_ROLLOVERS:
+        s = stat.asid_rollovers;
+        break;
+    case AVOIDED_RELOADS:
+        s = stat.avoided_reloads;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
 
+/**
+ * This function returns the correct statistic about the dirty pages according to a type parameter
+ * passed as an argument. Type can be either:
+ * - DIRTY_FAULT (0)
+ * - CLEAN_EVICTION (1)
+ * as defined in the header file.
+*/
+uint32_t dirty_stats(int type){
+    uint32_t s=0;
     switch (type)
     {
-    case FAULT_W_FREE:
-        stat.tlb_free_faults++;
-       
+    case DIRTY_FAULT:
+        s = stat.dirty_faults;
         break;
-    case FAULT_W_REPLACE:
-        stat.tlb_replace_faults++;
+    case CLEAN_EVICTION:
+        s = stat.clean_evictions;
         break;
+
     default:
         break;
     }
-    //spinlock_release(&stat.lock);
+    return s;
 }
 
 /**
- * This function increments the value of the field "tlb_invalidations" each time the whole TLB is invalidated due to a process switch.
+ * This function returns the correct statistic about the swap cache according to a type parameter
+ * passed as an argument. Type can be either:
+ * - AVOIDED_WRITE (0)
+ * - CACHE_RECLAIM (1)
+ * as defined in the header file.
 */
-void add_tlb_invalidation(void){
-    //spinlock_acquire(&stat.lock);
-    stat.tlb_invalidations++;
-    //spinlock_release(&stat.lock);
+uint32_t swap_cache_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case AVOIDED_WRITE:
+        s = stat.swap_cache_avoided_writes;
+        break;
+    case CACHE_RECLAIM:
+        s = stat.swap_cache_reclaims;
+        break;
+
+    default:
+        break;
+    }
+    return s;
 }
 
 /**
- * This function increments the value tlb_reloads each time there is a TLB fault for a page that is already in memory.
+ * This function returns the correct statistic about copy on write according to a type parameter
+ * passed as an argument. Type can be either:
+ * - COW_SHARED_PAGE (0)
+ * - COW_COPY (1)
+ * - COW_LAST_MAPPING (2)
+ * as defined in the header file.
 */
-void add_tlb_reload(void){
-    //spinlock_acquire(&stat.lock);
-    stat.tlb_reloads++;
-    //spinlock_release(&stat.lock);
+uint32_t cow_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case COW_SHARED_PAGE:
+        s = stat.cow_shared_pages;
+        break;
+    case COW_COPY:
+        s = stat.cow_copies;
+        break;
+    case COW_LAST_MAPPING:
+        s = stat.cow_last_mappings;
+        break;
+
+    default:
+        break;
+    }
+    return s;
 }
 
 /**
- * This function increments the value of the correct statistic on the page faults accordig to a type received as a parameter. This type can be either
- * - ZEROED (0)
- * - DISK (1)
- * - ELF (2)
- * - SWAPFILE (3)
- * as defined in the header file
+ * This function returns the correct statistic about the TLB shootdowns according to a type parameter
+ * passed as an argument. Type can be either:
+ * - SHOOTDOWNS (0)
+ * - SHOOTDOWN_IPIS (1)
+ * - SHOOTDOWN_SKIPPED_CPUS (2)
+ * - SHOOTDOWN_REMOTE_ENTRIES (3)
+ * - SHOOTDOWN_STOLEN_FRAMES (4)
+ * as defined in the header file.
 */
-void add_pt_type_fault(int type){
-    //spinlock_acquire(&stat.lock);
+uint32_t shootdown_stats(int type){
+    uint32_t s=0;
     switch (type)
-        {
-        case ZEROED:
-            stat.pt_zeroed_faults++;
-            break;
-        case DISK:
-            stat.pt_disk_faults++;
-            break;
-        case ELF:
-            stat.pt_elf_faults++;
-            break;
-        case SWAPFILE:
-            stat.pt_swapfile_faults++;
-            break;
+    {
+    case SHOOTDOWNS:
+        s = stat.shootdowns;
+        break;
+    case SHOOTDOWN_IPIS:
+        s = stat.shootdown_ipis;
+        break;
+    case SHOOTDOWN_SKIPPED_CPUS:
+        s = stat.shootdown_skipped_cpus;
+        break;
+    case SHOOTDOWN_REMOTE_ENTRIES:
+        s = stat.shootdown_remote_entries;
+        break;
+    case SHOOTDOWN_STOLEN_FRAMES:
+        s = stat.shootdown_stolen_frames;
+        break;
 
-        default:
-            break;
-        }
-        //spinlock_release(&stat.lock);
- 
+    default:
+        break;
+    }
+    return s;
 }
 
 /**
- * This function increments the value of "swap_writes" each time there has been a page fault that required
- * writing a page to the swap file.
+ * This function returns the correct statistic about the TLB replacement policy according to a type parameter
+ * passed as an argument. Type can be either:
+ * - TLB_POLICY_VICTIMS (0)
+ * - TLB_POLICY_REFAULTS (1)
+ * - TLB_POLICY_SPARED (2)
+ * - TLB_POLICY_SAMPLED (3)
+ * as defined in the header file.
 */
-void add_swap_writes(void){
-    //spinlock_acquire(&stat.lock);
-    stat.swap_writes++;
-    //spinlock_release(&stat.lock);
+uint32_t tlb_policy_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case TLB_POLICY_VICTIMS:
+        s = stat.tlb_policy_victims;
+        break;
+    case TLB_POLICY_REFAULTS:
+        s = stat.tlb_policy_refaults;
+        break;
+    case TLB_POLICY_SPARED:
+        s = stat.tlb_policy_spared;
+        break;
+    case TLB_POLICY_SAMPLED:
+        s = stat.tlb_policy_sampled;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the TSB according to a type parameter
+ * passed as an argument. Type can be either:
+ * - TSB_HITS (0)
+ * - TSB_MISSES (1)
+ * - RELOAD_LATENCY (2), the average over all the TLB reloads
+ * as defined in the header file.
+*/
+uint32_t tsb_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case TSB_HITS:
+        s = stat.tsb_hits;
+        break;
+    case TSB_MISSES:
+        s = stat.tsb_misses;
+        break;
+    case RELOAD_LATENCY:
+        s = stat.tlb_reloads ? (uint32_t)(stat.reload_ns / stat.tlb_reloads) : 0;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the readahead according to a type parameter
+ * passed as an argument. Type can be either:
+ * - READAHEAD_PAGES (0)
+ * - READAHEAD_HITS (1)
+ * - READAHEAD_WASTED (2)
+ * as defined in the header file.
+*/
+uint32_t readahead_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case READAHEAD_PAGES:
+        s = stat.readahead_pages;
+        break;
+    case READAHEAD_HITS:
+        s = stat.readahead_hits;
+        break;
+    case READAHEAD_WASTED:
+        s = stat.readahead_wasted;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the clusters of the swapfile according to a type parameter
+ * passed as an argument. Type can be either:
+ * - SWAP_CLUSTER_WRITES (0)
+ * - SWAP_CLUSTER_PAGES (1)
+ * - SWAP_READAROUND_PAGES (2)
+ * as defined in the header file.
+*/
+uint32_t swap_cluster_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case SWAP_CLUSTER_WRITES:
+        s = stat.swap_cluster_writes;
+        break;
+    case SWAP_CLUSTER_PAGES:
+        s = stat.swap_cluster_pages;
+        break;
+    case SWAP_READAROUND_PAGES:
+        s = stat.swap_readaround_pages;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the reclaim of the frames according to a type parameter
+ * passed as an argument. Type can be either:
+ * - PAGEOUT_WAKEUPS (0)
+ * - PAGEOUT_DAEMON_FRAMES (1)
+ * - PAGEOUT_DIRECT (2)
+ * - FAULT_LATENCY (3), the average over all the page faults (from disk or zeroed)
+ * as defined in the header file.
+*/
+uint32_t pageout_stats(int type){
+    uint32_t s=0, faults;
+    switch (type)
+    {
+    case PAGEOUT_WAKEUPS:
+        s = stat.pageout_wakeups;
+        break;
+    case PAGEOUT_DAEMON_FRAMES:
+        s = stat.pageout_daemon_frames;
+        break;
+    case PAGEOUT_DIRECT:
+        s = stat.pageout_direct;
+        break;
+    case FAULT_LATENCY:
+        faults = stat.pt_disk_faults + stat.pt_zeroed_faults;
+        s = faults ? (uint32_t)(stat.fault_ns / faults) : 0;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the pool of zeroed frames according to a type parameter
+ * passed as an argument. Type can be either:
+ * - ZERO_POOL_HITS (0)
+ * - ZERO_POOL_MISSES (1)
+ * - ZERO_POOL_FILLS (2)
+ * - ZERO_FILL_LATENCY (3), the average over all the zero-fill faults (hits and misses)
+ * as defined in the header file.
+*/
+uint32_t zero_pool_stats(int type){
+    uint32_t s=0, faults;
+    switch (type)
+    {
+    case ZERO_POOL_HITS:
+        s = stat.zero_pool_hits;
+        break;
+    case ZERO_POOL_MISSES:
+        s = stat.zero_pool_misses;
+        break;
+    case ZERO_POOL_FILLS:
+        s = stat.zero_pool_fills;
+        break;
+    case ZERO_FILL_LATENCY:
+        faults = stat.zero_pool_hits + stat.zero_pool_misses;
+        s = faults ? (uint32_t)(stat.zero_fill_ns / faults) : 0;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the sharing of the text pages according to a type parameter
+ * passed as an argument. Type can be either:
+ * - TEXT_SHARE_HITS (0)
+ * - TEXT_SHARE_LOADS (1)
+ * as defined in the header file.
+*/
+uint32_t text_share_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case TEXT_SHARE_HITS:
+        s = stat.text_share_hits;
+        break;
+    case TEXT_SHARE_LOADS:
+        s = stat.text_share_loads;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the page cache according to a type parameter
+ * passed as an argument. Type can be either:
+ * - PAGE_CACHE_HITS (0)
+ * - PAGE_CACHE_MISSES (1)
+ * - PAGE_CACHE_RECLAIMS (2)
+ * as defined in the header file.
+*/
+uint32_t page_cache_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case PAGE_CACHE_HITS:
+        s = stat.page_cache_hits;
+        break;
+    case PAGE_CACHE_MISSES:
+        s = stat.page_cache_misses;
+        break;
+    case PAGE_CACHE_RECLAIMS:
+        s = stat.page_cache_reclaims;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the buddy allocator according to a type parameter
+ * passed as an argument. Type can be either:
+ * - BUDDY_ALLOCS (0)
+ * - BUDDY_MERGES (1)
+ * - BUDDY_GROWS (2)
+ * - BUDDY_EVICTIONS (3)
+ * - BUDDY_FALLBACKS (4)
+ * as defined in the header file.
+*/
+uint32_t buddy_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case BUDDY_ALLOCS:
+        s = stat.buddy_allocs;
+        break;
+    case BUDDY_MERGES:
+        s = stat.buddy_merges;
+        break;
+    case BUDDY_GROWS:
+        s = stat.buddy_grows;
+        break;
+    case BUDDY_EVICTIONS:
+        s = stat.buddy_evictions;
+        break;
+    case BUDDY_FALLBACKS:
+        s = stat.buddy_fallbacks;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the allocation of the pages of the swapfile according to a type parameter
+ * passed as an argument. Type can be either:
+ * - SWAP_SLOT_SEQUENTIAL (0)
+ * - SWAP_SLOT_NEAR (1)
+ * - SWAP_SLOT_EXTENTS (2)
+ * - SWAP_SLOT_SCATTERED (3)
+ * - SWAP_SLOT_IOS (4)
+ * - SWAP_SLOT_SEEK (5)
+ * as defined in the header file.
+*/
+uint32_t swap_slot_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case SWAP_SLOT_SEQUENTIAL:
+        s = stat.swap_slot_sequential;
+        break;
+    case SWAP_SLOT_NEAR:
+        s = stat.swap_slot_near;
+        break;
+    case SWAP_SLOT_EXTENTS:
+        s = stat.swap_slot_extents;
+        break;
+    case SWAP_SLOT_SCATTERED:
+        s = stat.swap_slot_scattered;
+        break;
+    case SWAP_SLOT_IOS:
+        s = stat.swap_ios;
+        break;
+    case SWAP_SLOT_SEEK:
+        s = stat.swap_seek_pages;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/**
+ * This function returns the correct statistic about the compressed pool of the swapfile according to a type parameter
+ * passed as an argument. Type can be either:
+ * - ZSWAP_STORES (0)
+ * - ZSWAP_REJECTS (1)
+ * - ZSWAP_HITS (2)
+ * - ZSWAP_WRITEBACKS (3)
+ * - ZSWAP_BYTES (4)
+ * as defined in the header file.
+*/
+uint32_t zswap_stats(int type){
+    uint32_t s=0;
+    switch (type)
+    {
+    case ZSWAP_STORES:
+        s = stat.zswap_stores;
+        break;
+    case ZSWAP_REJECTS:
+        s = stat.zswap_rejects;
+        break;
+    case ZSWAP_HITS:
+        s = stat.zswap_hits;
+        break;
+    case ZSWAP_WRITEBACKS:
+        s = stat.zswap_writebacks;
+        break;
+    case ZSWAP_BYTES:
+        s = stat.zswap_bytes;
+        break;
+
+    default:
+        break;
+    }
+    return s;
+}
+
+/*-----------------------------UTILITY FUNCTIONS-----------------------------------------------------*/
+
+/**
+ * This function increments the value of "tlb_faults"
+*/
+void add_tlb_fault(void){
+    //spinlock_acquire(&stat.lock);
+    stat.tlb_faults++;
+    //spinlock_release(&stat.lock);
+}
+
+/**
+ * This function increments the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either: 
+ * - FAULT_W_FREE (0)
+ * - FAULT_W_REPLACE (1)
+ * as defined in the header file
+*/
+void add_tlb_type_fault(int type){
+    //spinlock_acquire(&stat.lock);
+
+    switch (type)
+    {
+    case FAULT_W_FREE:
+        stat.tlb_free_faults++;
+       
+        break;
+    case FAULT_W_REPLACE:
+        stat.tlb_replace_faults++;
+        break;
+    default:
+        break;
+    }
+    //spinlock_release(&stat.lock);
+}
+
+/**
+ * This function increments the value of the field "tlb_invalidations" each time the whole TLB is invalidated due to a process switch.
+*/
+void add_tlb_invalidation(void){
+    //spinlock_acquire(&stat.lock);
+    stat.tlb_invalidations++;
+    //spinlock_release(&stat.lock);
+}
+
+/**
+ * This function increments the value tlb_reloads each time there is a TLB fault for a page that is already in memory.
+*/
+void add_tlb_reload(void){
+    //spinlock_acquire(&stat.lock);
+    stat.tlb_reloads++;
+    //spinlock_release(&stat.lock);
+}
+
+/**
+ * This function increments the value of the correct statistic on the page faults accordig to a type received as a parameter. This type can be either
+ * - ZEROED (0)
+ * - DISK (1)
+ * - ELF (2)
+ * - SWAPFILE (3)
+ * as defined in the header file
+*/
+void add_pt_type_fault(int type){
+    //spinlock_acquire(&stat.lock);
+    switch (type)
+        {
+        case ZEROED:
+            stat.pt_zeroed_faults++;
+            break;
+        case DISK:
+            stat.pt_disk_faults++;
+            break;
+        case ELF:
+            stat.pt_elf_faults++;
+            break;
+        case SWAPFILE:
+            stat.pt_swapfile_faults++;
+            break;
+
+        default:
+            break;
+        }
+        //spinlock_release(&stat.lock);
+ 
+}
+
+/**
+ * This function increments the value of "swap_writes" each time there has been a page fault that required
+ * writing a page to the swap file.
+*/
+void add_swap_writes(void){
+    //spinlock_acquire(&stat.lock);
+    stat.swap_writes++;
+    //spinlock_release(&stat.lock);
+}
+
+/**
+ * This function increments the value of the correct statistic on the allocation of frames according to a type received as a parameter. This type can be either
+ * - FREE_LIST_HIT (0)
+ * - VICTIM_SELECTION (1)
+ * - VICTIM_SCAN_STEP (2)
+ * as defined in the header file
+*/
+void add_frame_stat(int type){
+    switch (type)
+        {
+        case FREE_LIST_HIT:
+            stat.free_list_hits++;
+            break;
+        case VICTIM_SELECTION:
+            stat.victim_selections++;
+            break;
+        case VICTIM_SCAN_STEP:
+            stat.victim_scan_steps++;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function updates the hash statistics after a lookup in the hash table that read "probes" slots.
+*/
+void add_hash_lookup(uint32_t probes){
+    stat.hash_lookups++;
+    stat.hash_probes+=probes;
+    if(probes>stat.hash_max_probes){
+        stat.hash_max_probes=probes;
+    }
+}
+
+/**
+ * This function increments the value of "hash_resizes" each time the hash table is doubled.
+*/
+void add_hash_resize(void){
+    stat.hash_resizes++;
+}
+
+/**
+ * This function increments the value of "asid_rollovers" each time the ASIDs are exhausted and the TLB is flushed.
+*/
+void add_asid_rollover(void){
+    stat.asid_rollovers++;
+}
+
+/**
+ * This function adds to "avoided_reloads" the number of TLB entries that a process finds still valid when it's scheduled again.
+*/
+void add_avoided_reloads(uint32_t n){
+    stat.avoided_reloads+=n;
+}
+
+/**
+ * This function increments the value of the correct statistic on the dirty pages according to a type received as a parameter. This type can be either
+ * - DIRTY_FAULT (0)
+ * - CLEAN_EVICTION (1)
+ * as defined in the header file
+*/
+void add_dirty_stat(int type){
+    switch (type)
+        {
+        case DIRTY_FAULT:
+            stat.dirty_faults++;
+            break;
+        case CLEAN_EVICTION:
+            stat.clean_evictions++;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function increments the value of "swap_cache_avoided_writes" each time a page is not written in the swapfile because
+ * the swap cache already has a copy of it.
+*/
+void add_swap_cache_stat(int type){
+    if(type==AVOIDED_WRITE){
+        stat.swap_cache_avoided_writes++;
+    }
+}
+
+/**
+ * This function adds to "swap_cache_reclaims" the number of swap cache entries released because the swapfile was full.
+*/
+void add_swap_cache_reclaim(uint32_t n){
+    stat.swap_cache_reclaims+=n;
+}
+
+/**
+ * This function increments the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - COW_SHARED_PAGE (0)
+ * - COW_COPY (1)
+ * - COW_LAST_MAPPING (2)
+ * as defined in the header file
+*/
+void add_cow_stat(int type){
+    switch (type)
+        {
+        case COW_SHARED_PAGE:
+            stat.cow_shared_pages++;
+            break;
+        case COW_COPY:
+            stat.cow_copies++;
+            break;
+        case COW_LAST_MAPPING:
+            stat.cow_last_mappings++;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - SHOOTDOWNS (0)
+ * - SHOOTDOWN_IPIS (1)
+ * - SHOOTDOWN_SKIPPED_CPUS (2)
+ * - SHOOTDOWN_REMOTE_ENTRIES (3)
+ * - SHOOTDOWN_STOLEN_FRAMES (4)
+ * as defined in the header file
+*/
+void add_shootdown_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case SHOOTDOWNS:
+            stat.shootdowns+=n;
+            break;
+        case SHOOTDOWN_IPIS:
+            stat.shootdown_ipis+=n;
+            break;
+        case SHOOTDOWN_SKIPPED_CPUS:
+            stat.shootdown_skipped_cpus+=n;
+            break;
+        case SHOOTDOWN_REMOTE_ENTRIES:
+            stat.shootdown_remote_entries+=n;
+            break;
+        case SHOOTDOWN_STOLEN_FRAMES:
+            stat.shootdown_stolen_frames+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function increments the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - TLB_POLICY_VICTIMS (0)
+ * - TLB_POLICY_REFAULTS (1)
+ * - TLB_POLICY_SPARED (2)
+ * - TLB_POLICY_SAMPLED (3)
+ * as defined in the header file
+*/
+void add_tlb_policy_stat(int type){
+    switch (type)
+        {
+        case TLB_POLICY_VICTIMS:
+            stat.tlb_policy_victims++;
+            break;
+        case TLB_POLICY_REFAULTS:
+            stat.tlb_policy_refaults++;
+            break;
+        case TLB_POLICY_SPARED:
+            stat.tlb_policy_spared++;
+            break;
+        case TLB_POLICY_SAMPLED:
+            stat.tlb_policy_sampled++;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - TSB_HITS (0)
+ * - TSB_MISSES (1)
+ * - RELOAD_LATENCY (2), n is in nanoseconds
+ * as defined in the header file
+*/
+void add_tsb_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case TSB_HITS:
+            stat.tsb_hits+=n;
+            break;
+        case TSB_MISSES:
+            stat.tsb_misses+=n;
+            break;
+        case RELOAD_LATENCY:
+            stat.reload_ns+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - READAHEAD_PAGES (0)
+ * - READAHEAD_HITS (1)
+ * - READAHEAD_WASTED (2)
+ * as defined in the header file
+*/
+void add_readahead_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case READAHEAD_PAGES:
+            stat.readahead_pages+=n;
+            break;
+        case READAHEAD_HITS:
+            stat.readahead_hits+=n;
+            break;
+        case READAHEAD_WASTED:
+            stat.readahead_wasted+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - SWAP_CLUSTER_WRITES (0)
+ * - SWAP_CLUSTER_PAGES (1)
+ * - SWAP_READAROUND_PAGES (2)
+ * as defined in the header file
+*/
+void add_swap_cluster_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case SWAP_CLUSTER_WRITES:
+            stat.swap_cluster_writes+=n;
+            break;
+        case SWAP_CLUSTER_PAGES:
+            stat.swap_cluster_pages+=n;
+            break;
+        case SWAP_READAROUND_PAGES:
+            stat.swap_readaround_pages+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - PAGEOUT_WAKEUPS (0)
+ * - PAGEOUT_DAEMON_FRAMES (1)
+ * - PAGEOUT_DIRECT (2)
+ * - FAULT_LATENCY (3), n is in nanoseconds
+ * as defined in the header file
+*/
+void add_pageout_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case PAGEOUT_WAKEUPS:
+            stat.pageout_wakeups+=n;
+            break;
+        case PAGEOUT_DAEMON_FRAMES:
+            stat.pageout_daemon_frames+=n;
+            break;
+        case PAGEOUT_DIRECT:
+            stat.pageout_direct+=n;
+            break;
+        case FAULT_LATENCY:
+            stat.fault_ns+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - ZERO_POOL_HITS (0)
+ * - ZERO_POOL_MISSES (1)
+ * - ZERO_POOL_FILLS (2)
+ * - ZERO_FILL_LATENCY (3), n is in nanoseconds
+ * as defined in the header file
+*/
+void add_zero_pool_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case ZERO_POOL_HITS:
+            stat.zero_pool_hits+=n;
+            break;
+        case ZERO_POOL_MISSES:
+            stat.zero_pool_misses+=n;
+            break;
+        case ZERO_POOL_FILLS:
+            stat.zero_pool_fills+=n;
+            break;
+        case ZERO_FILL_LATENCY:
+            stat.zero_fill_ns+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - TEXT_SHARE_HITS (0)
+ * - TEXT_SHARE_LOADS (1)
+ * as defined in the header file
+*/
+void add_text_share_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case TEXT_SHARE_HITS:
+            stat.text_share_hits+=n;
+            break;
+        case TEXT_SHARE_LOADS:
+            stat.text_share_loads+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - PAGE_CACHE_HITS (0)
+ * - PAGE_CACHE_MISSES (1)
+ * - PAGE_CACHE_RECLAIMS (2)
+ * as defined in the header file
+*/
+void add_page_cache_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case PAGE_CACHE_HITS:
+            stat.page_cache_hits+=n;
+            break;
+        case PAGE_CACHE_MISSES:
+            stat.page_cache_misses+=n;
+            break;
+        case PAGE_CACHE_RECLAIMS:
+            stat.page_cache_reclaims+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - BUDDY_ALLOCS (0)
+ * - BUDDY_MERGES (1)
+ * - BUDDY_GROWS (2)
+ * - BUDDY_EVICTIONS (3)
+ * - BUDDY_FALLBACKS (4)
+ * as defined in the header file
+*/
+void add_buddy_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case BUDDY_ALLOCS:
+            stat.buddy_allocs+=n;
+            break;
+        case BUDDY_MERGES:
+            stat.buddy_merges+=n;
+            break;
+        case BUDDY_GROWS:
+            stat.buddy_grows+=n;
+            break;
+        case BUDDY_EVICTIONS:
+            stat.buddy_evictions+=n;
+            break;
+        case BUDDY_FALLBACKS:
+            stat.buddy_fallbacks+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - SWAP_SLOT_SEQUENTIAL (0)
+ * - SWAP_SLOT_NEAR (1)
+ * - SWAP_SLOT_EXTENTS (2)
+ * - SWAP_SLOT_SCATTERED (3)
+ * - SWAP_SLOT_IOS (4)
+ * - SWAP_SLOT_SEEK (5)
+ * as defined in the header file
+*/
+void add_swap_slot_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case SWAP_SLOT_SEQUENTIAL:
+            stat.swap_slot_sequential+=n;
+            break;
+        case SWAP_SLOT_NEAR:
+            stat.swap_slot_near+=n;
+            break;
+        case SWAP_SLOT_EXTENTS:
+            stat.swap_slot_extents+=n;
+            break;
+        case SWAP_SLOT_SCATTERED:
+            stat.swap_slot_scattered+=n;
+            break;
+        case SWAP_SLOT_IOS:
+            stat.swap_ios+=n;
+            break;
+        case SWAP_SLOT_SEEK:
+            stat.swap_seek_pages+=n;
+            break;
+
+        default:
+            break;
+        }
+}
+
+/**
+ * This function adds n to the correct field of the structure according to a "type" parameter passed as an argument.
+ * type can be either:
+ * - ZSWAP_STORES (0)
+ * - ZSWAP_REJECTS (1)
+ * - ZSWAP_HITS (2)
+ * - ZSWAP_WRITEBACKS (3)
+ * - ZSWAP_BYTES (4)
+ * as defined in the header file
+*/
+void add_zswap_stat(int type, uint32_t n){
+    switch (type)
+        {
+        case ZSWAP_STORES:
+            stat.zswap_stores+=n;
+            break;
+        case ZSWAP_REJECTS:
+            stat.zswap_rejects+=n;
+            break;
+        case ZSWAP_HITS:
+            stat.zswap_hits+=n;
+            break;
+        case ZSWAP_WRITEBACKS:
+            stat.zswap_writebacks+=n;
+            break;
+        case ZSWAP_BYTES:
+            stat.zswap_bytes+=n;
+            break;
+
+        default:
+            break;
+        }
 }
 
 /**
@@ -229,7 +1340,26 @@ void add_swap_writes(void){
 void print_stats(void){
     uint32_t faults, free_faults, replace_faults, invalidations, reloads,
              pf_zeroed, pf_disk, pf_elf, pf_swap,
-             swap_writes;
+             swap_writes,
+             free_hits, victims, scan_steps,
+             lookups, probes, max_probes, resizes,
+             rollovers, avoided,
+             dirty_faults, clean_evictions,
+             cache_avoided, cache_reclaims,
+             cow_shared, cow_copies, cow_last,
+             shootdowns, ipis, skipped, remote_entries, stolen,
+             policy_victims, policy_refaults, policy_spared, policy_sampled,
+             tsb_hits, tsb_misses, reload_latency,
+             fast_refills,
+             ra_pages, ra_hits, ra_wasted,
+             cluster_writes, cluster_pages, readaround,
+             pageout_wakeups, daemon_frames, direct_reclaims, fault_latency,
+             zero_hits, zero_misses, zero_fills, zero_latency,
+             text_hits, text_loads,
+             pcache_hits, pcache_misses, pcache_reclaims,
+             buddy_allocs, buddy_merges, buddy_grows, buddy_evictions, buddy_fallbacks,
+             slot_sequential, slot_near, slot_extents, slot_scattered, swap_ios, seek_pages,
+             zswap_stores, zswap_rejects, zswap_hits, zswap_writebacks, zswap_bytes, zswap_ratio;
     //spinlock_acquire(&stat.lock);
     /*TLB stats*/
     faults = tlb_fault_stats();
@@ -244,13 +1374,130 @@ void print_stats(void){
     pf_swap = pt_fault_stats(SWAPFILE);
     /*swap writes*/
     swap_writes = swap_write_stat();
+    /*frame allocation*/
+    free_hits = frame_stats(FREE_LIST_HIT);
+    victims = frame_stats(VICTIM_SELECTION);
+    scan_steps = frame_stats(VICTIM_SCAN_STEP);
+    /*hash table*/
+    lookups = hash_stats(HASH_LOOKUPS);
+    probes = hash_stats(HASH_PROBES);
+    max_probes = hash_stats(HASH_MAX_PROBES);
+    resizes = hash_stats(HASH_RESIZES);
+    /*ASIDs*/
+    rollovers = asid_stats(ASID_ROLLOVERS);
+    avoided = asid_stats(AVOIDED_RELOADS);
+    /*dirty pages*/
+    dirty_faults = dirty_stats(DIRTY_FAULT);
+    clean_evictions = dirty_stats(CLEAN_EVICTION);
+    /*swap cache*/
+    cache_avoided = swap_cache_stats(AVOIDED_WRITE);
+    cache_reclaims = swap_cache_stats(CACHE_RECLAIM);
+    /*copy on write*/
+    cow_shared = cow_stats(COW_SHARED_PAGE);
+    cow_copies = cow_stats(COW_COPY);
+    cow_last = cow_stats(COW_LAST_MAPPING);
+    /*TLB shootdowns*/
+    shootdowns = shootdown_stats(SHOOTDOWNS);
+    ipis = shootdown_stats(SHOOTDOWN_IPIS);
+    skipped = shootdown_stats(SHOOTDOWN_SKIPPED_CPUS);
+    remote_entries = shootdown_stats(SHOOTDOWN_REMOTE_ENTRIES);
+    stolen = shootdown_stats(SHOOTDOWN_STOLEN_FRAMES);
+    /*TLB replacement policy*/
+    policy_victims = tlb_policy_stats(TLB_POLICY_VICTIMS);
+    policy_refaults = tlb_policy_stats(TLB_POLICY_REFAULTS);
+    policy_spared = tlb_policy_stats(TLB_POLICY_SPARED);
+    policy_sampled = tlb_policy_stats(TLB_POLICY_SAMPLED);
+    /*TSB*/
+    tsb_hits = tsb_stats(TSB_HITS);
+    tsb_misses = tsb_stats(TSB_MISSES);
+    reload_latency = tsb_stats(RELOAD_LATENCY);
+    /*UTLB handler*/
+    fast_refills = tlb_fast_refills();
+    /*readahead*/
+    ra_pages = readahead_stats(READAHEAD_PAGES);
+    ra_hits = readahead_stats(READAHEAD_HITS);
+    ra_wasted = readahead_stats(READAHEAD_WASTED);
+    /*swap clusters*/
+    cluster_writes = swap_cluster_stats(SWAP_CLUSTER_WRITES);
+    cluster_pages = swap_cluster_stats(SWAP_CLUSTER_PAGES);
+    readaround = swap_cluster_stats(SWAP_READAROUND_PAGES);
+    /*reclaim*/
+    pageout_wakeups = pageout_stats(PAGEOUT_WAKEUPS);
+    daemon_frames = pageout_stats(PAGEOUT_DAEMON_FRAMES);
+    direct_reclaims = pageout_stats(PAGEOUT_DIRECT);
+    fault_latency = pageout_stats(FAULT_LATENCY);
+    /*pool of zeroed frames*/
+    zero_hits = zero_pool_stats(ZERO_POOL_HITS);
+    zero_misses = zero_pool_stats(ZERO_POOL_MISSES);
+    zero_fills = zero_pool_stats(ZERO_POOL_FILLS);
+    zero_latency = zero_pool_stats(ZERO_FILL_LATENCY);
+    /*shared text pages*/
+    text_hits = text_share_stats(TEXT_SHARE_HITS);
+    text_loads = text_share_stats(TEXT_SHARE_LOADS);
+    /*page cache*/
+    pcache_hits = page_cache_stats(PAGE_CACHE_HITS);
+    pcache_misses = page_cache_stats(PAGE_CACHE_MISSES);
+    pcache_reclaims = page_cache_stats(PAGE_CACHE_RECLAIMS);
+    /*buddy allocator*/
+    buddy_allocs = buddy_stats(BUDDY_ALLOCS);
+    buddy_merges = buddy_stats(BUDDY_MERGES);
+    buddy_grows = buddy_stats(BUDDY_GROWS);
+    buddy_evictions = buddy_stats(BUDDY_EVICTIONS);
+    buddy_fallbacks = buddy_stats(BUDDY_FALLBACKS);
+    /*swap slots*/
+    slot_sequential = swap_slot_stats(SWAP_SLOT_SEQUENTIAL);
+    slot_near = swap_slot_stats(SWAP_SLOT_NEAR);
+    slot_extents = swap_slot_stats(SWAP_SLOT_EXTENTS);
+    slot_scattered = swap_slot_stats(SWAP_SLOT_SCATTERED);
+    swap_ios = swap_slot_stats(SWAP_SLOT_IOS);
+    seek_pages = swap_slot_stats(SWAP_SLOT_SEEK);
+    /*compressed swap pool*/
+    zswap_stores = zswap_stats(ZSWAP_STORES);
+    zswap_rejects = zswap_stats(ZSWAP_REJECTS);
+    zswap_hits = zswap_stats(ZSWAP_HITS);
+    zswap_writebacks = zswap_stats(ZSWAP_WRITEBACKS);
+    zswap_bytes = zswap_stats(ZSWAP_BYTES);
+    zswap_ratio = zswap_bytes ? (uint32_t)((uint64_t)zswap_stores * PAGE_SIZE * 100 / zswap_bytes) : 0; //Hundredths
     //spinlock_release(&stat.lock);
     /*print statistics and errors if present*/
     kprintf("TLB stats: TLB faults = %d\tTLB Faults with Free = %d\tTLB Faults with Replace = %d\tTLB Invalidations = %d\tTLB Reloads = %d\n", 
             faults, free_faults, replace_faults, invalidations, reloads);
+    kprintf("TSB stats: TSB hits = %d\tTSB misses = %d\tAverage reload latency = %d ns\n", tsb_hits, tsb_misses, reload_latency);
+    kprintf("UTLB stats: Fast refills (not counted as TLB faults) = %d\n", fast_refills);
     kprintf("PT stats: Page Faults(Zeroed) = %d\tPage Faults(Disk) = %d\tPage Faults from Elf = %d\tPage Faults from Swapfile = %d\n", 
             pf_zeroed, pf_disk, pf_elf, pf_swap);
     kprintf("Swapfile writes = %d\n", swap_writes);
+    kprintf("Reclaim stats: Pageout daemon wakeups = %d\tFrames freed by the daemon = %d\tDirect reclaims = %d\tAverage page fault latency = %d ns\n",
+            pageout_wakeups, daemon_frames, direct_reclaims, fault_latency);
+    kprintf("Zero pool stats: Pool hits = %d\tPool misses = %d\tFrames zeroed in advance = %d\tAverage zero-fill latency = %d ns\n",
+            zero_hits, zero_misses, zero_fills, zero_latency);
+    kprintf("Text sharing stats: Shared faults = %d\tIndexed pages loaded = %d\n",
+            text_hits, text_loads);
+    kprintf("Page cache stats: Hits = %d\tMisses = %d\tCached frames reclaimed = %d\n",
+            pcache_hits, pcache_misses, pcache_reclaims);
+    kprintf("Buddy stats: Kernel allocations = %d\tMerges = %d\tChunks taken from the IPT = %d\tUser pages evicted for the kernel = %d\tFallbacks to the IPT scan = %d\n",
+            buddy_allocs, buddy_merges, buddy_grows, buddy_evictions, buddy_fallbacks);
+    kprintf("Swap slot stats: Sequential pages = %d\tNearby pages = %d\tNew extents = %d\tScattered pages = %d\tSwapfile I/Os = %d\tAverage seek distance = %d.%02d pages\n",
+            slot_sequential, slot_near, slot_extents, slot_scattered, swap_ios,
+            swap_ios ? seek_pages/swap_ios : 0, swap_ios ? (seek_pages*100/swap_ios)%100 : 0);
+    kprintf("Zswap stats: Pages stored compressed = %d\tIncompressible pages = %d\tCompression ratio = %d.%02d\tPool hits = %d\tWritebacks = %d\tDisk I/Os avoided = %d\n",
+            zswap_stores, zswap_rejects, zswap_ratio/100, zswap_ratio%100, zswap_hits, zswap_writebacks,
+            zswap_stores - zswap_writebacks + zswap_hits);
+    kprintf("Swap cluster stats: Clustered writes = %d\tPages in clustered writes = %d\tPages read around = %d\n",
+            cluster_writes, cluster_pages, readaround);
+    kprintf("Readahead stats: Pages read ahead = %d\tReadahead hits = %d\tWasted pages = %d\n", ra_pages, ra_hits, ra_wasted);
+    kprintf("Frame stats: Free list hits = %d\tVictim selections = %d\tVictim scan steps = %d\n",
+            free_hits, victims, scan_steps);
+    kprintf("Hash stats: Lookups = %d\tProbes = %d\tAverage probes per lookup = %d.%02d\tMax probes = %d\tResizes = %d\n",
+            lookups, probes, lookups ? probes/lookups : 0, lookups ? (probes*100/lookups)%100 : 0, max_probes, resizes);
+    kprintf("ASID stats: ASID rollovers = %d\tAvoided reloads = %d\n", rollovers, avoided);
+    kprintf("Dirty stats: Dirty faults = %d\tClean evictions = %d\n", dirty_faults, clean_evictions);
+    kprintf("Swap cache stats: Avoided writes = %d\tReclaimed entries = %d\n", cache_avoided, cache_reclaims);
+    kprintf("COW stats: Pages shared at fork = %d\tCopies on write = %d\tWrites without copy = %d\n", cow_shared, cow_copies, cow_last);
+    kprintf("Shootdown stats: Shootdowns = %d\tIPIs = %d\tCPUs skipped = %d\tRemote entries invalidated = %d\tFrames stolen from the TLBs = %d\n",
+            shootdowns, ipis, skipped, remote_entries, stolen);
+    kprintf("TLB policy stats (%s): Victims = %d\tFaults on recent victims = %d\tSpared slots = %d\tSampled accesses = %d\n",
+            TLB_POLICY_NAME, policy_victims, policy_refaults, policy_spared, policy_sampled);
     /*check on constraint 1*/
     if(faults!=(free_faults + replace_faults))
         kprintf("ERROR-constraint1: sum of TLB Faults with Free and TLB faults with replace should be equal to TLB Faults\n");
@@ -0,0 +1,427 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <vm.h>
+#include <mainbus.h>
+#include <vmstats.h>
+#include <zswap.h>
+
+#define ZHASH_BITS 12 //The hash table of the compressor has 2^12 entries
+#define ZHASH_SIZE (1 << ZHASH_BITS)
+#define ZHASH_EMPTY 0xffff //Position of an empty entry of the hash table (a page has 4096 bytes, so it's never a valid one)
+#define ZHASH(p) ((((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2]) * 2654435761U) >> (32 - ZHASH_BITS))
+#define ZLZ_MIN_MATCH 3 //Shorter matches cost more than the literals they replace
+#define ZLZ_MAX_MATCH (18 + 255) //Length nibble 15 plus an extra byte
+#define ZLZ_WINDOW 4096 //12 bits of distance
+
+/**
+ * Entry of the pool for a page of the swapfile. The entries that are waiting to be written back form a doubly linked LRU list
+ * (the most recently stored or loaded at the head).
+*/
+struct zentry{
+    int16_t frame;//Frame of the pool with the compressed page, -1 if the page isn't in the pool
+    uint8_t chunk;//First chunk of the compressed page in its frame
+    uint8_t wb;//1 if the page is being written back, so it's not in the LRU list anymore
+    uint16_t len;//Length of the compressed page, in bytes
+    int16_t prev;//Previous and next entries in the LRU list (pages of the swapfile), -1 at the ends
+    int16_t next;
+};
+
+static struct spinlock zswap_lock = SPINLOCK_INITIALIZER; //It protects the entries, the LRU list and the bitmaps of the frames
+static struct zentry *zentries; //One entry for each page of the swapfile
+static char *zpool; //Frames of the pool, contiguous
+static uint32_t *zmap; //Two words for each frame of the pool: the bit of a chunk is set if the chunk is in use
+static int *zfree; //Free chunks of each frame of the pool
+static int nframes; //Frames of the pool
+static int nfree; //Free chunks of the pool
+static int nstored; //Pages in the pool
+static int lru_head = -1, lru_tail = -1;
+
+static struct lock *zcomp_lock; //It protects the buffers of the compressor, so a thread can sleep while compressing
+static uint16_t zhash[ZHASH_SIZE]; //Last position of each hash of 3 bytes
+static unsigned char zbuf[ZSWAP_MAX_LEN]; //Output of the compressor
+
+/**
+ * LZSS compressor. The output is a sequence of groups of up to 8 items, each group preceded by a flag byte where the bit i is set if
+ * the item i is a match. A literal is a single byte. A match is a copy of the bytes at a distance of 1-4096 bytes back in the page,
+ * encoded in 2 bytes: the length (3-17, minus 3) in the high nibble and the distance (minus 1) in the remaining 12 bits. The length
+ * nibble 15 means that a third byte follows, with the length minus 18. A match can overlap the bytes it produces, so a run of
+ * zeroes costs 3 bytes every 273.
+ * The matches are found with a hash table of the last position of each sequence of 3 bytes: it's greedy and it doesn't look for the
+ * longest match, but the pages of the processes (zeroes, arrays of small integers, code) compress well with it.
+ *
+ * @return the length of the output, -1 if it would exceed max bytes
+*/
+static int lz_compress(const unsigned char *src, unsigned char *dst, int max)
+{
+    int ip = 0, op = 0, flags = 0, nitems = 8, len, ref, off, h;
+
+    for (h = 0; h < ZHASH_SIZE; h++)
+    {
+        zhash[h] = ZHASH_EMPTY;
+    }
+
+    while (ip < PAGE_SIZE)
+    {
+        if (nitems == 8) //A new group starts with its flag byte
+        {
+            if (op >= max)
+            {
+                return -1;
+            }
+            flags = op++;
+            dst[flags] = 0;
+            nitems = 0;
+        }
+
+        len = 0;
+        ref = ZHASH_EMPTY;
+        if (ip + ZLZ_MIN_MATCH <= PAGE_SIZE)
+        {
+            h = ZHASH(src + ip);
+            ref = zhash[h];
+            zhash[h] = ip;
+            if (ref != ZHASH_EMPTY && ip - ref <= ZLZ_WINDOW && src[ref] == src[ip] && src[ref + 1] == src[ip + 1] && src[ref + 2] == src[ip + 2])
+            {
+                len = ZLZ_MIN_MATCH;
+                while (ip + len < PAGE_SIZE && len < ZLZ_MAX_MATCH && src[ref + len] == src[ip + len])
+                {
+                    len++;
+                }
+            }
+        }
+
+        if (len > 0)
+        {
+            off = ip - ref - 1;
+            if (op + (len < 18 ? 2 : 3) > max)
+            {
+                return -1;
+            }
+            dst[flags] |= 1 << nitems;
+            dst[op++] = (len < 18 ? len - ZLZ_MIN_MATCH : 15) << 4 | off >> 8;
+            dst[op++] = off & 0xff;
+            if (len >= 18)
+            {
+                dst[op++] = len - 18;
+            }
+            for (int k = 1; k < len && ip + k + ZLZ_MIN_MATCH <= PAGE_SIZE; k++) //The bytes inside the match can start the next ones
+            {
+                zhash[ZHASH(src + ip + k)] = ip + k;
+            }
+            ip += len;
+        }
+        else
+        {
+            if (op >= max)
+            {
+                return -1;
+            }
+            dst[op++] = src[ip++];
+        }
+        nitems++;
+    }
+
+    return op;
+}
+
+/**
+ * It decompresses the len bytes at src, produced by lz_compress, in the page dst.
+*/
+static void lz_decompress(const unsigned char *src, int len, unsigned char *dst)
+{
+    int ip = 0, op = 0, flags = 0, nitems = 8, n, off;
+
+    while (ip < len)
+    {
+        if (nitems == 8)
+        {
+            flags = src[ip++];
+            nitems = 0;
+        }
+        if (flags & (1 << nitems))
+        {
+            n = (src[ip] >> 4) + ZLZ_MIN_MATCH;
+            off = ((src[ip] & 0xf) << 8 | src[ip + 1]) + 1;
+            ip += 2;
+            if (n == 18)
+            {
+                n += src[ip++];
+            }
+            KASSERT(off <= op && op + n <= PAGE_SIZE);
+            for (; n > 0; n--, op++) //Byte by byte, since the match may overlap its output
+            {
+                dst[op] = dst[op - off];
+            }
+        }
+        else
+        {
+            KASSERT(op < PAGE_SIZE);
+            dst[op++] = src[ip++];
+        }
+        nitems++;
+    }
+    KASSERT(op == PAGE_SIZE);
+}
+
+/**
+ * Helpers for the bitmaps of the frames of the pool. They're called with zswap_lock held.
+*/
+static int chunk_used(int frame, int chunk)
+{
+    return (zmap[frame * 2 + chunk / 32] >> (chunk % 32)) & 1;
+}
+
+static void chunk_set(int frame, int chunk, int n, int used)
+{
+    for (int k = chunk; k < chunk + n; k++)
+    {
+        if (used)
+        {
+            zmap[frame * 2 + k / 32] |= 1U << (k % 32);
+        }
+        else
+        {
+            zmap[frame * 2 + k / 32] &= ~(1U << (k % 32));
+        }
+    }
+    zfree[frame] += used ? -n : n;
+    nfree += used ? -n : n;
+}
+
+/**
+ * It searches n adjacent free chunks in a frame of the pool (first fit). The frames with less than n free chunks are skipped without
+ * looking at their bitmap.
+ *
+ * @return the first chunk, -1 if there's no room for n chunks
+*/
+static int chunk_alloc(int n, int *frame)
+{
+    int run;
+
+    if (nfree < n)
+    {
+        return -1;
+    }
+    for (int f = 0; f < nframes; f++)
+    {
+        if (zfree[f] < n)
+        {
+            continue;
+        }
+        run = 0;
+        for (int c = 0; c < ZSWAP_CHUNKS; c++)
+        {
+            run = chunk_used(f, c) ? 0 : run + 1;
+            if (run == n)
+            {
+                chunk_set(f, c - n + 1, n, 1);
+                *frame = f;
+                return c - n + 1;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Helpers for the LRU list. They're called with zswap_lock held.
+*/
+static void lru_remove(int slot)
+{
+    struct zentry *e = &zentries[slot];
+
+    if (e->prev != -1)
+    {
+        zentries[e->prev].next = e->next;
+    }
+    else
+    {
+        lru_head = e->next;
+    }
+    if (e->next != -1)
+    {
+        zentries[e->next].prev = e->prev;
+    }
+    else
+    {
+        lru_tail = e->prev;
+    }
+    e->prev = e->next = -1;
+}
+
+static void lru_push(int slot)
+{
+    struct zentry *e = &zentries[slot];
+
+    e->prev = -1;
+    e->next = lru_head;
+    if (lru_head != -1)
+    {
+        zentries[lru_head].prev = slot;
+    }
+    else
+    {
+        lru_tail = slot;
+    }
+    lru_head = slot;
+}
+
+void zswap_init(int nslots)
+{
+    KASSERT(nslots <= 32767); //The links of the LRU list are 16 bits
+
+    nframes = (mainbus_ramsize() - ram_stealmem(0)) / PAGE_SIZE * ZSWAP_PCT / 100;
+    if (nframes == 0)
+    {
+        nframes = 1;
+    }
+
+    /**
+     * The pool is taken before the IPT is created, so its frames are never used by the processes and the pool doesn't compete with
+     * the pages it holds.
+    */
+    zpool = kmalloc(nframes * PAGE_SIZE);
+    zmap = kmalloc(nframes * 2 * sizeof(uint32_t));
+    zfree = kmalloc(nframes * sizeof(int));
+    zentries = kmalloc(nslots * sizeof(struct zentry));
+    zcomp_lock = lock_create("zswap_comp");
+    if (zpool == NULL || zmap == NULL || zfree == NULL || zentries == NULL || zcomp_lock == NULL)
+    {
+        panic("Error during the allocation of the compressed swap pool");
+    }
+
+    for (int f = 0; f < nframes; f++)
+    {
+        zmap[f * 2] = zmap[f * 2 + 1] = 0;
+        zfree[f] = ZSWAP_CHUNKS;
+    }
+    for (int s = 0; s < nslots; s++)
+    {
+        zentries[s].frame = -1;
+        zentries[s].wb = 0;
+        zentries[s].prev = zentries[s].next = -1;
+    }
+    nfree = nframes * ZSWAP_CHUNKS;
+    nstored = 0;
+}
+
+int zswap_store(int slot, paddr_t paddr)
+{
+    int len, chunk, frame;
+
+    lock_acquire(zcomp_lock);
+
+    len = lz_compress((const unsigned char *)PADDR_TO_KVADDR(paddr), zbuf, ZSWAP_MAX_LEN);
+    if (len == -1)
+    {
+        lock_release(zcomp_lock);
+        add_zswap_stat(ZSWAP_REJECTS, 1);
+        return -1;
+    }
+
+    spinlock_acquire(&zswap_lock);
+    KASSERT(zentries[slot].frame == -1);
+    chunk = chunk_alloc(DIVROUNDUP(len, ZSWAP_CHUNK), &frame);
+    if (chunk == -1)
+    {
+        spinlock_release(&zswap_lock);
+        lock_release(zcomp_lock);
+        return 0;
+    }
+    memcpy(zpool + frame * PAGE_SIZE + chunk * ZSWAP_CHUNK, zbuf, len);
+    zentries[slot].frame = frame;
+    zentries[slot].chunk = chunk;
+    zentries[slot].len = len;
+    zentries[slot].wb = 0;
+    lru_push(slot);
+    nstored++;
+    spinlock_release(&zswap_lock);
+
+    lock_release(zcomp_lock);
+
+    add_zswap_stat(ZSWAP_STORES, 1);
+    add_zswap_stat(ZSWAP_BYTES, len);
+
+    return 1;
+}
+
+int zswap_load(int slot, void *kbuf)
+{
+    struct zentry *e = &zentries[slot];
+
+    spinlock_acquire(&zswap_lock);
+    if (e->frame == -1)
+    {
+        spinlock_release(&zswap_lock);
+        return 0;
+    }
+    lz_decompress((unsigned char *)zpool + e->frame * PAGE_SIZE + e->chunk * ZSWAP_CHUNK, e->len, kbuf);
+    if (!e->wb) //With the swap cache the page stays in the pool, so it becomes the most recently used one
+    {
+        lru_remove(slot);
+        lru_push(slot);
+    }
+    spinlock_release(&zswap_lock);
+
+    return 1;
+}
+
+int zswap_contains(int slot)
+{
+    int found;
+
+    spinlock_acquire(&zswap_lock);
+    found = zentries[slot].frame != -1;
+    spinlock_release(&zswap_lock);
+
+    return found;
+}
+
+int zswap_victim(void)
+{
+    int slot;
+
+    spinlock_acquire(&zswap_lock);
+    slot = lru_tail;
+    if (slot != -1)
+    {
+        lru_remove(slot);
+        zentries[slot].wb = 1;
+    }
+    spinlock_release(&zswap_lock);
+
+    return slot;
+}
+
+void zswap_drop(int slot)
+{
+    struct zentry *e = &zentries[slot];
+
+    spinlock_acquire(&zswap_lock);
+    if (e->frame != -1)
+    {
+        if (!e->wb)
+        {
+            lru_remove(slot);
+        }
+        chunk_set(e->frame, e->chunk, DIVROUNDUP(e->len, ZSWAP_CHUNK), 0);
+        e->frame = -1;
+        e->wb = 0;
+        nstored--;
+    }
+    spinlock_release(&zswap_lock);
+}
+
+void zswap_print_stats(void)
+{
+    int stored, used;
+
+    spinlock_acquire(&zswap_lock);
+    stored = nstored;
+    used = nframes * ZSWAP_CHUNKS - nfree;
+    spinlock_release(&zswap_lock);
+
+    kprintf("Compressed pool: %d pages in %d frames\tChunks in use = %d of %d\n", stored, nframes, used, nframes * ZSWAP_CHUNKS);
+}
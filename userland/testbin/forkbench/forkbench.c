@@ -0,0 +1,136 @@
+/*
+ * forkbench - fork throughput benchmark.
+ *
+ * Usage: forkbench [maxforkers] [forks]
+ *
+ * For each number of forking processes n = 1, 2, 4, ... up to
+ * maxforkers (default 8), it starts n processes that perform
+ * "forks" fork/waitpid pairs each (default 32), and it prints the
+ * number of forks completed per second. Each forking process writes
+ * a buffer of some pages before starting, so that every fork has an
+ * address space to share with its child; the child writes one page
+ * (causing a copy on write) and exits.
+ *
+ * With a single global fork lock the throughput doesn't grow with
+ * the number of forking processes.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE     4096
+#define NPAGES   16
+#define MAXFORKERS 32
+
+static char buffer[NPAGES*PAGE];
+
+/*
+ * Touch all the pages of the buffer, so that they're in memory and
+ * dirty when we fork.
+ */
+static
+void
+touch(int val)
+{
+	int i;
+
+	for (i=0; i<NPAGES; i++) {
+		buffer[i*PAGE] = val;
+	}
+}
+
+/*
+ * Body of a forking process: fork, let the child write one page and
+ * exit, wait for it.
+ */
+static
+void
+forker(int id, int forks)
+{
+	int i, pid, status;
+
+	touch(id);
+	for (i=0; i<forks; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			buffer[(i % NPAGES)*PAGE] = i;
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	if (buffer[0] != id) {
+		errx(1, "forker %d: buffer changed by a child - "
+		     "your vm is broken!", id);
+	}
+	_exit(0);
+}
+
+/*
+ * Run n forking processes at the same time and return the elapsed
+ * time in milliseconds.
+ */
+static
+unsigned long
+run(int n, int forks)
+{
+	int i, status;
+	pid_t pids[MAXFORKERS];
+	time_t s1, s2;
+	unsigned long ns1, ns2;
+
+	__time(&s1, &ns1);
+	for (i=0; i<n; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			forker(i+1, forks);
+		}
+	}
+	for (i=0; i<n; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	__time(&s2, &ns2);
+
+	return (s2-s1)*1000 + ns2/1000000 - ns1/1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n, maxforkers = 8, forks = 32;
+	unsigned long ms, total;
+
+	if (argc > 1) {
+		maxforkers = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		forks = atoi(argv[2]);
+	}
+	if (maxforkers < 1 || maxforkers > MAXFORKERS || forks < 1) {
+		errx(1, "Usage: forkbench [maxforkers (1-%d)] [forks]",
+		     MAXFORKERS);
+	}
+
+	printf("forkbench: %d forks per process\n", forks);
+	printf("forkers\tforks\tms\tforks/s\n");
+	for (n=1; n<=maxforkers; n*=2) {
+		ms = run(n, forks);
+		total = n*forks;
+		printf("%d\t%lu\t%lu\t%lu\n", n, total, ms,
+		       ms ? total*1000/ms : 0);
+	}
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * vmscale - VM throughput benchmark for multiprocessor configurations.
+ *
+ * Usage: vmscale [workers] [rounds]
+ *
+ * It starts "workers" processes (default 8) at the same time. Each of
+ * them performs "rounds" rounds (default 16): in each round it writes
+ * and then reads back all the pages of a private buffer, and it forks
+ * a child that writes one page (a copy on write) and exits. So the
+ * load causes TLB faults, page faults, copies on write and TLB
+ * shootdowns on process exit and fork, like parallelvm and
+ * forkbench together.
+ *
+ * It prints the number of pages touched per second. The number of
+ * cpus is set in sys161.conf (cpus= on the mainboard line); to see
+ * how the VM scales run it with the same arguments at 1, 2, 4 and 8
+ * cpus and compare the throughput. The kernel statistics printed at
+ * shutdown report the shootdowns that were needed.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE       4096
+#define NPAGES     32
+#define MAXWORKERS 32
+
+#define WORDS_PER_PAGE (PAGE/sizeof(int))
+
+static int buffer[NPAGES*WORDS_PER_PAGE];
+
+/*
+ * One round of a worker: write every page, fork a child that writes
+ * one of them, then check that our copy didn't change.
+ */
+static
+void
+do_round(int id, int r)
+{
+	unsigned i;
+	int pid, status;
+
+	for (i=0; i<NPAGES; i++) {
+		buffer[i*WORDS_PER_PAGE] = id*1000 + r;
+		buffer[i*WORDS_PER_PAGE + WORDS_PER_PAGE-1] = i;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		buffer[(r % NPAGES)*WORDS_PER_PAGE] = -1;
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+
+	for (i=0; i<NPAGES; i++) {
+		if (buffer[i*WORDS_PER_PAGE] != id*1000 + r ||
+		    buffer[i*WORDS_PER_PAGE + WORDS_PER_PAGE-1] != (int)i) {
+			errx(1, "worker %d: page %u has wrong contents - "
+			     "your vm is broken!", id, i);
+		}
+	}
+}
+
+static
+void
+worker(int id, int rounds)
+{
+	int r;
+
+	for (r=0; r<rounds; r++) {
+		do_round(id, r);
+	}
+	_exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, status, workers = 8, rounds = 16;
+	pid_t pids[MAXWORKERS];
+	time_t s1, s2;
+	unsigned long ns1, ns2, ms, pages;
+
+	if (argc > 1) {
+		workers = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (workers < 1 || workers > MAXWORKERS || rounds < 1) {
+		errx(1, "Usage: vmscale [workers (1-%d)] [rounds]",
+		     MAXWORKERS);
+	}
+
+	__time(&s1, &ns1);
+	for (i=0; i<workers; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			worker(i+1, rounds);
+		}
+	}
+	for (i=0; i<workers; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	__time(&s2, &ns2);
+
+	ms = (s2-s1)*1000 + ns2/1000000 - ns1/1000000;
+	/* each round writes and reads every page, and the child writes one */
+	pages = (unsigned long)workers * rounds * (2*NPAGES + 1);
+	printf("vmscale: %d workers, %d rounds\n", workers, rounds);
+	printf("workers\tpages\tms\tpages/s\n");
+	printf("%d\t%lu\t%lu\t%lu\n", workers, pages, ms,
+	       ms ? pages*1000/ms : 0);
+	return 0;
+}